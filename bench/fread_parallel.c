@@ -0,0 +1,139 @@
+/*
+ * fread_parallel.c
+ *
+ * compares wow_fread_bytes against wow_fread_bytes_parallel
+ * across thread counts and chunk sizes
+ *
+ * usage: fread_parallel [file] [megabytes]
+ *
+ * if the file doesn't exist, it is created with the given size
+ * (default 1024 mb); each run prints one line:
+ *   method threads chunk_kb cache seconds mb_per_s
+ *
+ * the cold cache runs ask the kernel to drop the file's pages
+ * first, which works best on a file that isn't being written
+ *
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#define WOW_USE_PTHREAD
+#define WOW_IMPLEMENTATION
+#include "wow.h"
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void drop_cache(FILE *fp)
+{
+#ifdef POSIX_FADV_DONTNEED
+	posix_fadvise(fileno(fp), 0, 0, POSIX_FADV_DONTNEED);
+#else
+	(void)fp; /* unused parameter */
+#endif
+}
+
+static int make_file(const char *name, size_t mb)
+{
+	FILE *fp;
+	unsigned char *block = wow_malloc_die(1024 * 1024);
+	size_t i;
+
+	for (i = 0; i < 1024 * 1024; ++i)
+		block[i] = i * 31;
+
+	if (!(fp = wow_fopen(name, "wb")))
+		return -1;
+	for (i = 0; i < mb; ++i)
+		wow_fwrite_bytes(block, 1024 * 1024, fp);
+	fclose(fp);
+	wow_free(block);
+
+	return 0;
+}
+
+static void run(
+	const char *name
+	, void *dst
+	, size_t bytes
+	, int threads
+	, size_t chunk
+	, int cold
+)
+{
+	FILE *fp = wow_fopen(name, "rb");
+	double start;
+	double secs;
+	size_t got;
+
+	if (!fp)
+		wow_die("failed to open '%s'", name);
+
+	if (cold)
+		drop_cache(fp);
+
+	start = now();
+	if (threads)
+		got = wow_fread_bytes_parallel(dst, bytes, fp, threads, chunk);
+	else
+		got = wow_fread_bytes(dst, bytes, fp);
+	secs = now() - start;
+	fclose(fp);
+
+	if (got != bytes)
+		wow_die("short read");
+
+	fprintf(stdout, "%s %d %lu %s %.4f %.1f\n"
+		, threads ? "parallel" : "fread_bytes"
+		, threads ? threads : 1
+		, (unsigned long)(chunk / 1024)
+		, cold ? "cold" : "warm"
+		, secs
+		, (bytes / (1024.0 * 1024.0)) / secs
+	);
+	fflush(stdout);
+}
+
+int wow_main(argc, argv)
+{
+	wow_main_args(argc, argv);
+	const char *name = (argc > 1) ? argv[1] : "fread_parallel.bin";
+	size_t mb = (argc > 2) ? strtoul(argv[2], 0, 0) : 1024;
+	static const int threads[] = { 1, 2, 4, 8, 16 };
+	static const size_t chunks[] = { 1, 8, 32 };
+	size_t bytes;
+	void *dst;
+	unsigned i;
+	unsigned k;
+	int cold;
+
+	if (!wow_is_dir(name) && access(name, F_OK) && make_file(name, mb))
+		wow_die("failed to create '%s'", name);
+
+	{
+		struct stat s;
+		if (stat(name, &s))
+			wow_die("failed to stat '%s'", name);
+		bytes = s.st_size;
+	}
+	dst = wow_malloc_die(bytes);
+	memset(dst, 0, bytes); /* fault the pages in before timing */
+
+	fprintf(stdout, "method threads chunk_kb cache seconds mb_per_s\n");
+	for (cold = 0; cold < 2; ++cold)
+	{
+		run(name, dst, bytes, 0, 0, cold);
+		for (k = 0; k < sizeof(chunks) / sizeof(chunks[0]); ++k)
+			for (i = 0; i < sizeof(threads) / sizeof(threads[0]); ++i)
+				run(name, dst, bytes, threads[i], chunks[k] * 1024 * 1024, cold);
+	}
+
+	wow_free(dst);
+
+	return 0;
+}
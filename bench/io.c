@@ -0,0 +1,550 @@
+/*
+ * io.c
+ *
+ * microbenchmarks for the wow.h i/o layer: wow_fread_bytes,
+ * wow_fwrite_bytes, wow_fopen and the directory wrappers, each
+ * next to plain stdio, read()/write() and mmap baselines
+ *
+ * usage: io [dir] [max_mb]
+ *
+ * the test files go in dir (default io_bench, which is created
+ * and emptied again afterwards); file sizes go from 4 kb up to
+ * max_mb (default 256; 4096 covers the full 4 gb range, which
+ * takes that much free memory and disk space); each run prints
+ * one line:
+ *   op method bytes cache iters seconds ns_per_op mb_per_s
+ * (bytes is 0 for ops that aren't about throughput; the list
+ * runs each read a directory of 1000 empty files; the
+ * wow_filecache_load runs are warm cache hits, which hand out
+ * the cached contents instead of copying them into a buffer;
+ * the bswap runs swap buf in place, in memory, and the
+ * wow_reader_swap runs read the file as 32-bit big-endian values)
+ *
+ * small sizes are repeated until they add up to 64 mb (at most
+ * 4096 times); the cold cache runs ask the kernel to drop the
+ * file's pages before every iteration, outside the timing
+ *
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <dirent.h>
+
+#define WOW_IMPLEMENTATION
+#include "wow.h"
+#include "wow_dirent.h"
+
+#define DIR_ENTRIES 1000
+
+typedef size_t (*io_func)(const char *path, void *buf, size_t bytes);
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void drop_cache(const char *path)
+{
+#ifdef POSIX_FADV_DONTNEED
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+#else
+	(void)path; /* unused parameter */
+#endif
+}
+
+static void result(
+	const char *op
+	, const char *method
+	, size_t bytes
+	, const char *cache
+	, size_t iters
+	, double secs
+)
+{
+	fprintf(stdout, "%s %s %lu %s %lu %.6f %.1f %.1f\n"
+		, op
+		, method
+		, (unsigned long)bytes
+		, cache
+		, (unsigned long)iters
+		, secs
+		, secs * 1e9 / iters
+		, bytes ? ((double)bytes * iters / (1024.0 * 1024.0)) / secs : 0
+	);
+	fflush(stdout);
+}
+
+/* readers: each opens, reads the whole file into buf, and closes */
+static size_t read_wow(const char *path, void *buf, size_t bytes)
+{
+	FILE *fp = wow_fopen(path, "rb");
+	size_t got;
+	if (!fp)
+		return 0;
+	got = wow_fread_bytes(buf, bytes, fp);
+	fclose(fp);
+	return got;
+}
+
+static size_t read_stdio(const char *path, void *buf, size_t bytes)
+{
+	FILE *fp = fopen(path, "rb");
+	size_t got;
+	if (!fp)
+		return 0;
+	got = fread(buf, 1, bytes, fp);
+	fclose(fp);
+	return got;
+}
+
+static size_t read_posix(const char *path, void *buf, size_t bytes)
+{
+	unsigned char *dst = buf;
+	size_t got = 0;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	while (got < bytes)
+	{
+		ssize_t n = read(fd, dst + got, bytes - got);
+		if (n <= 0)
+			break;
+		got += n;
+	}
+	close(fd);
+	return got;
+}
+
+static size_t read_mmap(const char *path, void *buf, size_t bytes)
+{
+	void *map;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	map = mmap(0, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return 0;
+	memcpy(buf, map, bytes);
+	munmap(map, bytes);
+	return bytes;
+}
+
+/* a wow_filecache hit: the contents are already in memory, so *
+ * the file is only stat()ed and nothing is copied into buf     */
+static struct wow_filecache *filecache;
+
+static size_t read_filecache(const char *path, void *buf, size_t bytes)
+{
+	size_t size;
+	const void *data = wow_filecache_load(filecache, path, &size);
+	(void)buf; /* unused parameter */
+	(void)bytes; /* unused parameter */
+	if (!data)
+		return 0;
+	wow_filecache_release(data);
+	return size;
+}
+
+/* big-endian 32-bit values: wow_reader_swap does the swap as *
+ * it copies out of the reader's buffer, against a plain read  *
+ * (straight into buf for large reads) and a swap afterwards   */
+static size_t read_reader_swap(const char *path, void *buf, size_t bytes)
+{
+	struct wow_reader *r = wow_reader_open(path, 0);
+	size_t got;
+	if (!r)
+		return 0;
+	wow_reader_swap(r, 4);
+	got = wow_reader_read(r, buf, bytes);
+	wow_reader_close(r);
+	return got;
+}
+
+static size_t read_reader_bswap(const char *path, void *buf, size_t bytes)
+{
+	struct wow_reader *r = wow_reader_open(path, 0);
+	size_t got;
+	if (!r)
+		return 0;
+	got = wow_reader_read(r, buf, bytes);
+	wow_reader_close(r);
+	wow_bswap32_array(buf, buf, got / 4);
+	return got;
+}
+
+/* writers: each creates the file, writes buf, and closes */
+static size_t write_wow(const char *path, void *buf, size_t bytes)
+{
+	FILE *fp = wow_fopen(path, "wb");
+	size_t done;
+	if (!fp)
+		return 0;
+	done = wow_fwrite_bytes(buf, bytes, fp);
+	if (fclose(fp))
+		return 0;
+	return done;
+}
+
+static size_t write_stdio(const char *path, void *buf, size_t bytes)
+{
+	FILE *fp = fopen(path, "wb");
+	size_t done;
+	if (!fp)
+		return 0;
+	done = fwrite(buf, 1, bytes, fp);
+	if (fclose(fp))
+		return 0;
+	return done;
+}
+
+static size_t write_posix(const char *path, void *buf, size_t bytes)
+{
+	const unsigned char *src = buf;
+	size_t done = 0;
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return 0;
+	while (done < bytes)
+	{
+		ssize_t n = write(fd, src + done, bytes - done);
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	close(fd);
+	return done;
+}
+
+static void run_io(
+	const char *op
+	, const char *method
+	, io_func func
+	, const char *path
+	, void *buf
+	, size_t bytes
+	, int cold
+)
+{
+	size_t iters = (64 * 1024 * 1024) / bytes;
+	double secs = 0;
+	size_t i;
+
+	if (iters < 1)
+		iters = 1;
+	else if (iters > 4096)
+		iters = 4096;
+
+	for (i = 0; i < iters; ++i)
+	{
+		double start;
+		if (cold)
+			drop_cache(path);
+		start = now();
+		if (func(path, buf, bytes) != bytes)
+			wow_die("%s %s failed on '%s'", op, method, path);
+		secs += now() - start;
+	}
+
+	result(op, method, bytes, cold ? "cold" : "warm", iters, secs);
+}
+
+/* the byte order kernels on buf in place, next to a plain loop *
+ * that swaps one value at a time                               */
+static void scalar_bswap16(void *buf, size_t count)
+{
+	uint16_t *p = buf;
+	size_t i;
+	for (i = 0; i < count; ++i)
+		p[i] = __builtin_bswap16(p[i]);
+}
+
+static void scalar_bswap32(void *buf, size_t count)
+{
+	uint32_t *p = buf;
+	size_t i;
+	for (i = 0; i < count; ++i)
+		p[i] = __builtin_bswap32(p[i]);
+}
+
+static void scalar_bswap64(void *buf, size_t count)
+{
+	uint64_t *p = buf;
+	size_t i;
+	for (i = 0; i < count; ++i)
+		p[i] = __builtin_bswap64(p[i]);
+}
+
+static void run_bswap(void *buf, size_t bytes)
+{
+	static const struct {
+		const char *method;
+		int size;
+		void (*func)(void *dst, const void *src, size_t count);
+		void (*scalar)(void *buf, size_t count);
+	} swaps[] = {
+		{ "wow_bswap16_array", 2, wow_bswap16_array, scalar_bswap16 }
+		, { "wow_bswap32_array", 4, wow_bswap32_array, scalar_bswap32 }
+		, { "wow_bswap64_array", 8, wow_bswap64_array, scalar_bswap64 }
+	};
+	size_t iters = (256 * 1024 * 1024) / bytes;
+	unsigned m;
+	size_t i;
+
+	if (iters < 1)
+		iters = 1;
+	else if (iters > 65536)
+		iters = 65536;
+
+	for (m = 0; m < sizeof(swaps) / sizeof(swaps[0]); ++m)
+	{
+		size_t count = bytes / swaps[m].size;
+		char scalar[64];
+		double start = now();
+
+		for (i = 0; i < iters; ++i)
+			swaps[m].func(buf, buf, count);
+		result("bswap", swaps[m].method, bytes, "warm", iters, now() - start);
+
+		snprintf(scalar, sizeof(scalar), "scalar_bswap%d", swaps[m].size * 8);
+		start = now();
+		for (i = 0; i < iters; ++i)
+			swaps[m].scalar(buf, count);
+		result("bswap", scalar, bytes, "warm", iters, now() - start);
+	}
+}
+
+/* opens and closes the same file over and over */
+static void run_open(const char *path, int use_wow)
+{
+	const size_t iters = 20000;
+	double start = now();
+	size_t i;
+
+	for (i = 0; i < iters; ++i)
+	{
+		FILE *fp = use_wow ? wow_fopen(path, "rb") : fopen(path, "rb");
+		if (!fp)
+			wow_die("failed to open '%s'", path);
+		fclose(fp);
+	}
+
+	result("open", use_wow ? "wow_fopen" : "fopen", 0, "warm", iters, now() - start);
+}
+
+static size_t list_wow(const char *path)
+{
+	struct wow_dirent *ep;
+	wow_DIR *dir = wow_opendir(path);
+	size_t count = 0;
+	if (!dir)
+		return 0;
+	while ((ep = wow_readdir(dir)))
+		count += 1;
+	wow_closedir(dir);
+	return count;
+}
+
+static size_t list_posix(const char *path)
+{
+	struct dirent *ep;
+	DIR *dir = opendir(path);
+	size_t count = 0;
+	if (!dir)
+		return 0;
+	while ((ep = readdir(dir)))
+		count += 1;
+	closedir(dir);
+	return count;
+}
+
+static enum wow_walk_action walk_count(const struct wow_walk_entry *entry, void *udata)
+{
+	(void)entry; /* unused parameter */
+	*(size_t*)udata += 1;
+	return WOW_WALK_CONTINUE;
+}
+
+static void run_dirs(const char *dir)
+{
+	struct wow_dircache *cache = wow_dircache_new();
+	char path[4096];
+	const size_t iters = 200;
+	double start;
+	size_t i;
+	struct stat s;
+
+	for (i = 0; i < DIR_ENTRIES; ++i)
+	{
+		FILE *fp;
+		snprintf(path, sizeof(path), "%s/list/%04lu.bin", dir, (unsigned long)i);
+		if (!(fp = wow_fopen(path, "wb")))
+			wow_die("failed to create '%s'", path);
+		fclose(fp);
+	}
+	snprintf(path, sizeof(path), "%s/list", dir);
+
+	start = now();
+	for (i = 0; i < iters; ++i)
+		if (list_wow(path) != DIR_ENTRIES + 2)
+			wow_die("wow_readdir came up short");
+	result("list", "wow_readdir", 0, "warm", iters, now() - start);
+
+	start = now();
+	for (i = 0; i < iters; ++i)
+		if (list_posix(path) != DIR_ENTRIES + 2)
+			wow_die("readdir came up short");
+	result("list", "readdir", 0, "warm", iters, now() - start);
+
+	start = now();
+	for (i = 0; i < iters; ++i)
+	{
+		size_t count = 0;
+		if (!wow_dircache_list(cache, path, &count) || count != DIR_ENTRIES)
+			wow_die("wow_dircache_list came up short");
+	}
+	result("list", "wow_dircache", 0, "warm", iters, now() - start);
+
+	start = now();
+	for (i = 0; i < iters; ++i)
+	{
+		size_t count = 0;
+		if (wow_walk(path, 1, walk_count, &count) || count != DIR_ENTRIES)
+			wow_die("wow_walk came up short");
+	}
+	result("list", "wow_walk", 0, "warm", iters, now() - start);
+
+	start = now();
+	for (i = 0; i < iters * 100; ++i)
+		if (!wow_is_dir(path))
+			wow_die("wow_is_dir failed");
+	result("is_dir", "wow_is_dir", 0, "warm", iters * 100, now() - start);
+
+	start = now();
+	for (i = 0; i < iters * 100; ++i)
+		if (stat(path, &s) || !S_ISDIR(s.st_mode))
+			wow_die("stat failed");
+	result("is_dir", "stat", 0, "warm", iters * 100, now() - start);
+
+	snprintf(path, sizeof(path), "%s/made", dir);
+	start = now();
+	for (i = 0; i < iters * 10; ++i)
+		if (wow_mkdir(path) || wow_remove(path))
+			wow_die("wow_mkdir/wow_remove failed");
+	result("mkdir", "wow_mkdir", 0, "warm", iters * 10, now() - start);
+
+	start = now();
+	for (i = 0; i < iters * 10; ++i)
+		if (mkdir(path, 0777) || rmdir(path))
+			wow_die("mkdir/rmdir failed");
+	result("mkdir", "mkdir", 0, "warm", iters * 10, now() - start);
+
+	wow_dircache_free(cache);
+	for (i = 0; i < DIR_ENTRIES; ++i)
+	{
+		snprintf(path, sizeof(path), "%s/list/%04lu.bin", dir, (unsigned long)i);
+		wow_remove(path);
+	}
+	snprintf(path, sizeof(path), "%s/list", dir);
+	wow_remove(path);
+}
+
+int wow_main(argc, argv)
+{
+	wow_main_args(argc, argv);
+	const char *dir = (argc > 1) ? argv[1] : "io_bench";
+	size_t max_mb = (argc > 2) ? strtoul(argv[2], 0, 0) : 256;
+	static const size_t sizes_kb[] = {
+		4, 64, 1024, 16 * 1024, 256 * 1024, 1024 * 1024, 4096 * 1024
+	};
+	static const struct { const char *method; io_func func; } readers[] = {
+		{ "wow_fread_bytes", read_wow }
+		, { "fread", read_stdio }
+		, { "read", read_posix }
+		, { "mmap", read_mmap }
+	};
+	static const struct { const char *method; io_func func; } writers[] = {
+		{ "wow_fwrite_bytes", write_wow }
+		, { "fwrite", write_stdio }
+		, { "write", write_posix }
+	};
+	char path[4096];
+	size_t max_bytes = max_mb * 1024 * 1024;
+	unsigned char *buf;
+	size_t i;
+	unsigned k;
+	unsigned m;
+	int cold;
+
+	if (max_bytes < 4096)
+		max_bytes = 4096;
+
+	snprintf(path, sizeof(path), "%s/list", dir);
+	if ((!wow_is_dir(dir) && wow_mkdir(dir)) || (!wow_is_dir(path) && wow_mkdir(path)))
+		wow_die("failed to create '%s'", path);
+
+	buf = wow_malloc_die(max_bytes);
+	for (i = 0; i < max_bytes; ++i)
+		buf[i] = i * 31;
+
+	fprintf(stdout, "op method bytes cache iters seconds ns_per_op mb_per_s\n");
+	for (k = 0; k < sizeof(sizes_kb) / sizeof(sizes_kb[0]); ++k)
+	{
+		size_t bytes = sizes_kb[k] * 1024;
+
+		if (bytes > max_bytes)
+			break;
+		snprintf(path, sizeof(path), "%s/%lu.bin", dir, (unsigned long)bytes);
+
+		for (m = 0; m < sizeof(writers) / sizeof(writers[0]); ++m)
+			run_io("write", writers[m].method, writers[m].func, path, buf, bytes, 0);
+
+		/* the cold runs can only drop pages that are on disk */
+		{
+			int fd = open(path, O_RDONLY);
+			if (fd >= 0)
+			{
+				fsync(fd);
+				close(fd);
+			}
+		}
+
+		for (cold = 0; cold < 2; ++cold)
+			for (m = 0; m < sizeof(readers) / sizeof(readers[0]); ++m)
+				run_io("read", readers[m].method, readers[m].func, path, buf, bytes, cold);
+
+		/* an untimed read first, so the first of the pair isn't slower */
+		read_reader_bswap(path, buf, bytes);
+		run_io("read", "wow_reader_swap", read_reader_swap, path, buf, bytes, 0);
+		run_io("read", "wow_reader_read+wow_bswap32_array", read_reader_bswap, path, buf, bytes, 0);
+
+		/* the first load fills the cache, so every timed one hits */
+		filecache = wow_filecache_new(bytes * 2);
+		if (!filecache || read_filecache(path, buf, bytes) != bytes)
+			wow_die("wow_filecache_load failed on '%s'", path);
+		run_io("read", "wow_filecache_load", read_filecache, path, buf, bytes, 0);
+		wow_filecache_free(filecache);
+
+		run_bswap(buf, bytes);
+
+		if (k == 0)
+		{
+			run_open(path, 1);
+			run_open(path, 0);
+		}
+
+		wow_remove(path);
+	}
+
+	run_dirs(dir);
+	wow_remove(dir);
+	wow_free(buf);
+
+	return 0;
+}
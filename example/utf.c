@@ -0,0 +1,333 @@
+#include <stdio.h>
+
+#define WOW_IMPLEMENTATION
+#include "wow.h"
+
+/* checks wow_utf8_to_utf16 and wow_utf16_to_utf8 against a plain *
+ * one-code-point-at-a-time version; the long runs are there so   *
+ * the vector ascii paths get used, not just the scalar tails     */
+
+static int failed = 0;
+
+#define CHECK(X) do { if (!(X)) { \
+	fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #X); \
+	failed = 1; \
+} } while (0)
+
+/* code points -> utf-16, the slow way */
+static
+size_t
+ref_utf16(uint16_t *dst, const uint32_t *cp, size_t n)
+{
+	size_t o = 0;
+	size_t i;
+	
+	for (i = 0; i < n; ++i)
+	{
+		if (cp[i] >= 0x10000)
+		{
+			dst[o++] = 0xd800 + ((cp[i] - 0x10000) >> 10);
+			dst[o++] = 0xdc00 + ((cp[i] - 0x10000) & 0x3ff);
+		}
+		else
+			dst[o++] = cp[i];
+	}
+	
+	return o;
+}
+
+/* code points -> utf-8, the slow way */
+static
+size_t
+ref_utf8(char *dst, const uint32_t *cp, size_t n)
+{
+	unsigned char *d = (unsigned char*)dst;
+	size_t o = 0;
+	size_t i;
+	
+	for (i = 0; i < n; ++i)
+	{
+		uint32_t c = cp[i];
+		
+		if (c < 0x80)
+			d[o++] = c;
+		else if (c < 0x800)
+		{
+			d[o++] = 0xc0 | (c >> 6);
+			d[o++] = 0x80 | (c & 0x3f);
+		}
+		else if (c < 0x10000)
+		{
+			d[o++] = 0xe0 | (c >> 12);
+			d[o++] = 0x80 | ((c >> 6) & 0x3f);
+			d[o++] = 0x80 | (c & 0x3f);
+		}
+		else
+		{
+			d[o++] = 0xf0 | (c >> 18);
+			d[o++] = 0x80 | ((c >> 12) & 0x3f);
+			d[o++] = 0x80 | ((c >> 6) & 0x3f);
+			d[o++] = 0x80 | (c & 0x3f);
+		}
+	}
+	
+	return o;
+}
+
+static uint32_t seed = 1;
+
+static
+uint32_t
+rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+/* a valid code point; mostly ascii, in runs of up to 100 */
+static
+uint32_t
+rnd_cp(unsigned *ascii_left)
+{
+	uint32_t c;
+	
+	if (*ascii_left)
+	{
+		--*ascii_left;
+		return 1 + rnd() % 0x7f;
+	}
+	switch (rnd() % 5)
+	{
+		case 0: *ascii_left = rnd() % 100; return 'a';
+		case 1: return 0x80 + rnd() % (0x800 - 0x80);
+		case 2:
+			do
+				c = 0x800 + rnd() % (0x10000 - 0x800);
+			while (c >= 0xd800 && c <= 0xdfff);
+			return c;
+		case 3: return 0x10000 + rnd() % (0x110000 - 0x10000);
+		default: return 0xfffd;
+	}
+}
+
+/* one utf-8 -> utf-16 conversion, checked against the expected *
+ * units, with dst sized exactly, too small by 1, and empty     */
+static
+void
+check_8to16(const char *src, size_t len, const uint16_t *want, size_t want_len)
+{
+	uint16_t *out = wow_malloc_die((want_len + 8) * sizeof(*out));
+	size_t i;
+	
+	for (i = 0; i < want_len + 8; ++i)
+		out[i] = 0xaaaa;
+	CHECK(wow_utf8_to_utf16(out, want_len, src, len) == want_len);
+	CHECK(!memcmp(out, want, want_len * sizeof(*out)));
+	CHECK(out[want_len] == 0xaaaa);
+	
+	if (want_len)
+	{
+		for (i = 0; i < want_len + 8; ++i)
+			out[i] = 0xaaaa;
+		CHECK(wow_utf8_to_utf16(out, want_len - 1, src, len) == want_len);
+		CHECK(out[want_len - 1] == 0xaaaa);
+		/* whatever was written is a prefix of the real thing */
+		for (i = 0; i < want_len - 1 && out[i] != 0xaaaa; ++i)
+			CHECK(out[i] == want[i]);
+	}
+	
+	CHECK(wow_utf8_to_utf16(0, 0, src, len) == want_len);
+	
+	wow_free(out);
+}
+
+/* the same the other way */
+static
+void
+check_16to8(const uint16_t *src, size_t len, const char *want, size_t want_len)
+{
+	char *out = wow_malloc_die(want_len + 8);
+	size_t i;
+	
+	memset(out, 0xaa, want_len + 8);
+	CHECK(wow_utf16_to_utf8(out, want_len, src, len) == want_len);
+	CHECK(!memcmp(out, want, want_len));
+	CHECK((unsigned char)out[want_len] == 0xaa);
+	
+	if (want_len)
+	{
+		memset(out, 0xaa, want_len + 8);
+		CHECK(wow_utf16_to_utf8(out, want_len - 1, src, len) == want_len);
+		CHECK((unsigned char)out[want_len - 1] == 0xaa);
+		for (i = 0; i < want_len - 1 && (unsigned char)out[i] != 0xaa; ++i)
+			CHECK(out[i] == want[i]);
+	}
+	
+	CHECK(wow_utf16_to_utf8(0, 0, src, len) == want_len);
+	
+	wow_free(out);
+}
+
+/* random valid text both ways, at lengths around the vector widths */
+static
+void
+test_round_trip(void)
+{
+	static const size_t lens[] = {
+		0, 1, 7, 8, 15, 16, 17, 31, 32, 33, 63, 64, 65, 200, 4096, 100000
+	};
+	size_t k;
+	int r;
+	
+	for (k = 0; k < sizeof(lens) / sizeof(*lens); ++k)
+	{
+		for (r = 0; r < 20; ++r)
+		{
+			size_t n = lens[k];
+			uint32_t *cp = wow_malloc_die((n + 1) * sizeof(*cp));
+			uint16_t *u16 = wow_malloc_die((n * 2 + 1) * sizeof(*u16));
+			char *u8 = wow_malloc_die(n * 4 + 1);
+			unsigned ascii_left = r & 1 ? n : 0; /* odd runs all ascii */
+			size_t n16;
+			size_t n8;
+			size_t i;
+			
+			for (i = 0; i < n; ++i)
+				cp[i] = rnd_cp(&ascii_left);
+			n16 = ref_utf16(u16, cp, n);
+			n8 = ref_utf8(u8, cp, n);
+			
+			check_8to16(u8, n8, u16, n16);
+			check_16to8(u16, n16, u8, n8);
+			
+			wow_free(cp);
+			wow_free(u16);
+			wow_free(u8);
+		}
+	}
+}
+
+/* characters outside the bmp, alone and after long ascii runs */
+static
+void
+test_surrogates(void)
+{
+	static const uint16_t pair[] = { 0xd83d, 0xde00 }; /* U+1F600 */
+	static const uint16_t max[] = { 0xdbff, 0xdfff }; /* U+10FFFF */
+	char u8[128];
+	uint16_t u16[128];
+	size_t i;
+	size_t k;
+	
+	check_8to16("\xf0\x9f\x98\x80", 4, pair, 2);
+	check_16to8(pair, 2, "\xf0\x9f\x98\x80", 4);
+	check_8to16("\xf4\x8f\xbf\xbf", 4, max, 2);
+	check_16to8(max, 2, "\xf4\x8f\xbf\xbf", 4);
+	
+	/* the pair lands at every offset within and just past a vector */
+	for (i = 0; i < 70; ++i)
+	{
+		memset(u8, 'x', i);
+		memcpy(u8 + i, "\xf0\x9f\x98\x80yz", 6);
+		for (k = 0; k < i; ++k)
+			u16[k] = 'x';
+		u16[i] = 0xd83d;
+		u16[i + 1] = 0xde00;
+		u16[i + 2] = 'y';
+		u16[i + 3] = 'z';
+		check_8to16(u8, i + 6, u16, i + 4);
+		check_16to8(u16, i + 4, u8, i + 6);
+	}
+	
+	/* a pair that doesn't fit whole is left out whole */
+	u16[0] = 0xaaaa;
+	CHECK(wow_utf8_to_utf16(u16, 1, "\xf0\x9f\x98\x80", 4) == 2);
+	CHECK(u16[0] == 0xaaaa);
+}
+
+/* each malformed byte or unpaired surrogate becomes one U+FFFD */
+static
+void
+test_invalid(void)
+{
+	static const struct
+	{
+		const char *src;
+		size_t len;
+		const char *want;
+	} bad8[] = {
+		{ "\x80", 1, "\xef\xbf\xbd" }, /* lone continuation */
+		{ "\xc0\xaf", 2, "\xef\xbf\xbd\xef\xbf\xbd" }, /* overlong */
+		{ "\xe0\x80\xaf", 3, "\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd" },
+		{ "\xed\xa0\x80", 3, "\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd" }, /* surrogate */
+		{ "\xf4\x90\x80\x80", 4, /* past U+10FFFF */
+			"\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd" },
+		{ "\xff", 1, "\xef\xbf\xbd" },
+		{ "a\xc3", 2, "a\xef\xbf\xbd" }, /* cut short */
+		{ "\xe2\x82z", 3, "\xef\xbf\xbd\xef\xbf\xbdz" },
+	};
+	static const uint16_t lone_hi[] = { 'a', 0xd800, 'b' };
+	static const uint16_t lone_lo[] = { 0xdc00, 'a' };
+	static const uint16_t hi_hi[] = { 0xd800, 0xd800, 0xdc00 };
+	static const uint16_t hi_end[] = { 'a', 0xdbff };
+	uint16_t want16[16];
+	uint16_t got16[16];
+	size_t i;
+	
+	/* bad utf-8 -> U+FFFD per byte; checked by way of utf-8, since *
+	 * good utf-8 -> utf-16 -> utf-8 is covered by the round trips  */
+	for (i = 0; i < sizeof(bad8) / sizeof(*bad8); ++i)
+	{
+		size_t n = wow_utf8_to_utf16(got16, 16, bad8[i].src, bad8[i].len);
+		size_t want_len = strlen(bad8[i].want);
+		size_t n16 = 0;
+		size_t k;
+		
+		for (k = 0; k < want_len; )
+		{
+			if ((unsigned char)bad8[i].want[k] == 0xef)
+			{
+				want16[n16++] = 0xfffd;
+				k += 3;
+			}
+			else
+				want16[n16++] = bad8[i].want[k++];
+		}
+		CHECK(n == n16);
+		CHECK(!memcmp(got16, want16, n16 * sizeof(*got16)));
+	}
+	
+	check_16to8(lone_hi, 3, "a\xef\xbf\xbd" "b", 5);
+	check_16to8(lone_lo, 2, "\xef\xbf\xbd" "a", 4);
+	check_16to8(hi_hi, 3, "\xef\xbf\xbd\xf0\x90\x80\x80", 7);
+	check_16to8(hi_end, 2, "a\xef\xbf\xbd", 4);
+	
+	/* a bad byte right after a long ascii run */
+	{
+		char src[200];
+		uint16_t want[200];
+		
+		for (i = 0; i < 150; ++i)
+		{
+			src[i] = 'q';
+			want[i] = 'q';
+		}
+		src[150] = (char)0x80;
+		want[150] = 0xfffd;
+		check_8to16(src, 151, want, 151);
+	}
+}
+
+int
+main(void)
+{
+	test_round_trip();
+	test_surrogates();
+	test_invalid();
+	
+	if (failed)
+		return 1;
+	
+	fprintf(stderr, "utf: all checks passed\n");
+	return 0;
+}
@@ -10,6 +10,15 @@ i686-w64-mingw32.static-gcc -o bin/test.exe example/test.c -s -Wall -Wextra -mco
 #valgrind bin/test wow this is a test
 
 
+# utf.c (checks itself; the avx2 build runs where the cpu has it)
+# linux
+gcc -o bin/utf example/utf.c -I. -O2 -s -Wall -Wextra && bin/utf
+gcc -o bin/utf_avx2 example/utf.c -I. -O2 -s -Wall -Wextra -mavx2 \
+	&& if grep -q avx2 /proc/cpuinfo; then bin/utf_avx2; fi
+# win32
+i686-w64-mingw32.static-gcc -o bin/utf.exe example/utf.c -I. -s -Wall -Wextra -mconsole
+
+
 # clipboard.c
 # linux
 gcc -o bin/clipboard example/clipboard.c -s -Wall -Wextra -Wno-unused-function `pkg-config --cflags --libs gtk+-2.0`
@@ -23,3 +32,12 @@ gcc -o bin/gui example/gui.c -s -Wall `deps/wow_gui_x11.sh`
 # win32
 i686-w64-mingw32.static-gcc -o bin/gui.exe example/gui.c -s -Wall `deps/wow_gui_win32.sh`
 
+
+
+# bench/fread_parallel.c
+# linux
+gcc -o bin/fread_parallel bench/fread_parallel.c -I. -O2 -s -Wall -Wextra -lpthread
+
+# bench/io.c
+# linux
+gcc -o bin/io bench/io.c -I. -O2 -s -Wall -Wextra
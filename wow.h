@@ -14,7 +14,19 @@
  * have fopen/fread/fwrite/fclose redirected to libwow
  *
  * you can also #define WOW_OVERLOAD_ALLOCATORS before you #include
- * to have malloc/calloc/realloc/free redirected to libwow
+ * to have malloc/calloc/realloc/free redirected to libwow; code
+ * running between wow_arena_push_scope and wow_arena_pop_scope then
+ * allocates from that arena without any changes of its own
+ *
+ * you can also #define WOW_POOL_ALLOCATORS before you #include to
+ * have small allocations made through libwow come from wow_pool
+ *
+ * add #define WOW_TRACK_ALLOCATIONS to WOW_OVERLOAD_ALLOCATORS to
+ * count allocations per call site (see wow_alloc_report)
+ *
+ * you can also #define WOW_USE_PTHREAD before you #include to enable
+ * the features that do their work on helper threads (link -lpthread);
+ * without it, those features quietly do the same work synchronously
  *
  * TODO WOW_OVERLOAD_ALL eventually
  * 
@@ -31,14 +43,70 @@
 #include <string.h> /* strdup */
 #include <unistd.h> /* chdir, getcwd */
 #include <stdarg.h>
+#include <stdint.h> /* SIZE_MAX */
 #include <locale.h>
 #include <errno.h>
+#include <time.h> /* clock_gettime */
 
 #ifdef _WIN32
  #include <windows.h>
+ #include <malloc.h> /* _aligned_malloc */
  #if defined(UNICODE) && !defined(_UNICODE)
   #define _UNICODE
  #endif
+#else
+ #include <sys/mman.h> /* mmap */
+ #include <sys/uio.h> /* writev */
+ #include <sys/wait.h>
+ #include <spawn.h>
+ #include <poll.h>
+ #include <signal.h>
+ #include <sched.h> /* sched_yield */
+#endif
+
+#ifdef WOW_USE_PTHREAD
+ #include <pthread.h>
+#endif
+
+/* io_uring is talked to directly, so only kernel headers are needed; *
+ * #define WOW_NO_IO_URING to leave it out                            */
+#if defined(__linux__) && !defined(WOW_NO_IO_URING) && defined(__has_include)
+ #if __has_include(<linux/io_uring.h>)
+  #define WOW_HAVE_IO_URING
+  #include <linux/io_uring.h>
+  #include <linux/stat.h> /* statx */
+  #include <sys/syscall.h>
+  #ifndef AT_EMPTY_PATH
+   #define AT_EMPTY_PATH 0x1000
+  #endif
+ #endif
+#endif
+
+/* vector paths for the text and byte order routines; #define *
+ * WOW_NO_SIMD to leave them out                              */
+#if !defined(WOW_NO_SIMD)
+ #if defined(__AVX2__)
+  #define WOW_SIMD_AVX2
+  #include <immintrin.h>
+ #endif
+ #if defined(__SSSE3__) || defined(__AVX2__)
+  #define WOW_SIMD_SSSE3
+  #include <tmmintrin.h>
+ #endif
+ #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define WOW_SIMD_SSE2
+  #include <emmintrin.h>
+ #elif (defined(__ARM_NEON) && defined(__aarch64__)) || defined(_M_ARM64)
+  #define WOW_SIMD_NEON
+  #include <arm_neon.h>
+ #endif
+#endif
+
+#ifdef __linux__
+ #include <sys/ioctl.h> /* FICLONE */
+ #include <sys/sendfile.h>
+ #include <sys/syscall.h> /* copy_file_range */
+ #include <linux/fs.h>
 #endif
 
 
@@ -58,6 +126,12 @@
  #define WOW_API_PREFIX
 #endif
 
+#if defined(_MSC_VER)
+ #define WOW_THREAD_LOCAL __declspec(thread)
+#else
+ #define WOW_THREAD_LOCAL __thread
+#endif
+
 WOW_API_PREFIX
 void *
 wow_utf8_to_wchar(const char *str);
@@ -74,6 +148,57 @@ WOW_API_PREFIX
 char *
 wow_wchar_to_utf8_die(void *wstr);
 
+/* utf-8 <-> utf-16 without allocating: both take explicit lengths, *
+ * write at most dst_max units (no terminator), and return how many *
+ * units the whole conversion needs, so a return value greater than *
+ * dst_max means dst was too small; each malformed byte or unpaired *
+ * surrogate comes out as U+FFFD                                    */
+WOW_API_PREFIX
+size_t
+wow_utf8_to_utf16(uint16_t *dst, size_t dst_max, const char *src, size_t src_len);
+
+WOW_API_PREFIX
+size_t
+wow_utf16_to_utf8(char *dst, size_t dst_max, const uint16_t *src, size_t src_len);
+
+/* utf-16 copy of a utf-8 string, kept on the stack when it's short *
+ * (paths mostly are); the struct points into itself, so don't copy *
+ * it around, and pair every init with a free                       */
+#define WOW_UTF16_BUF_STACK 520
+struct wow_utf16_buf
+{
+	uint16_t *str;
+	uint16_t stack[WOW_UTF16_BUF_STACK];
+};
+
+/* returns buf->str, or 0 (errno = EILSEQ) if str is 0 or isn't *
+ * valid utf-8, so a bad path can't turn into a different file   *
+ * named with U+FFFD; dies on allocation failure                 */
+WOW_API_PREFIX
+uint16_t *
+wow_utf16_buf_init(struct wow_utf16_buf *buf, const char *str);
+
+WOW_API_PREFIX
+void
+wow_utf16_buf_free(struct wow_utf16_buf *buf);
+
+/* returns the length of the longest valid utf-8 prefix of s, *
+ * so it returns len when all of s is valid                   */
+WOW_API_PREFIX
+size_t
+wow_utf8_valid(const char *s, size_t len);
+
+/* returns how many bytes at the start of s are ascii */
+WOW_API_PREFIX
+size_t
+wow_utf8_ascii_run(const char *s, size_t len);
+
+/* decodes the code point at *s and moves *s past it; a malformed *
+ * byte decodes as U+FFFD and is skipped by itself; *s < end      */
+WOW_API_PREFIX
+uint32_t
+wow_utf8_next(const char **s, const char *end);
+
 
 /* converts argv[] from wchar to char win32, in place */
 WOW_API_PREFIX
@@ -94,6 +219,21 @@ size_t
 wow_fread_bytes(void *ptr, size_t bytes, FILE *stream);
 
 
+/* wow_fread_bytes, but a big read is split into chunks that *
+ * several threads fill at once with pread; threads 0 uses one *
+ * per processor, chunk 0 uses 8 mb; falls back to a plain     *
+ * wow_fread_bytes without WOW_USE_PTHREAD or for non-files    */
+WOW_API_PREFIX
+size_t
+wow_fread_bytes_parallel(
+	void *ptr
+	, size_t bytes
+	, FILE *stream
+	, int threads
+	, size_t chunk
+);
+
+
 /* fwrite abstraction that falls back to buffer-based fwrite *
  * if a big fwrite fails; if that still fails, returns 0     */
 WOW_API_PREFIX
@@ -121,6 +261,413 @@ FILE *
 wow_fopen(char const *name, char const *mode);
 
 
+/* an open file along with what fstat said about it */
+enum wow_file_type
+{
+	WOW_FILE_REGULAR = 0
+	, WOW_FILE_DIR
+	, WOW_FILE_OTHER  /* pipes, devices, ... */
+};
+struct wow_file
+{
+	int fd;
+	FILE *fp;          /* 0 until wow_file_stream is called */
+	uint64_t size;     /* 0 unless type is WOW_FILE_REGULAR */
+	int64_t mtime_ns;  /* last modified, nanoseconds since the epoch */
+	enum wow_file_type type;
+	int flags;         /* what open() was given */
+};
+
+
+/* opens path with an fopen-style mode ("rb", "w", "a+", "wx", ...) *
+ * using one open() and one fstat(); directories can be opened for *
+ * reading, and come back as WOW_FILE_DIR; returns non-zero on     *
+ * failure                                                         */
+WOW_API_PREFIX
+int
+wow_file_open(struct wow_file *file, char const *path, char const *mode);
+
+
+/* returns a FILE* on the file's descriptor, made on the first call *
+ * (0 for directories); wow_file_close closes it, so don't fclose  */
+WOW_API_PREFIX
+FILE *
+wow_file_stream(struct wow_file *file);
+
+
+/* closes a file opened with wow_file_open; returns non-zero on failure */
+WOW_API_PREFIX
+int
+wow_file_close(struct wow_file *file);
+
+
+/* fills in size, mtime_ns and type for path with a single stat(), *
+ * without opening it (fd stays -1); returns non-zero on failure   */
+WOW_API_PREFIX
+int
+wow_file_stat(struct wow_file *file, char const *path);
+
+
+/* file mapping modes */
+enum wow_map_mode
+{
+	WOW_MAP_READ = 0  /* read-only view of the file */
+	, WOW_MAP_COPY    /* writable view, writes never reach the file */
+};
+
+/* a mapped file; data is 0 if the file is empty */
+struct wow_map
+{
+	void *data;
+	size_t size;
+	int is_mapped; /* zero if data was read into a buffer instead */
+};
+
+
+/* maps a file into memory without copying it; falls back to *
+ * reading it into a buffer if it can't be mapped (pipes and *
+ * other special files); returns non-zero on failure         */
+WOW_API_PREFIX
+int
+wow_file_map(struct wow_map *map, char const *path, enum wow_map_mode mode);
+
+
+/* releases a mapping created by wow_file_map */
+WOW_API_PREFIX
+void
+wow_file_unmap(struct wow_map *map);
+
+
+/* reverse the byte order of count 16-, 32- or 64-bit values, *
+ * e.g. big-endian data read on a little-endian machine; dst  *
+ * may be src to swap in place, but must not overlap it       *
+ * otherwise; neither has to be aligned                       */
+WOW_API_PREFIX
+void
+wow_bswap16_array(void *dst, const void *src, size_t count);
+
+WOW_API_PREFIX
+void
+wow_bswap32_array(void *dst, const void *src, size_t count);
+
+WOW_API_PREFIX
+void
+wow_bswap64_array(void *dst, const void *src, size_t count);
+
+
+/* buffered file reader that learns the file size once and *
+ * never seeks, which makes it cheap to pull small records  *
+ * out of a file one at a time; bufsz 0 uses the default    */
+struct wow_reader;
+
+
+/* opens a file for reading; returns 0 on failure */
+WOW_API_PREFIX
+struct wow_reader *
+wow_reader_open(char const *path, size_t bufsz);
+
+
+/* reads from an open file descriptor, starting from its *
+ * current offset; the descriptor is not closed for you, *
+ * and directories are refused                           */
+WOW_API_PREFIX
+struct wow_reader *
+wow_reader_fdopen(int fd, size_t bufsz);
+
+
+/* closes a reader */
+WOW_API_PREFIX
+void
+wow_reader_close(struct wow_reader *r);
+
+
+/* reads up to bytes; returns bytes read, which is less than *
+ * requested only at the end of the file or on error        */
+WOW_API_PREFIX
+size_t
+wow_reader_read(struct wow_reader *r, void *dst, size_t bytes);
+
+
+/* makes wow_reader_read reverse the byte order of each size-byte *
+ * value (2, 4 or 8) as it is read, counting from the current     *
+ * offset; values stay on that grid across reads and skips of any *
+ * length, and only one cut short by the end of the file is       *
+ * copied as it is; 0 turns it off again; returns non-zero for    *
+ * any other size                                                 */
+WOW_API_PREFIX
+int
+wow_reader_swap(struct wow_reader *r, int size);
+
+
+/* returns a pointer to the next bytes without consuming them, *
+ * or 0 if fewer remain (or bytes is larger than the buffer)   */
+WOW_API_PREFIX
+const void *
+wow_reader_peek(struct wow_reader *r, size_t bytes);
+
+
+/* skips bytes without reading them; returns bytes skipped */
+WOW_API_PREFIX
+size_t
+wow_reader_skip(struct wow_reader *r, size_t bytes);
+
+
+/* returns the current read offset */
+WOW_API_PREFIX
+uint64_t
+wow_reader_tell(struct wow_reader *r);
+
+
+/* returns the size of the file, or 0 if it isn't a regular file */
+WOW_API_PREFIX
+uint64_t
+wow_reader_size(struct wow_reader *r);
+
+
+/* returns non-zero if a read error occurred */
+WOW_API_PREFIX
+int
+wow_reader_error(struct wow_reader *r);
+
+
+/* reads the next block on a helper thread while the current one *
+ * is consumed; returns non-zero if prefetching isn't available  *
+ * (no WOW_USE_PTHREAD, or not a regular file), in which case    *
+ * the reader keeps working as before                            */
+WOW_API_PREFIX
+int
+wow_reader_prefetch(struct wow_reader *r);
+
+
+/* a compression format that wow_decoder can read; the built-in  *
+ * ones are Yaz0, LZ77 (the "LZ77"-tagged type 0x10 variant) and *
+ * WOWB, the block container of wow_writer_compress              */
+struct wow_codec
+{
+	const char *name;
+	const void *magic;   /* a file in this format starts with these */
+	size_t magic_len;
+	size_t header_len;   /* magic included; skipped before decoding */
+	
+	/* returns new decoding state for a file with this header, or *
+	 * 0 if the header is bad; *size gets the decoded size        */
+	void *(*open)(const unsigned char *header, uint64_t *size);
+	
+	/* decodes from src into dst; on return, *dst_len and *src_len *
+	 * hold how much was produced and consumed; returns 1 at the   *
+	 * end of the data, 0 to be called again (with more input, if  *
+	 * nothing could be done), or -1 if the data is corrupt        */
+	int (*decode)(
+		void *state
+		, unsigned char *dst
+		, size_t *dst_len
+		, const unsigned char *src
+		, size_t *src_len
+	);
+	
+	void (*close)(void *state);
+	
+	/* optional: compresses len bytes into a complete stream in *
+	 * this format, header included (free with wow_free), and   *
+	 * sets *packed_len; returns 0 if it can't                  */
+	void *(*encode)(const void *src, size_t len, size_t *packed_len);
+};
+
+
+/* adds a format for wow_decoder_open to look for (checked before *
+ * the ones added earlier); do this before decoders are opened,   *
+ * the codec is used in place; returns non-zero if the table is   *
+ * full                                                           */
+WOW_API_PREFIX
+int
+wow_codec_register(const struct wow_codec *codec);
+
+
+/* returns the registered codec with this name, or 0 */
+WOW_API_PREFIX
+const struct wow_codec *
+wow_codec_find(const char *name);
+
+
+/* decompressing layer on a wow_reader: the format is told apart by *
+ * its magic bytes, and the data is decoded a piece at a time right *
+ * into the caller's buffer, so the compressed file is never held   *
+ * in memory as a whole; data in no known format passes through    */
+struct wow_decoder;
+
+
+/* starts decoding at the reader's current position; the reader *
+ * must stay open until wow_decoder_close; returns 0 on failure  */
+WOW_API_PREFIX
+struct wow_decoder *
+wow_decoder_open(struct wow_reader *r);
+
+
+/* reads up to bytes of decoded data; returns bytes read, which *
+ * is less than requested only at the end or on error           */
+WOW_API_PREFIX
+size_t
+wow_decoder_read(struct wow_decoder *d, void *dst, size_t bytes);
+
+
+/* returns the decoded size (for data passed through, whatever *
+ * is left of the file, or 0 if that isn't known)              */
+WOW_API_PREFIX
+uint64_t
+wow_decoder_size(struct wow_decoder *d);
+
+
+/* returns the codec's name, or "raw" if data is passed through */
+WOW_API_PREFIX
+const char *
+wow_decoder_format(struct wow_decoder *d);
+
+
+/* returns non-zero on a read error, corrupt or truncated data */
+WOW_API_PREFIX
+int
+wow_decoder_error(struct wow_decoder *d);
+
+
+/* frees a decoder, leaving its reader open */
+WOW_API_PREFIX
+void
+wow_decoder_close(struct wow_decoder *d);
+
+
+/* one file in a batch load */
+struct wow_batch_file
+{
+	char const *path; /* set this */
+	void *data;       /* contents (0 if empty), free with wow_free */
+	size_t size;
+	int error;        /* 0 on success, otherwise an errno value */
+};
+
+
+/* content cache for files that are loaded over and over: each   *
+ * file is read once into a shared, read-only buffer, and loading *
+ * it again costs a single stat() for as long as its size and     *
+ * mtime stay the same; the least recently used buffers nobody    *
+ * holds are dropped whenever the total goes over the budget      */
+struct wow_filecache;
+
+
+/* creates an empty cache that tries to stay under budget bytes; *
+ * returns 0 on memory failure                                    */
+WOW_API_PREFIX
+struct wow_filecache *
+wow_filecache_new(size_t budget);
+
+
+/* frees the cache; buffers still held stay valid until released */
+WOW_API_PREFIX
+void
+wow_filecache_free(struct wow_filecache *cache);
+
+
+/* returns a file's contents (*size bytes, read-only) and holds a  *
+ * reference to them until wow_filecache_release; a file that has *
+ * changed is read again, while buffers handed out earlier keep   *
+ * the old contents; returns 0 on failure (non-regular files fail *
+ * with errno = EINVAL)                                           */
+WOW_API_PREFIX
+const void *
+wow_filecache_load(struct wow_filecache *cache, char const *path, size_t *size);
+
+
+/* drops a reference taken by wow_filecache_load (0 is ignored) */
+WOW_API_PREFIX
+void
+wow_filecache_release(const void *data);
+
+
+/* loads many whole files at once; opens and reads are queued *
+ * through io_uring on linux, otherwise they are spread over a *
+ * few threads (or done one by one without WOW_USE_PTHREAD);   *
+ * returns how many files were loaded successfully             */
+WOW_API_PREFIX
+size_t
+wow_file_load_batch(struct wow_batch_file *files, size_t count);
+
+
+/* buffered file writer that never leaves a half-written file: *
+ * everything goes to a temporary file beside the destination, *
+ * which replaces it only when committed; bufsz 0 uses 1 mb    */
+struct wow_writer;
+
+
+/* starts writing a file; returns 0 on failure */
+WOW_API_PREFIX
+struct wow_writer *
+wow_writer_open(char const *path, size_t bufsz);
+
+
+/* writes bytes; returns bytes written, which is less than *
+ * requested only on error (see wow_writer_error)          */
+WOW_API_PREFIX
+size_t
+wow_writer_write(struct wow_writer *w, const void *src, size_t bytes);
+
+
+/* switches a writer that hasn't written anything yet to block  *
+ * compression: the data is cut into block_size pieces (0 uses  *
+ * 1 mb), each compressed on its own with codec by one of       *
+ * 'threads' workers (0 = one per processor; without            *
+ * WOW_USE_PTHREAD it's done in place), and the blocks are      *
+ * written out in order, followed by an index of where each one *
+ * starts (see wow_block_index); wow_decoder reads it all back  *
+ * as one stream; returns non-zero if codec can't encode        */
+WOW_API_PREFIX
+int
+wow_writer_compress(
+	struct wow_writer *w
+	, const struct wow_codec *codec
+	, size_t block_size
+	, int threads
+);
+
+
+/* flushes, syncs to disk, and replaces the destination with *
+ * what was written; the writer is freed either way; returns *
+ * non-zero on failure, leaving the destination untouched    */
+WOW_API_PREFIX
+int
+wow_writer_commit(struct wow_writer *w);
+
+
+/* one block of a file written by a compressing wow_writer */
+struct wow_block
+{
+	uint64_t ofs;   /* file offset of the block's stream, which a  *
+	                 * wow_decoder opened there decodes on its own */
+	uint64_t pos;   /* offset of its first byte in the decoded data */
+};
+
+
+/* loads the index of a file written by a compressing wow_writer; *
+ * returns count blocks plus one more past the end, whose pos is  *
+ * the decoded size (free with wow_free), or 0 if the file isn't  *
+ * one; a block ends where the next one starts, so ranges can be  *
+ * decoded in parallel, each thread with its own wow_reader       *
+ * skipped to ofs                                                 */
+WOW_API_PREFIX
+struct wow_block *
+wow_block_index(char const *path, size_t *count);
+
+
+/* throws away everything written and frees the writer */
+WOW_API_PREFIX
+void
+wow_writer_abort(struct wow_writer *w);
+
+
+/* returns non-zero if a write error occurred */
+WOW_API_PREFIX
+int
+wow_writer_error(struct wow_writer *w);
+
+
 /* open abstraction for utf8 support on windows win32 */
 WOW_API_PREFIX
 int
@@ -133,6 +680,14 @@ int
 wow_remove(char const *path);
 
 
+/* copies a file, letting the kernel do the work where it can *
+ * (reflink, copy_file_range, sendfile on linux; CopyFile on  *
+ * win32); returns non-zero on failure                        */
+WOW_API_PREFIX
+int
+wow_copy_file(char const *src, char const *dst);
+
+
 /* mkdir */
 WOW_API_PREFIX
 int
@@ -169,12 +724,90 @@ int
 wow_system(char const *path);
 
 
-/* system_gui */
+/* opens program name with the arguments in param, no shell involved; *
+ * param is split the way win32 splits a command line, so the same    *
+ * quoting works on both sides: blanks separate, "quotes" group, and  *
+ * \" is a literal quote; returns 0 on success, else on win32 1 if it *
+ * couldn't be opened, and elsewhere the program's exit code (128 +   *
+ * signal if killed, -1 if it didn't run) instead of system()'s raw   *
+ * wait status, since it waits for the program to finish there       */
 WOW_API_PREFIX
 int
 wow_system_gui(char const *name, const char *param);
 
 
+/* runs a program without a shell (posix_spawn); zero the struct, *
+ * set argv and the io modes, and the rest is filled in           *
+ * NOTE: on win32 only WOW_SPAWN_INHERIT is supported so far, and *
+ *       wow_spawn_start waits for the program to finish          */
+enum wow_spawn_io
+{
+	WOW_SPAWN_INHERIT = 0  /* use the parent's stream */
+	, WOW_SPAWN_NULL       /* /dev/null */
+	, WOW_SPAWN_PIPE       /* stdin: fed from input; else captured */
+};
+struct wow_spawn
+{
+	/* set these */
+	char const *const *argv;  /* 0-terminated; argv[0] is looked up in PATH */
+	enum wow_spawn_io io_in;
+	enum wow_spawn_io io_out;
+	enum wow_spawn_io io_err;
+	const void *input;        /* what io_in = WOW_SPAWN_PIPE writes */
+	size_t input_len;
+	
+	/* results; output and errors are 0-terminated, free them *
+	 * with wow_spawn_free                                    */
+	char *output;
+	size_t output_len;
+	char *errors;
+	size_t errors_len;
+	int status;  /* exit code, 128 + signal if killed, -1 if it didn't run */
+	
+	/* internal */
+	long pid;
+	int pidfd;
+	int fd[3];
+	size_t input_ofs;
+	size_t output_cap;
+	size_t errors_cap;
+	int reaped;
+};
+
+
+/* starts sp->argv; returns non-zero (and sets errno) if it couldn't */
+WOW_API_PREFIX
+int
+wow_spawn_start(struct wow_spawn *sp);
+
+
+/* feeds and drains the pipes until the program exits; returns sp->status */
+WOW_API_PREFIX
+int
+wow_spawn_wait(struct wow_spawn *sp);
+
+
+/* wow_spawn_start + wow_spawn_wait; returns the exit status, or -1 */
+WOW_API_PREFIX
+int
+wow_spawn(struct wow_spawn *sp);
+
+
+/* frees the captured output */
+WOW_API_PREFIX
+void
+wow_spawn_free(struct wow_spawn *sp);
+
+
+/* runs count programs, at most max_parallel at a time (0 = one per *
+ * processor), waiting on all of them from a single poll loop; each *
+ * gets its status and output filled in like wow_spawn; returns how *
+ * many failed to start or exited with a non-zero status           */
+WOW_API_PREFIX
+size_t
+wow_run_batch(struct wow_spawn *cmds, size_t count, int max_parallel);
+
+
 /* window icon */
 WOW_API_PREFIX
 void
@@ -182,15 +815,184 @@ wow_windowicon(int iconId);
 
 WOW_API_PREFIX int wow_strcasecmp(char *str, const char *ext);
 WOW_API_PREFIX char *wow_fnHasExtension(char *str);
+/* these reallocate *str when it has to grow (returning non-zero on *
+ * memory failure); wow_path does the same without reallocating     */
 WOW_API_PREFIX int wow_fnChangeExtension(char **str, const char *ext);
+WOW_API_PREFIX int wow_fnForceExtension(char **str, const char *ext);
 
+/* path builder: the length and capacity are tracked, so every  *
+ * operation is O(length) at most, and short paths live in the  *
+ * struct itself, so they never touch the heap; the struct      *
+ * points into itself, so don't copy it around, and pair every  *
+ * init with a free; both '/' and '\' count as separators       */
+#define WOW_PATH_STACK 256
+struct wow_path
+{
+	char *str; /* always zero-terminated */
+	size_t len;
+	size_t cap;
+	char stack[WOW_PATH_STACK];
+};
 
-WOW_API_PREFIX void wow_die(const char *fmt, ...)
-	__attribute__ ((format (printf, 1, 2)))
-;
-WOW_API_PREFIX void wow_stderr(const char *fmt, ...)
+/* starts path out as a copy of str (0 = empty); returns non-zero *
+ * on memory failure, as do all the wow_path functions that can   *
+ * grow it (in which case path is left as it was)                 */
+WOW_API_PREFIX
+int
+wow_path_init(struct wow_path *path, const char *str);
+
+WOW_API_PREFIX
+void
+wow_path_free(struct wow_path *path);
+
+/* hands over path->str as a heap string (release with free) *
+ * and leaves path empty; returns 0 on memory failure        */
+WOW_API_PREFIX
+char *
+wow_path_detach(struct wow_path *path);
+
+WOW_API_PREFIX
+int
+wow_path_set(struct wow_path *path, const char *str);
+
+/* str may point into path->str itself (e.g. to repeat a part) */
+WOW_API_PREFIX
+int
+wow_path_append(struct wow_path *path, const char *str);
+
+WOW_API_PREFIX
+int
+wow_path_append_n(struct wow_path *path, const char *str, size_t n);
+
+/* appends a separator (unless path is empty or already ends in *
+ * one) followed by name, which may point into path->str too    */
+WOW_API_PREFIX
+int
+wow_path_join(struct wow_path *path, const char *name);
+
+/* cuts path back to its first len bytes, e.g. to a length saved *
+ * before joining, so one directory can be reused for many names */
+WOW_API_PREFIX
+void
+wow_path_truncate(struct wow_path *path, size_t len);
+
+/* returns the extension (past the '.') in path->str, or 0 */
+WOW_API_PREFIX
+char *
+wow_path_extension(const struct wow_path *path);
+
+/* replaces the extension, or adds one if there is none; ext may *
+ * be given with or without its leading '.'                      */
+WOW_API_PREFIX
+int
+wow_path_replace_extension(struct wow_path *path, const char *ext);
+
+/* adds ext unless the path already ends in it (ignoring case) */
+WOW_API_PREFIX
+int
+wow_path_force_extension(struct wow_path *path, const char *ext);
+
+/* cuts path back to its directory, without a trailing separator; *
+ * trailing separators on path are ignored, as with posix dirname *
+ * ("a/b/c" -> "a/b", "a/b/" -> "a", "/c" -> "/", "c" -> "")      */
+WOW_API_PREFIX
+void
+wow_path_dirname(struct wow_path *path);
+
+/* cuts path down to its last component, ignoring trailing *
+ * separators ("a/b/c" -> "c", "a/b/" -> "b", "/" -> "/")  */
+WOW_API_PREFIX
+void
+wow_path_basename(struct wow_path *path);
+
+
+WOW_API_PREFIX void wow_die(const char *fmt, ...)
+	__attribute__ ((format (printf, 1, 2)))
+;
+WOW_API_PREFIX void wow_stderr(const char *fmt, ...)
 	__attribute__ ((format (printf, 1, 2)))
 ;
+
+/* log levels; #define WOW_LOG_LEVEL before you #include to have *
+ * every wow_log_* call below that level compiled out entirely   */
+#define WOW_LOG_DEBUG 0
+#define WOW_LOG_INFO  1
+#define WOW_LOG_WARN  2
+#define WOW_LOG_ERROR 3
+#ifndef WOW_LOG_LEVEL
+ #define WOW_LOG_LEVEL WOW_LOG_DEBUG
+#endif
+
+/* like wow_stderr, with the level as a prefix (info has none) */
+WOW_API_PREFIX void wow_log(int level, const char *fmt, ...)
+	__attribute__ ((format (printf, 2, 3)))
+;
+
+/* starts the background log writer: from then on, wow_stderr and  *
+ * wow_log format into a per-thread buffer and queue the line in a  *
+ * lock-free ring, which a helper thread writes out in batches;     *
+ * returns 0 on success, or -1 if lines are to stay synchronous     *
+ * (no WOW_USE_PTHREAD); wow_die flushes the ring before it exits   */
+WOW_API_PREFIX int wow_log_async_begin(void);
+
+/* returns once every line queued before the call has been written */
+WOW_API_PREFIX void wow_log_flush(void);
+
+/* flushes and stops the background log writer (done at exit, too); *
+ * other threads should be done logging by the time this is called  */
+WOW_API_PREFIX void wow_log_async_end(void);
+
+#if WOW_LOG_LEVEL <= WOW_LOG_DEBUG
+ #define wow_log_debug(...) wow_log(WOW_LOG_DEBUG, __VA_ARGS__)
+#else
+ #define wow_log_debug(...) ((void)0)
+#endif
+#if WOW_LOG_LEVEL <= WOW_LOG_INFO
+ #define wow_log_info(...) wow_log(WOW_LOG_INFO, __VA_ARGS__)
+#else
+ #define wow_log_info(...) ((void)0)
+#endif
+#if WOW_LOG_LEVEL <= WOW_LOG_WARN
+ #define wow_log_warn(...) wow_log(WOW_LOG_WARN, __VA_ARGS__)
+#else
+ #define wow_log_warn(...) ((void)0)
+#endif
+#if WOW_LOG_LEVEL <= WOW_LOG_ERROR
+ #define wow_log_error(...) wow_log(WOW_LOG_ERROR, __VA_ARGS__)
+#else
+ #define wow_log_error(...) ((void)0)
+#endif
+
+/* tracing: #define WOW_TRACE before you #include (in every file) to *
+ * have wow_trace_begin/end and wow_trace_scope record timestamped    *
+ * events into per-thread buffers; at exit, they are written as       *
+ * Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev) to the *
+ * file named by the WOW_TRACE_FILE environment variable, or to       *
+ * wow_trace.json; without WOW_TRACE, the macros compile to nothing   *
+ * note: names are stored, not copied, so use string literals         */
+#ifdef WOW_TRACE
+ #define WOW_TRACE_CAT_(A, B) A##B
+ #define WOW_TRACE_CAT(A, B) WOW_TRACE_CAT_(A, B)
+ #define wow_trace_begin(NAME) wow_trace_event(NAME, 'B')
+ #define wow_trace_end(NAME) wow_trace_event(NAME, 'E')
+ /* a declaration: begins here, ends when the enclosing block exits */
+ #define wow_trace_scope(NAME) \
+	const char *WOW_TRACE_CAT(wow_trace_scope_, __LINE__) \
+	__attribute__ ((cleanup (wow_trace_scope_end), unused)) \
+	= wow_trace_scope_begin(NAME)
+WOW_API_PREFIX void wow_trace_event(const char *name, int phase);
+WOW_API_PREFIX const char *wow_trace_scope_begin(const char *name);
+WOW_API_PREFIX void wow_trace_scope_end(const char **name);
+#else
+ #define wow_trace_begin(NAME) ((void)0)
+ #define wow_trace_end(NAME) ((void)0)
+ #define wow_trace_scope(NAME) struct wow_trace_scope_unused
+#endif
+
+/* writes the events recorded so far to a JSON file; returns 0 on *
+ * success, or -1 on failure or if built without WOW_TRACE        */
+WOW_API_PREFIX int wow_trace_write(const char *path);
+
 /* these die on allocation failure */
 WOW_API_PREFIX void *wow_calloc_die(size_t nmemb, size_t size);
 WOW_API_PREFIX void *wow_malloc_die(size_t size);
@@ -200,448 +1002,6784 @@ WOW_API_PREFIX void *wow_memdup_die(void *ptr, size_t size);
 
 WOW_API_PREFIX void wow_free(void *ptr);
 
+/* bump allocator: allocations are carved out of big chunks and *
+ * are never freed one by one, only all at once (reset/release) */
+struct wow_arena_chunk;
+struct wow_arena_granule;
+struct wow_arena
+{
+	struct wow_arena_chunk *head;  /* chunk being carved up */
+	struct wow_arena_chunk *spare; /* chunks kept by wow_arena_reset */
+	size_t chunk_size;             /* smallest chunk to allocate */
+	struct wow_arena *scope_prev;  /* see wow_arena_push_scope */
+	struct wow_arena_granule *map; /* which chunks cover which 64 kb */
+	size_t map_cap;
+	size_t map_used;
+};
+/* a position to rewind an arena to; a zeroed mark is the start */
+struct wow_arena_mark
+{
+	struct wow_arena_chunk *chunk;
+	size_t used;
+};
+/* chunk_size 0 uses 64 kb; a zeroed arena also works */
+WOW_API_PREFIX void wow_arena_init(struct wow_arena *arena, size_t chunk_size);
+/* these die on allocation failure, like the ones above */
+WOW_API_PREFIX void *wow_arena_alloc(struct wow_arena *arena, size_t size);
+WOW_API_PREFIX void *wow_arena_calloc(struct wow_arena *arena, size_t nmemb, size_t size);
+WOW_API_PREFIX char *wow_arena_strdup(struct wow_arena *arena, const char *s);
+WOW_API_PREFIX void *wow_arena_memdup(struct wow_arena *arena, const void *ptr, size_t size);
+WOW_API_PREFIX struct wow_arena_mark wow_arena_mark(struct wow_arena *arena);
+/* frees everything allocated after mark, keeping the memory for reuse */
+WOW_API_PREFIX void wow_arena_reset(struct wow_arena *arena, struct wow_arena_mark mark);
+/* gives all of an arena's memory back */
+WOW_API_PREFIX void wow_arena_release(struct wow_arena *arena);
+/* until popped, the calling thread's wow_malloc_die and friends   *
+ * (so malloc and friends under WOW_OVERLOAD_ALLOCATORS) allocate *
+ * from arena, and wow_free ignores pointers into it; scopes nest *
+ * NOTE: nothing allocated in a scope may be freed or realloc'd   *
+ *       after the scope is popped, except by resetting or        *
+ *       releasing the arena                                      */
+WOW_API_PREFIX void wow_arena_push_scope(struct wow_arena *arena);
+WOW_API_PREFIX void wow_arena_pop_scope(void);
+
+/* small object allocator: sizes up to WOW_POOL_MAX are served     *
+ * from per-size-class slabs, through a cache kept by each thread; *
+ * bigger sizes go to malloc; #define WOW_POOL_ALLOCATORS to have  *
+ * the *_die family (and so WOW_OVERLOAD_ALLOCATORS) use the pool  *
+ * NOTE: slab memory is kept for reuse, never given back to the    *
+ *       system; wow_pool_free/realloc also accept malloc pointers */
+#define WOW_POOL_MAX 2048
+/* these die on allocation failure */
+WOW_API_PREFIX void *wow_pool_alloc(size_t size);
+WOW_API_PREFIX void *wow_pool_calloc(size_t nmemb, size_t size);
+WOW_API_PREFIX void *wow_pool_realloc(void *ptr, size_t size);
+WOW_API_PREFIX void wow_pool_free(void *ptr);
+/* returns the usable size of a pool allocation, 0 if not from the pool */
+WOW_API_PREFIX size_t wow_pool_size(const void *ptr);
+/* hands the calling thread's cached blocks back to the shared pool;  *
+ * happens by itself at thread exit under WOW_USE_PTHREAD, otherwise *
+ * threads that use the pool should call it before they return       */
+WOW_API_PREFIX void wow_pool_flush(void);
+
+/* allocation tracking: #define WOW_TRACK_ALLOCATIONS along with    *
+ * WOW_OVERLOAD_ALLOCATORS and every malloc/calloc/realloc records *
+ * its call site; set the environment variable WOW_ALLOC_REPORT to *
+ * a file name (or "-" for stderr) to get a report at exit         */
+struct wow_alloc_stats
+{
+	size_t live_bytes;
+	size_t live_count;
+	size_t peak_bytes;
+	uint64_t allocs;   /* malloc + calloc */
+	uint64_t reallocs;
+	uint64_t frees;
+};
+WOW_API_PREFIX void wow_alloc_stats_get(struct wow_alloc_stats *stats);
+/* prints the totals, then call sites by number of calls */
+WOW_API_PREFIX void wow_alloc_report(FILE *out);
+/* zeroes the counters (not the live bytes), e.g. once per frame */
+WOW_API_PREFIX void wow_alloc_reset(void);
+/* what the overloads call; file and line are the call site */
+WOW_API_PREFIX void *wow_track_malloc(size_t size, const char *file, int line);
+WOW_API_PREFIX void *wow_track_calloc(size_t nmemb, size_t size, const char *file, int line);
+WOW_API_PREFIX void *wow_track_realloc(void *ptr, size_t size, const char *file, int line);
+WOW_API_PREFIX void wow_track_free(void *ptr);
+
 #ifdef WOW_IMPLEMENTATION
 
-WOW_API_PREFIX void wow_die(const char *fmt, ...)
+/* arena internals */
+struct wow_arena_chunk
 {
-	va_list args;
-	va_start(args, fmt);
-#if defined(_WIN32) && defined(_UNICODE)
-	char buf[4096];
-	vsprintf(buf, fmt, args);
-	wchar_t *wc = wow_utf8_to_wchar_die(buf);
-	setlocale(LC_ALL, "");
-	fwprintf(stderr, L"%ls", wc);
-	free(wc);
-#else
-	vfprintf(stderr, fmt, args);
-#endif
-	va_end(args);
-	fprintf(stderr, "\n");
-	exit(EXIT_FAILURE);
-}
+	struct wow_arena_chunk *prev;
+	size_t cap;
+	size_t used;
+	size_t pad; /* keeps data 16-byte aligned */
+};
+#define WOW_ARENA_DATA(CHUNK) ((unsigned char*)((CHUNK) + 1))
+#define WOW_ARENA_ALIGN(X) (((X) + 15) & ~(size_t)15)
 
-WOW_API_PREFIX void wow_stderr(const char *fmt, ...)
+/* innermost arena scope of the calling thread */
+static WOW_THREAD_LOCAL struct wow_arena *private_arena_scope = 0;
+
+/* allocation made in an arena scope, which remembers its size for realloc */
+struct private_arena_scoped
 {
-	va_list args;
-	va_start(args, fmt);
-#if defined(_WIN32) && defined(_UNICODE)
-	char buf[4096];
-	vsprintf(buf, fmt, args);
-	wchar_t *wc = wow_utf8_to_wchar_die(buf);
-	setlocale(LC_ALL, "");
-	fwprintf(stderr, L"%ls", wc);
-	free(wc);
-#else
-	vfprintf(stderr, fmt, args);
-#endif
-	va_end(args);
-	fprintf(stderr, "\n");
-}
+	size_t size;
+	size_t pad;
+};
 
-WOW_API_PREFIX void wow_free(void *ptr)
+/* every chunk is listed under each 64 kb granule of memory it *
+ * touches, so finding the chunk a pointer may belong to takes  *
+ * one lookup instead of a walk over all chunks; a granule can  *
+ * be listed more than once, for chunks that share it           */
+#define WOW_ARENA_GRANULE_BITS 16
+
+struct wow_arena_granule
 {
-	free(ptr);
-}
+	uintptr_t granule;
+	struct wow_arena_chunk *chunk; /* 0 = empty slot */
+};
 
-WOW_API_PREFIX void *wow_calloc_die(size_t nmemb, size_t size)
+static inline
+size_t
+private_arena_granule_hash(uintptr_t granule)
 {
-	void *result = (calloc)(nmemb, size);
-	
-	if (!result)
-		wow_die("memory error");
-	
-	return result;
+	return (size_t)(granule * 2654435761u);
 }
 
-WOW_API_PREFIX void *wow_malloc_die(size_t size)
+static
+void
+private_arena_map_put(struct wow_arena *arena, uintptr_t granule, struct wow_arena_chunk *c)
 {
-	void *result = (malloc)(size);
-	
-	if (!result)
-		wow_die("memory error");
+	size_t mask = arena->map_cap - 1;
+	size_t i = private_arena_granule_hash(granule) & mask;
 	
-	return result;
+	while (arena->map[i].chunk)
+		i = (i + 1) & mask;
+	arena->map[i].granule = granule;
+	arena->map[i].chunk = c;
+	arena->map_used += 1;
 }
 
-WOW_API_PREFIX void *wow_realloc_die(void *ptr, size_t size)
+/* lists a new chunk under the granules it touches */
+static
+void
+private_arena_map_add(struct wow_arena *arena, struct wow_arena_chunk *c)
 {
-	void *result = (realloc)(ptr, size);
+	uintptr_t lo = (uintptr_t)WOW_ARENA_DATA(c) >> WOW_ARENA_GRANULE_BITS;
+	uintptr_t hi = ((uintptr_t)WOW_ARENA_DATA(c) + c->cap - 1) >> WOW_ARENA_GRANULE_BITS;
+	uintptr_t g;
 	
-	if (!result)
-		wow_die("memory error");
+	/* keep it at most half full */
+	if ((arena->map_used + (hi - lo + 1)) * 2 > arena->map_cap)
+	{
+		struct wow_arena_granule *old = arena->map;
+		size_t old_cap = arena->map_cap;
+		size_t i;
+		
+		while ((arena->map_used + (hi - lo + 1)) * 2 > arena->map_cap)
+			arena->map_cap = arena->map_cap ? arena->map_cap * 2 : 64;
+		if (!(arena->map = (calloc)(arena->map_cap, sizeof(*arena->map))))
+			wow_die("memory error");
+		arena->map_used = 0;
+		for (i = 0; i < old_cap; ++i)
+			if (old[i].chunk)
+				private_arena_map_put(arena, old[i].granule, old[i].chunk);
+		free(old);
+	}
 	
-	return result;
+	for (g = lo; g <= hi; ++g)
+		private_arena_map_put(arena, g, c);
 }
 
-WOW_API_PREFIX char *wow_strdup_die(const char *s)
+/* returns non-zero if ptr was carved out of arena */
+static
+int
+private_arena_owns(struct wow_arena *arena, const void *ptr)
 {
-	char *result;
-	int n;
+	const unsigned char *p = ptr;
+	uintptr_t granule = (uintptr_t)p >> WOW_ARENA_GRANULE_BITS;
+	size_t mask = arena->map_cap - 1;
+	size_t i;
 	
-	if (!s)
+	if (!arena->map_cap)
 		return 0;
 	
-	n = strlen(s) + 1;
-	
-	result = wow_malloc_die(n);
-	
-	strcpy(result, s);
+	/* spare chunks have nothing in use, so they never match */
+	for (i = private_arena_granule_hash(granule) & mask; arena->map[i].chunk; i = (i + 1) & mask)
+	{
+		struct wow_arena_chunk *c = arena->map[i].chunk;
+		
+		if (arena->map[i].granule == granule
+			&& p >= WOW_ARENA_DATA(c)
+			&& p < WOW_ARENA_DATA(c) + c->used
+		)
+			return 1;
+	}
 	
-	return result;
+	return 0;
 }
 
-WOW_API_PREFIX void *wow_memdup_die(void *ptr, size_t size)
+/* returns the arena in the scope stack that owns ptr, if any */
+static
+struct wow_arena *
+private_arena_scope_owner(const void *ptr)
 {
-	void *result;
+	struct wow_arena *a;
 	
-	if (!ptr || !size)
-		return 0;
+	for (a = private_arena_scope; a; a = a->scope_prev)
+		if (private_arena_owns(a, ptr))
+			return a;
 	
-	result = wow_malloc_die(size);
+	return 0;
+}
+
+static
+void *
+private_arena_scoped_alloc(size_t size)
+{
+	struct private_arena_scoped *h;
 	
-	memcpy(result, ptr, size);
+	h = wow_arena_alloc(private_arena_scope, sizeof(*h) + size);
+	h->size = size;
 	
-	return result;
+	return h + 1;
 }
 
+/* pool internals */
+#define WOW_POOL_SLAB_BITS 16  /* 64 kb slabs, aligned to their size */
+#define WOW_POOL_SLAB (1 << WOW_POOL_SLAB_BITS)
+#define WOW_POOL_CLASSES 24
+#define WOW_POOL_BATCH 32      /* blocks moved between caches at a time */
+#define WOW_POOL_MAP 256       /* 4 gb regions the pool can live in */
 
-WOW_API_PREFIX
-void *
-wow_utf8_to_wchar(const char *str)
+static const unsigned short private_pool_sizes[WOW_POOL_CLASSES] = {
+	16, 32, 48, 64, 80, 96, 112, 128
+	, 160, 192, 224, 256, 320, 384, 448, 512
+	, 640, 768, 896, 1024, 1280, 1536, 1792, 2048
+};
+
+/* shared state of one size class, guarded by its spinlock */
+static struct private_pool_class
 {
-	if (!str)
-		return 0;
-#if defined(_WIN32) && defined(_UNICODE)
-	const char *src = str;
-	wchar_t *out = 0;
-	size_t src_length;
-	int length;
-	
-	src_length = strlen(src);
-	length = MultiByteToWideChar(CP_UTF8, 0, src, src_length, 0, 0);
-	out = (malloc)((length+1) * sizeof(*out));
-	if (out) {
-		MultiByteToWideChar(CP_UTF8, 0, src, src_length, out, length);
-		out[length] = L'\0';
-	}
-	return out;
+	int lock;
+	void *free;             /* blocks linked through their first word */
+	unsigned char *bump;    /* rest of the newest slab */
+	unsigned char *bump_end;
+} private_pool_class[WOW_POOL_CLASSES];
+
+/* per-thread cache of one size class */
+struct private_pool_cache
+{
+	void *head;
+	unsigned count;
+};
+static WOW_THREAD_LOCAL struct private_pool_cache private_pool_tl[WOW_POOL_CLASSES];
+
+/* which slabs belong to the pool: a table of 4 gb regions, each *
+ * with one byte per slab holding its class + 1 (0 = not pool);  *
+ * entries are only ever added, so lookups don't need the lock  */
+static struct
+{
+	uint64_t key; /* region + 1, 0 = unused */
+	unsigned char *slabs;
+} private_pool_map[WOW_POOL_MAP];
+static int private_pool_map_lock;
+
+/* tells the cpu we're in a spin loop, so it can ease off */
+static
+void
+private_spin_pause(void)
+{
+#if defined(WOW_SIMD_SSE2)
+	_mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+/* spins a short while with the cpu paused, then gives the rest *
+ * of the time slice away, so a holder that was preempted gets  *
+ * to run instead of waiting out a busy loop on the same core   */
+static
+void
+private_spin_lock(int *lock)
+{
+	unsigned spins = 0;
+	
+	while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE))
+	{
+		while (__atomic_load_n(lock, __ATOMIC_RELAXED))
+		{
+			if (++spins < 64)
+				private_spin_pause();
+			else
+#ifdef _WIN32
+				SwitchToThread();
 #else
-    return strdup(str);
+				sched_yield();
 #endif
+		}
+	}
 }
 
+static
+void
+private_spin_unlock(int *lock)
+{
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
 
-WOW_API_PREFIX
-void *
-wow_utf8_to_wchar_die(const char *str)
+/* returns the region's slab table, adding it if create is set */
+static
+unsigned char *
+private_pool_region(uint64_t region, int create)
 {
-	void *result = wow_utf8_to_wchar(str);
+	unsigned i = (unsigned)(region * 0x9E3779B97F4A7C15ull >> 56);
+	unsigned n;
 	
-	if (!result)
+	for (n = 0; n < WOW_POOL_MAP; ++n, i = (i + 1) % WOW_POOL_MAP)
+	{
+		uint64_t key = __atomic_load_n(&private_pool_map[i].key, __ATOMIC_ACQUIRE);
+		
+		if (key == region + 1)
+			return private_pool_map[i].slabs;
+		
+		if (!key)
+		{
+			if (!create)
+				return 0;
+			
+			private_spin_lock(&private_pool_map_lock);
+			key = __atomic_load_n(&private_pool_map[i].key, __ATOMIC_ACQUIRE);
+			if (!key)
+			{
+				unsigned char *slabs = (calloc)(1, (size_t)1 << (32 - WOW_POOL_SLAB_BITS));
+				
+				if (!slabs)
+					wow_die("memory error");
+				private_pool_map[i].slabs = slabs;
+				__atomic_store_n(&private_pool_map[i].key, region + 1, __ATOMIC_RELEASE);
+				private_spin_unlock(&private_pool_map_lock);
+				return slabs;
+			}
+			private_spin_unlock(&private_pool_map_lock);
+			if (key == region + 1)
+				return private_pool_map[i].slabs;
+		}
+	}
+	
+	if (create)
 		wow_die("memory error");
 	
-	return result;
+	return 0;
 }
 
-WOW_API_PREFIX
-char *
-wow_wchar_to_utf8_buf(void *wstr, void *dst, int dst_max)
+/* returns the size class of a pool pointer, or -1 */
+static
+int
+private_pool_class_of(const void *ptr)
 {
-#if defined(_WIN32) && defined(_UNICODE)
-    WideCharToMultiByte(CP_UTF8, 0, wstr, -1, dst, dst_max, 0, 0);
-    return dst;
-#else
-    (void)dst_max; /* unused parameter */
-    return strcpy(dst, wstr);
-#endif
+	uint64_t addr = (uintptr_t)ptr;
+	unsigned char *slabs = private_pool_region(addr >> 32, 0);
+	
+	if (!slabs)
+		return -1;
+	
+	return slabs[(addr & 0xffffffffu) >> WOW_POOL_SLAB_BITS] - 1;
 }
 
-WOW_API_PREFIX
-char *
-wow_wchar_to_utf8(void *wstr)
+static
+int
+private_pool_class_for(size_t size)
 {
-	if (!wstr)
-		return 0;
-#if defined(_WIN32) && defined(_UNICODE)
-	const void *src = wstr;
-	char *out = 0;
-	size_t src_length = 0;
-	int length;
-	
-	src_length = wcslen(src);
-	length = WideCharToMultiByte(CP_UTF8, 0, src, src_length,
-			0, 0, NULL, NULL);
-	out = (malloc)((length+1) * sizeof(char));
-	if (out) {
-		WideCharToMultiByte(CP_UTF8, 0, src, src_length,
-				out, length, NULL, NULL);
-		out[length] = '\0';
-	}
-	return out;
-#else
-    return strdup(wstr);
-#endif
+	int c;
+	
+	if (size <= 128)
+		return size ? (int)((size - 1) >> 4) : 0;
+	
+	for (c = 8; private_pool_sizes[c] < size; ++c)
+		;
+	
+	return c;
 }
 
-WOW_API_PREFIX
-char *
-wow_wchar_to_utf8_die(void *wstr)
+#ifdef WOW_USE_PTHREAD
+/* flushes a thread's caches when it exits */
+static pthread_key_t private_pool_key;
+static pthread_once_t private_pool_once = PTHREAD_ONCE_INIT;
+static WOW_THREAD_LOCAL int private_pool_registered;
+
+static
+void
+private_pool_thread_exit(void *unused)
 {
-	char *result = wow_wchar_to_utf8(wstr);
-	
-	if (!result)
-		wow_die("memory error");
-	
-	return result;
+	(void)unused;
+	wow_pool_flush();
 }
 
-WOW_API_PREFIX
-char *
-wow_wchar_to_utf8_inplace(void *wstr)
+static
+void
+private_pool_key_init(void)
 {
-#if defined(_WIN32) && defined(_UNICODE)
+	pthread_key_create(&private_pool_key, private_pool_thread_exit);
+}
+#endif
+
+/* takes a batch of blocks from the shared class into the thread cache */
+static
+void
+private_pool_refill(int c)
+{
+	struct private_pool_class *pc = &private_pool_class[c];
+	struct private_pool_cache *tl = &private_pool_tl[c];
+	size_t bsz = private_pool_sizes[c];
+	
+#ifdef WOW_USE_PTHREAD
+	if (!private_pool_registered)
+	{
+		pthread_once(&private_pool_once, private_pool_key_init);
+		pthread_setspecific(private_pool_key, &private_pool_registered);
+		private_pool_registered = 1;
+	}
+#endif
+	
+	private_spin_lock(&pc->lock);
+	while (tl->count < WOW_POOL_BATCH)
+	{
+		void *b;
+		
+		if ((b = pc->free))
+			pc->free = *(void**)b;
+		else
+		{
+			if (pc->bump_end - pc->bump < (ptrdiff_t)bsz)
+			{
+				unsigned char *slab;
+				uint64_t addr;
+				
+				if (tl->count)
+					break;
+#if defined(_WIN32)
+				slab = _aligned_malloc(WOW_POOL_SLAB, WOW_POOL_SLAB);
+#else
+				if (posix_memalign((void**)&slab, WOW_POOL_SLAB, WOW_POOL_SLAB))
+					slab = 0;
+#endif
+				if (!slab)
+				{
+					private_spin_unlock(&pc->lock);
+					wow_die("memory error");
+				}
+				addr = (uintptr_t)slab;
+				private_pool_region(addr >> 32, 1)
+					[(addr & 0xffffffffu) >> WOW_POOL_SLAB_BITS] = c + 1;
+				pc->bump = slab;
+				pc->bump_end = slab + WOW_POOL_SLAB;
+			}
+			b = pc->bump;
+			pc->bump += bsz;
+		}
+		*(void**)b = tl->head;
+		tl->head = b;
+		tl->count += 1;
+	}
+	private_spin_unlock(&pc->lock);
+}
+
+/* gives n blocks from the thread cache back to the shared class */
+static
+void
+private_pool_drain(int c, unsigned n)
+{
+	struct private_pool_class *pc = &private_pool_class[c];
+	struct private_pool_cache *tl = &private_pool_tl[c];
+	void *first = tl->head;
+	void *last = first;
+	unsigned i;
+	
+	if (!n || !first)
+		return;
+	
+	/* unlink the first n blocks before taking the lock */
+	for (i = 1; i < n && *(void**)last; ++i)
+		last = *(void**)last;
+	tl->head = *(void**)last;
+	tl->count -= i;
+	
+	private_spin_lock(&pc->lock);
+	*(void**)last = pc->free;
+	pc->free = first;
+	private_spin_unlock(&pc->lock);
+}
+
+WOW_API_PREFIX void *wow_pool_alloc(size_t size)
+{
+	struct private_pool_cache *tl;
+	void *result;
+	int c;
+	
+	if (size > WOW_POOL_MAX)
+	{
+		if (!(result = (malloc)(size)))
+			wow_die("memory error");
+		return result;
+	}
+	
+	c = private_pool_class_for(size);
+	tl = &private_pool_tl[c];
+	if (!tl->head)
+		private_pool_refill(c);
+	
+	result = tl->head;
+	tl->head = *(void**)result;
+	tl->count -= 1;
+	
+	return result;
+}
+
+WOW_API_PREFIX void *wow_pool_calloc(size_t nmemb, size_t size)
+{
+	void *result;
+	
+	if (size && nmemb > (size_t)-1 / size)
+		wow_die("memory error");
+	
+	result = wow_pool_alloc(nmemb * size);
+	memset(result, 0, nmemb * size);
+	
+	return result;
+}
+
+WOW_API_PREFIX void *wow_pool_realloc(void *ptr, size_t size)
+{
+	void *result;
+	int c;
+	
+	if (!ptr)
+		return wow_pool_alloc(size);
+	
+	/* malloc pointers stay with malloc, whose size isn't known here */
+	if ((c = private_pool_class_of(ptr)) < 0)
+	{
+		if (!(result = (realloc)(ptr, size ? size : 1)))
+			wow_die("memory error");
+		return result;
+	}
+	
+	/* still fits in the same class */
+	if (size <= private_pool_sizes[c] && (c == 0 || size > private_pool_sizes[c - 1]))
+		return ptr;
+	
+	result = wow_pool_alloc(size);
+	memcpy(result, ptr, (size < private_pool_sizes[c]) ? size : private_pool_sizes[c]);
+	wow_pool_free(ptr);
+	
+	return result;
+}
+
+WOW_API_PREFIX void wow_pool_free(void *ptr)
+{
+	struct private_pool_cache *tl;
+	int c;
+	
+	if (!ptr)
+		return;
+	
+	if ((c = private_pool_class_of(ptr)) < 0)
+	{
+		free(ptr);
+		return;
+	}
+	
+	tl = &private_pool_tl[c];
+	*(void**)ptr = tl->head;
+	tl->head = ptr;
+	tl->count += 1;
+	
+	/* keep one batch around, hand the rest back */
+	if (tl->count >= 2 * WOW_POOL_BATCH)
+		private_pool_drain(c, WOW_POOL_BATCH);
+}
+
+WOW_API_PREFIX size_t wow_pool_size(const void *ptr)
+{
+	int c;
+	
+	if (!ptr || (c = private_pool_class_of(ptr)) < 0)
+		return 0;
+	
+	return private_pool_sizes[c];
+}
+
+WOW_API_PREFIX void wow_pool_flush(void)
+{
+	int c;
+	
+	for (c = 0; c < WOW_POOL_CLASSES; ++c)
+		private_pool_drain(c, private_pool_tl[c].count);
+}
+
+/* tracking internals: a table of live pointers and one of call *
+ * sites, both open addressing, guarded by one spinlock          */
+struct private_track_site
+{
+	const char *file; /* 0 = unused */
+	int line;
+	uint64_t calls;
+	uint64_t bytes;
+	size_t live_bytes;
+	size_t live_count;
+};
+struct private_track_live
+{
+	void *ptr; /* 0 = unused, 1 = deleted */
+	size_t size;
+	struct private_track_site *site;
+};
+static struct
+{
+	int lock;
+	struct wow_alloc_stats stats;
+	struct private_track_live *live;
+	size_t live_cap;
+	size_t live_used; /* including deleted */
+	struct private_track_site **sites;
+	size_t sites_cap;
+	size_t sites_count;
+	int registered;
+} private_track;
+
+static
+size_t
+private_track_hash(uintptr_t x)
+{
+	return (size_t)(((uint64_t)x * 0x9E3779B97F4A7C15ull) >> 17);
+}
+
+static
+struct private_track_site *
+private_track_site(const char *file, int line)
+{
+	size_t mask = private_track.sites_cap - 1;
+	size_t i;
+	struct private_track_site *site;
+	
+	if ((private_track.sites_count + 1) * 2 > private_track.sites_cap)
+	{
+		struct private_track_site **old = private_track.sites;
+		size_t old_cap = private_track.sites_cap;
+		size_t k;
+		
+		private_track.sites_cap = old_cap ? old_cap * 2 : 256;
+		if (!(private_track.sites = (calloc)(private_track.sites_cap, sizeof(*old))))
+			wow_die("memory error");
+		mask = private_track.sites_cap - 1;
+		for (k = 0; k < old_cap; ++k)
+		{
+			if (!(site = old[k]))
+				continue;
+			i = private_track_hash((uintptr_t)site->file + site->line) & mask;
+			while (private_track.sites[i])
+				i = (i + 1) & mask;
+			private_track.sites[i] = site;
+		}
+		free(old);
+	}
+	
+	i = private_track_hash((uintptr_t)file + line) & mask;
+	while ((site = private_track.sites[i]))
+	{
+		if (site->file == file && site->line == line)
+			return site;
+		i = (i + 1) & mask;
+	}
+	
+	if (!(site = (calloc)(1, sizeof(*site))))
+		wow_die("memory error");
+	site->file = file;
+	site->line = line;
+	private_track.sites[i] = site;
+	private_track.sites_count += 1;
+	
+	return site;
+}
+
+static
+void
+private_track_add(void *ptr, size_t size, struct private_track_site *site)
+{
+	size_t mask = private_track.live_cap - 1;
+	size_t i;
+	
+	if ((private_track.live_used + 1) * 2 > private_track.live_cap)
+	{
+		struct private_track_live *old = private_track.live;
+		size_t old_cap = private_track.live_cap;
+		size_t k;
+		
+		/* grow unless most of the used slots are deletions */
+		if (private_track.stats.live_count * 4 > old_cap)
+			private_track.live_cap = old_cap * 2;
+		if (!private_track.live_cap)
+			private_track.live_cap = 1024;
+		if (!(private_track.live = (calloc)(private_track.live_cap, sizeof(*old))))
+			wow_die("memory error");
+		mask = private_track.live_cap - 1;
+		private_track.live_used = 0;
+		for (k = 0; k < old_cap; ++k)
+		{
+			if ((uintptr_t)old[k].ptr <= 1)
+				continue;
+			i = private_track_hash((uintptr_t)old[k].ptr) & mask;
+			while (private_track.live[i].ptr)
+				i = (i + 1) & mask;
+			private_track.live[i] = old[k];
+			private_track.live_used += 1;
+		}
+		free(old);
+	}
+	
+	i = private_track_hash((uintptr_t)ptr) & mask;
+	while ((uintptr_t)private_track.live[i].ptr > 1)
+		i = (i + 1) & mask;
+	if (!private_track.live[i].ptr)
+		private_track.live_used += 1;
+	private_track.live[i].ptr = ptr;
+	private_track.live[i].size = size;
+	private_track.live[i].site = site;
+	
+	site->calls += 1;
+	site->bytes += size;
+	site->live_bytes += size;
+	site->live_count += 1;
+	private_track.stats.live_bytes += size;
+	private_track.stats.live_count += 1;
+	if (private_track.stats.live_bytes > private_track.stats.peak_bytes)
+		private_track.stats.peak_bytes = private_track.stats.live_bytes;
+}
+
+/* forgets a live pointer; returns 0 if it wasn't tracked */
+static
+int
+private_track_remove(void *ptr)
+{
+	size_t mask = private_track.live_cap - 1;
+	size_t i;
+	
+	if (!private_track.live_cap)
+		return 0;
+	
+	for (i = private_track_hash((uintptr_t)ptr) & mask; private_track.live[i].ptr; i = (i + 1) & mask)
+	{
+		struct private_track_live *e = &private_track.live[i];
+		
+		if (e->ptr != ptr)
+			continue;
+		e->site->live_bytes -= e->size;
+		e->site->live_count -= 1;
+		private_track.stats.live_bytes -= e->size;
+		private_track.stats.live_count -= 1;
+		e->ptr = (void*)1;
+		return 1;
+	}
+	
+	return 0;
+}
+
+static
+void
+private_track_atexit(void)
+{
+	const char *name = getenv("WOW_ALLOC_REPORT");
+	FILE *out;
+	
+	if (!name || !*name)
+		return;
+	
+	if (!strcmp(name, "-"))
+		wow_alloc_report(stderr);
+	else if ((out = fopen(name, "w")))
+	{
+		wow_alloc_report(out);
+		fclose(out);
+	}
+}
+
+static
+void
+private_track_begin(void)
+{
+	private_spin_lock(&private_track.lock);
+	if (!private_track.registered)
+	{
+		private_track.registered = 1;
+		atexit(private_track_atexit);
+	}
+}
+
+static
+int
+private_track_site_cmp(const void *a_, const void *b_)
+{
+	const struct private_track_site *a = *(const struct private_track_site * const*)a_;
+	const struct private_track_site *b = *(const struct private_track_site * const*)b_;
+	
+	if (a->calls != b->calls)
+		return (a->calls < b->calls) ? 1 : -1;
+	if (a->bytes != b->bytes)
+		return (a->bytes < b->bytes) ? 1 : -1;
+	
+	return 0;
+}
+
+WOW_API_PREFIX void wow_alloc_stats_get(struct wow_alloc_stats *stats)
+{
+	private_spin_lock(&private_track.lock);
+	*stats = private_track.stats;
+	private_spin_unlock(&private_track.lock);
+}
+
+WOW_API_PREFIX void wow_alloc_report(FILE *out)
+{
+	struct private_track_site **sorted;
+	struct wow_alloc_stats st;
+	size_t n = 0;
+	size_t i;
+	
+	/* snapshot the sites so printing happens outside the lock */
+	private_spin_lock(&private_track.lock);
+	st = private_track.stats;
+	sorted = (malloc)((private_track.sites_count + 1) * sizeof(*sorted));
+	for (i = 0; sorted && i < private_track.sites_cap; ++i)
+	{
+		struct private_track_site *site = private_track.sites[i];
+		
+		if (!site || !site->calls)
+			continue;
+		if (!(sorted[n] = (malloc)(sizeof(*site))))
+			break;
+		*sorted[n++] = *site;
+	}
+	private_spin_unlock(&private_track.lock);
+	
+	fprintf(out, "allocations: %lu live bytes in %lu blocks, peak %lu bytes\n"
+		, (unsigned long)st.live_bytes
+		, (unsigned long)st.live_count
+		, (unsigned long)st.peak_bytes
+	);
+	fprintf(out, "  %llu allocs, %llu reallocs, %llu frees\n"
+		, (unsigned long long)st.allocs
+		, (unsigned long long)st.reallocs
+		, (unsigned long long)st.frees
+	);
+	
+	if (!sorted)
+		return;
+	
+	qsort(sorted, n, sizeof(*sorted), private_track_site_cmp);
+	fprintf(out, "%12s %14s %12s %8s  %s\n", "calls", "bytes", "live bytes", "live", "site");
+	for (i = 0; i < n; ++i)
+	{
+		fprintf(out, "%12llu %14llu %12lu %8lu  %s:%d\n"
+			, (unsigned long long)sorted[i]->calls
+			, (unsigned long long)sorted[i]->bytes
+			, (unsigned long)sorted[i]->live_bytes
+			, (unsigned long)sorted[i]->live_count
+			, sorted[i]->file
+			, sorted[i]->line
+		);
+		free(sorted[i]);
+	}
+	free(sorted);
+}
+
+WOW_API_PREFIX void wow_alloc_reset(void)
+{
+	size_t i;
+	
+	private_spin_lock(&private_track.lock);
+	private_track.stats.allocs = 0;
+	private_track.stats.reallocs = 0;
+	private_track.stats.frees = 0;
+	private_track.stats.peak_bytes = private_track.stats.live_bytes;
+	for (i = 0; i < private_track.sites_cap; ++i)
+	{
+		struct private_track_site *site = private_track.sites[i];
+		
+		if (!site)
+			continue;
+		site->calls = 0;
+		site->bytes = 0;
+	}
+	private_spin_unlock(&private_track.lock);
+}
+
+WOW_API_PREFIX void *wow_track_malloc(size_t size, const char *file, int line)
+{
+	void *result = wow_malloc_die(size);
+	
+	private_track_begin();
+	private_track.stats.allocs += 1;
+	private_track_add(result, size, private_track_site(file, line));
+	private_spin_unlock(&private_track.lock);
+	
+	return result;
+}
+
+WOW_API_PREFIX void *wow_track_calloc(size_t nmemb, size_t size, const char *file, int line)
+{
+	void *result = wow_calloc_die(nmemb, size);
+	
+	private_track_begin();
+	private_track.stats.allocs += 1;
+	private_track_add(result, nmemb * size, private_track_site(file, line));
+	private_spin_unlock(&private_track.lock);
+	
+	return result;
+}
+
+WOW_API_PREFIX void *wow_track_realloc(void *ptr, size_t size, const char *file, int line)
+{
+	void *result;
+	
+	/* forget ptr first: realloc may hand the address to another thread */
+	if (ptr)
+	{
+		private_track_begin();
+		private_track_remove(ptr);
+		private_spin_unlock(&private_track.lock);
+	}
+	
+	result = wow_realloc_die(ptr, size);
+	
+	private_track_begin();
+	private_track.stats.reallocs += 1;
+	private_track_add(result, size, private_track_site(file, line));
+	private_spin_unlock(&private_track.lock);
+	
+	return result;
+}
+
+WOW_API_PREFIX void wow_track_free(void *ptr)
+{
+	if (!ptr)
+		return;
+	
+	private_track_begin();
+	if (private_track_remove(ptr))
+		private_track.stats.frees += 1;
+	private_spin_unlock(&private_track.lock);
+	
+	wow_free(ptr);
+}
+
+/* log lines are at most this long (bytes, including the newline) */
+#define WOW_LOG_LINE 4096
+
+static const char *const private_log_prefix[] = {
+	"debug: ", "", "warning: ", "error: "
+};
+
+static
+const char *
+private_log_level(int level)
+{
+	if (level < WOW_LOG_DEBUG)
+		level = WOW_LOG_DEBUG;
+	else if (level > WOW_LOG_ERROR)
+		level = WOW_LOG_ERROR;
+	
+	return private_log_prefix[level];
+}
+
+/* writes one line straight to stderr */
+static
+void
+private_log_sync(const char *prefix, const char *fmt, va_list args)
+{
+#if defined(_WIN32) && defined(_UNICODE)
+	char buf[4096];
+	wchar_t wc[4096];
+	size_t n = strlen(prefix);
+	memcpy(buf, prefix, n);
+	vsnprintf(buf + n, sizeof(buf) - n, fmt, args);
+	wc[wow_utf8_to_utf16((uint16_t*)wc, 4095, buf, strlen(buf))] = L'\0';
+	setlocale(LC_ALL, "");
+	fwprintf(stderr, L"%ls", wc);
+#else
+	fputs(prefix, stderr);
+	vfprintf(stderr, fmt, args);
+#endif
+	fprintf(stderr, "\n");
+}
+
+#ifdef WOW_USE_PTHREAD
+
+/* the ring is a bounded multi-producer queue (one sequence number *
+ * per cell); producers never lock, and lines that don't fit in a  *
+ * cell are carried on the heap                                    */
+#define WOW_LOG_RING 1024 /* power of two */
+#define WOW_LOG_CELL 232
+
+struct private_log_cell
+{
+	size_t seq;
+	char *heap;
+	size_t len;
+	char text[WOW_LOG_CELL];
+};
+
+static struct
+{
+	struct private_log_cell cells[WOW_LOG_RING];
+	size_t head; /* next cell a producer claims */
+	size_t tail; /* next cell to write out (under lock) */
+	int ready;
+	int running;
+	int sleeping;
+	int atexit;
+	pthread_t thread;
+	char out[64 * 1024];
+} private_log;
+static pthread_mutex_t private_log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t private_log_wake = PTHREAD_COND_INITIALIZER;
+
+static WOW_THREAD_LOCAL char private_log_line[WOW_LOG_LINE];
+
+/* writes a batch of whole lines to stderr */
+static
+void
+private_log_write(const char *buf, size_t len)
+{
+#if defined(_WIN32) && defined(_UNICODE)
+	const char *end = buf + len;
+	wchar_t wc[WOW_LOG_LINE + 1];
+	
+	setlocale(LC_ALL, "");
+	while (buf < end)
+	{
+		const char *nl = memchr(buf, '\n', end - buf);
+		size_t n = (nl ? nl + 1 : end) - buf;
+		
+		wc[wow_utf8_to_utf16((uint16_t*)wc, WOW_LOG_LINE, buf, n)] = L'\0';
+		fwprintf(stderr, L"%ls", wc);
+		buf += n;
+	}
+#else
+	/* stderr is unbuffered, so this is one write */
+	fwrite(buf, 1, len, stderr);
+#endif
+}
+
+/* writes out published cells, stopping at the first unpublished *
+ * one or at cell 'until'; returns how many were written; the    *
+ * caller holds private_log_lock                                 */
+static
+size_t
+private_log_drain(size_t until)
+{
+	char *out = private_log.out;
+	size_t used = 0;
+	size_t count = 0;
+	
+	while (private_log.tail != until)
+	{
+		size_t tail = private_log.tail;
+		struct private_log_cell *cell = &private_log.cells[tail & (WOW_LOG_RING - 1)];
+		const char *src;
+		
+		if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != tail + 1)
+			break;
+		
+		src = cell->heap ? cell->heap : cell->text;
+		if (used + cell->len > sizeof(private_log.out))
+		{
+			private_log_write(out, used);
+			used = 0;
+		}
+		memcpy(out + used, src, cell->len);
+		used += cell->len;
+		if (cell->heap)
+			(free)(cell->heap);
+		
+		/* hand the cell back to the producers */
+		__atomic_store_n(&cell->seq, tail + WOW_LOG_RING, __ATOMIC_RELEASE);
+		private_log.tail = tail + 1;
+		count += 1;
+	}
+	
+	if (used)
+		private_log_write(out, used);
+	
+	return count;
+}
+
+static
+void *
+private_log_thread(void *arg)
+{
+	(void)arg; /* unused parameter */
+	
+	pthread_mutex_lock(&private_log_lock);
+	while (__atomic_load_n(&private_log.running, __ATOMIC_ACQUIRE))
+	{
+		struct timespec ts;
+		size_t tail = private_log.tail;
+		struct private_log_cell *cell = &private_log.cells[tail & (WOW_LOG_RING - 1)];
+		
+		if (private_log_drain(SIZE_MAX))
+		{
+			/* let wow_log_flush and full producers in between batches */
+			pthread_mutex_unlock(&private_log_lock);
+			pthread_mutex_lock(&private_log_lock);
+			continue;
+		}
+		
+		/* nothing ready: sleep until a producer wakes us; the    *
+		 * seq_cst pair here and in private_log_push makes sure   *
+		 * one of the two sides sees the other, and the timeout   *
+		 * covers anything else                                   */
+		__atomic_store_n(&private_log.sleeping, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&cell->seq, __ATOMIC_SEQ_CST) == tail + 1)
+		{
+			__atomic_store_n(&private_log.sleeping, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += 50 * 1000000;
+		if (ts.tv_nsec >= 1000000000)
+		{
+			ts.tv_sec += 1;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&private_log_wake, &private_log_lock, &ts);
+		__atomic_store_n(&private_log.sleeping, 0, __ATOMIC_RELAXED);
+	}
+	private_log_drain(SIZE_MAX);
+	pthread_mutex_unlock(&private_log_lock);
+	
+	return 0;
+}
+
+/* queues one formatted line */
+static
+void
+private_log_push(const char *line, size_t len)
+{
+	struct private_log_cell *cell;
+	size_t pos = __atomic_load_n(&private_log.head, __ATOMIC_RELAXED);
+	char *heap = 0;
+	
+	if (len > WOW_LOG_CELL)
+	{
+		if (!(heap = (malloc)(len)))
+		{
+			/* keep the order, then write it ourselves */
+			wow_log_flush();
+			private_log_write(line, len);
+			return;
+		}
+		memcpy(heap, line, len);
+	}
+	
+	for (;;)
+	{
+		size_t seq;
+		
+		cell = &private_log.cells[pos & (WOW_LOG_RING - 1)];
+		seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		
+		if (seq == pos)
+		{
+			if (__atomic_compare_exchange_n(&private_log.head, &pos, pos + 1
+				, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+			)
+				break;
+		}
+		else if ((intptr_t)(seq - pos) < 0)
+		{
+			/* ring is full: help write it out */
+			pthread_mutex_lock(&private_log_lock);
+			private_log_drain(SIZE_MAX);
+			pthread_mutex_unlock(&private_log_lock);
+			pos = __atomic_load_n(&private_log.head, __ATOMIC_RELAXED);
+		}
+		else
+			pos = __atomic_load_n(&private_log.head, __ATOMIC_RELAXED);
+	}
+	
+	cell->heap = heap;
+	cell->len = len;
+	if (!heap)
+		memcpy(cell->text, line, len);
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_SEQ_CST);
+	
+	/* wake the writer if it went to sleep */
+	if (__atomic_load_n(&private_log.sleeping, __ATOMIC_SEQ_CST)
+		&& __atomic_exchange_n(&private_log.sleeping, 0, __ATOMIC_RELAXED)
+	)
+	{
+		pthread_mutex_lock(&private_log_lock);
+		pthread_cond_signal(&private_log_wake);
+		pthread_mutex_unlock(&private_log_lock);
+	}
+}
+
+static
+void
+private_log_atexit(void)
+{
+	wow_log_async_end();
+}
+
+#endif /* WOW_USE_PTHREAD */
+
+/* formats a line and queues it if the background writer is running */
+static
+void
+private_log_v(const char *prefix, const char *fmt, va_list args)
+{
+#ifdef WOW_USE_PTHREAD
+	if (__atomic_load_n(&private_log.running, __ATOMIC_ACQUIRE))
+	{
+		char *buf = private_log_line;
+		size_t n = strlen(prefix);
+		int len;
+		
+		memcpy(buf, prefix, n);
+		len = vsnprintf(buf + n, WOW_LOG_LINE - n - 1, fmt, args);
+		if (len > 0)
+			n += len;
+		if (n > WOW_LOG_LINE - 2)
+			n = WOW_LOG_LINE - 2;
+		buf[n++] = '\n';
+		private_log_push(buf, n);
+		return;
+	}
+#endif
+	private_log_sync(prefix, fmt, args);
+}
+
+WOW_API_PREFIX int wow_log_async_begin(void)
+{
+#ifdef WOW_USE_PTHREAD
+	int rval = 0;
+	
+	pthread_mutex_lock(&private_log_lock);
+	if (!private_log.ready)
+	{
+		size_t i;
+		
+		for (i = 0; i < WOW_LOG_RING; ++i)
+			private_log.cells[i].seq = i;
+		private_log.ready = 1;
+	}
+	if (!private_log.running)
+	{
+		__atomic_store_n(&private_log.running, 1, __ATOMIC_RELEASE);
+		if (pthread_create(&private_log.thread, 0, private_log_thread, 0))
+		{
+			__atomic_store_n(&private_log.running, 0, __ATOMIC_RELEASE);
+			rval = -1;
+		}
+		else if (!private_log.atexit)
+		{
+			atexit(private_log_atexit);
+			private_log.atexit = 1;
+		}
+	}
+	pthread_mutex_unlock(&private_log_lock);
+	
+	return rval;
+#else
+	return -1;
+#endif
+}
+
+WOW_API_PREFIX void wow_log_flush(void)
+{
+#ifdef WOW_USE_PTHREAD
+	size_t until;
+	size_t wrote;
+	int done;
+	
+	if (!__atomic_load_n(&private_log.ready, __ATOMIC_ACQUIRE))
+		return;
+	
+	/* cells claimed before now are published shortly, so wait on *
+	 * them; the lock is let go between tries, so the producer    *
+	 * still filling one in isn't kept from the ring meanwhile    */
+	until = __atomic_load_n(&private_log.head, __ATOMIC_ACQUIRE);
+	for (;;)
+	{
+		pthread_mutex_lock(&private_log_lock);
+		wrote = private_log_drain(until);
+		done = (intptr_t)(until - private_log.tail) <= 0;
+		pthread_mutex_unlock(&private_log_lock);
+		if (done)
+			break;
+		if (!wrote)
+#ifdef _WIN32
+			SwitchToThread();
+#else
+			sched_yield();
+#endif
+	}
+#endif
+}
+
+WOW_API_PREFIX void wow_log_async_end(void)
+{
+#ifdef WOW_USE_PTHREAD
+	pthread_mutex_lock(&private_log_lock);
+	if (!private_log.running)
+	{
+		pthread_mutex_unlock(&private_log_lock);
+		return;
+	}
+	__atomic_store_n(&private_log.running, 0, __ATOMIC_RELEASE);
+	pthread_cond_signal(&private_log_wake);
+	pthread_mutex_unlock(&private_log_lock);
+	
+	pthread_join(private_log.thread, 0);
+	wow_log_flush();
+#endif
+}
+
+WOW_API_PREFIX void wow_log(int level, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	private_log_v(private_log_level(level), fmt, args);
+	va_end(args);
+}
+
+WOW_API_PREFIX void wow_die(const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	
+	/* queued lines go out first, then this one, synchronously */
+	wow_log_flush();
+	private_log_sync("", fmt, args);
+	va_end(args);
+	exit(EXIT_FAILURE);
+}
+
+WOW_API_PREFIX void wow_stderr(const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	private_log_v("", fmt, args);
+	va_end(args);
+}
+
+#ifdef WOW_TRACE
+
+#define WOW_TRACE_CHUNK 4096
+
+struct private_trace_event
+{
+	const char *name;
+	uint64_t ns;
+	int phase;
+};
+
+struct private_trace_chunk
+{
+	struct private_trace_chunk *next;
+	size_t count; /* published with release, read with acquire */
+	struct private_trace_event event[WOW_TRACE_CHUNK];
+};
+
+/* one per thread that has recorded anything; these outlive *
+ * their threads so the events can be written at exit      */
+struct private_trace_thread
+{
+	struct private_trace_thread *next;
+	struct private_trace_chunk *head;
+	struct private_trace_chunk *tail;
+	int tid;
+};
+
+static struct
+{
+	struct private_trace_thread *threads;
+	int lock;
+	int count;
+} private_trace;
+
+static WOW_THREAD_LOCAL struct private_trace_thread *private_trace_self;
+
+static
+uint64_t
+private_trace_now(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+	
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	
+	return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000000
+		+ (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart
+	;
+#else
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static
+void
+private_trace_atexit(void)
+{
+	const char *path = getenv("WOW_TRACE_FILE");
+	
+	wow_trace_write((path && *path) ? path : "wow_trace.json");
+}
+
+/* the allocations here bypass wow_malloc_die so that tracing *
+ * works the same inside arena scopes and under tracking      */
+static
+struct private_trace_thread *
+private_trace_register(void)
+{
+	struct private_trace_thread *self = (calloc)(1, sizeof(*self));
+	
+	if (!self || !(self->head = (calloc)(1, sizeof(*self->head))))
+	{
+		(free)(self);
+		return 0;
+	}
+	self->tail = self->head;
+	
+	private_spin_lock(&private_trace.lock);
+	if (!private_trace.count)
+		atexit(private_trace_atexit);
+	self->tid = ++private_trace.count;
+	self->next = private_trace.threads;
+	private_trace.threads = self;
+	private_spin_unlock(&private_trace.lock);
+	
+	return private_trace_self = self;
+}
+
+WOW_API_PREFIX void wow_trace_event(const char *name, int phase)
+{
+	struct private_trace_thread *self = private_trace_self;
+	struct private_trace_chunk *chunk;
+	struct private_trace_event *event;
+	
+	if (!self && !(self = private_trace_register()))
+		return;
+	
+	chunk = self->tail;
+	if (chunk->count == WOW_TRACE_CHUNK)
+	{
+		struct private_trace_chunk *next = (calloc)(1, sizeof(*next));
+		
+		if (!next)
+			return;
+		__atomic_store_n(&chunk->next, next, __ATOMIC_RELEASE);
+		self->tail = chunk = next;
+	}
+	
+	event = &chunk->event[chunk->count];
+	event->name = name;
+	event->phase = phase;
+	event->ns = private_trace_now();
+	__atomic_store_n(&chunk->count, chunk->count + 1, __ATOMIC_RELEASE);
+}
+
+WOW_API_PREFIX const char *wow_trace_scope_begin(const char *name)
+{
+	wow_trace_event(name, 'B');
+	
+	return name;
+}
+
+WOW_API_PREFIX void wow_trace_scope_end(const char **name)
+{
+	wow_trace_event(*name, 'E');
+}
+
+/* writes a JSON string */
+static
+void
+private_trace_string(FILE *fp, const char *str)
+{
+	fputc('"', fp);
+	for ( ; *str; ++str)
+	{
+		unsigned char c = *str;
+		
+		if (c == '"' || c == '\\')
+			fprintf(fp, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(fp, "\\u%04x", c);
+		else
+			fputc(c, fp);
+	}
+	fputc('"', fp);
+}
+
+#endif /* WOW_TRACE */
+
+WOW_API_PREFIX int wow_trace_write(const char *path)
+{
+#ifdef WOW_TRACE
+	struct private_trace_thread *threads;
+	struct private_trace_thread *thread;
+	uint64_t epoch = UINT64_MAX;
+	const char *sep = "";
+	FILE *fp;
+	int rval;
+	
+	if (!(fp = wow_fopen(path, "w")))
+		return -1;
+	
+	private_spin_lock(&private_trace.lock);
+	threads = private_trace.threads;
+	private_spin_unlock(&private_trace.lock);
+	
+	/* timestamps are written relative to the earliest event */
+	for (thread = threads; thread; thread = thread->next)
+		if (__atomic_load_n(&thread->head->count, __ATOMIC_ACQUIRE)
+			&& thread->head->event[0].ns < epoch
+		)
+			epoch = thread->head->event[0].ns;
+	
+	fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	for (thread = threads; thread; thread = thread->next)
+	{
+		struct private_trace_chunk *chunk;
+		
+		for (chunk = thread->head; chunk; chunk = __atomic_load_n(&chunk->next, __ATOMIC_ACQUIRE))
+		{
+			size_t count = __atomic_load_n(&chunk->count, __ATOMIC_ACQUIRE);
+			size_t i;
+			
+			for (i = 0; i < count; ++i)
+			{
+				const struct private_trace_event *event = &chunk->event[i];
+				uint64_t ns = event->ns - epoch;
+				
+				fprintf(fp, "%s\n{\"name\":", sep);
+				private_trace_string(fp, event->name ? event->name : "");
+				fprintf(fp, ",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":1,\"tid\":%d}"
+					, event->phase
+					, (unsigned long long)(ns / 1000)
+					, (unsigned)(ns % 1000)
+					, thread->tid
+				);
+				sep = ",";
+			}
+		}
+	}
+	fprintf(fp, "\n]}\n");
+	
+	rval = ferror(fp) ? -1 : 0;
+	if (fclose(fp))
+		rval = -1;
+	
+	return rval;
+#else
+	(void)path; /* unused parameter */
+	
+	return -1;
+#endif
+}
+
+WOW_API_PREFIX void wow_free(void *ptr)
+{
+	/* arena allocations go away with the arena */
+	if (private_arena_scope && ptr && private_arena_scope_owner(ptr))
+		return;
+	
+#ifdef WOW_POOL_ALLOCATORS
+	wow_pool_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+WOW_API_PREFIX void *wow_calloc_die(size_t nmemb, size_t size)
+{
+	void *result;
+	
+	if (private_arena_scope)
+	{
+		if (size && nmemb > (size_t)-1 / size)
+			wow_die("memory error");
+		result = private_arena_scoped_alloc(nmemb * size);
+		memset(result, 0, nmemb * size);
+		return result;
+	}
+	
+#ifdef WOW_POOL_ALLOCATORS
+	return wow_pool_calloc(nmemb, size);
+#endif
+	result = (calloc)(nmemb, size);
+	
+	if (!result)
+		wow_die("memory error");
+	
+	return result;
+}
+
+WOW_API_PREFIX void *wow_malloc_die(size_t size)
+{
+	void *result;
+	
+	if (private_arena_scope)
+		return private_arena_scoped_alloc(size);
+	
+#ifdef WOW_POOL_ALLOCATORS
+	return wow_pool_alloc(size);
+#endif
+	result = (malloc)(size);
+	
+	if (!result)
+		wow_die("memory error");
+	
+	return result;
+}
+
+WOW_API_PREFIX void *wow_realloc_die(void *ptr, size_t size)
+{
+	void *result;
+	
+	if (private_arena_scope && (!ptr || private_arena_scope_owner(ptr)))
+	{
+		struct private_arena_scoped *h = ptr;
+		
+		result = private_arena_scoped_alloc(size);
+		if (h)
+		{
+			h -= 1;
+			memcpy(result, ptr, (h->size < size) ? h->size : size);
+		}
+		return result;
+	}
+	
+#ifdef WOW_POOL_ALLOCATORS
+	return wow_pool_realloc(ptr, size);
+#endif
+	result = (realloc)(ptr, size);
+	
+	if (!result)
+		wow_die("memory error");
+	
+	return result;
+}
+
+WOW_API_PREFIX char *wow_strdup_die(const char *s)
+{
+	char *result;
+	int n;
+	
+	if (!s)
+		return 0;
+	
+	n = strlen(s) + 1;
+	
+	result = wow_malloc_die(n);
+	
+	strcpy(result, s);
+	
+	return result;
+}
+
+WOW_API_PREFIX void *wow_memdup_die(void *ptr, size_t size)
+{
+	void *result;
+	
+	if (!ptr || !size)
+		return 0;
+	
+	result = wow_malloc_die(size);
+	
+	memcpy(result, ptr, size);
+	
+	return result;
+}
+
+
+WOW_API_PREFIX void wow_arena_init(struct wow_arena *arena, size_t chunk_size)
+{
+	memset(arena, 0, sizeof(*arena));
+	arena->chunk_size = chunk_size;
+}
+
+WOW_API_PREFIX void *wow_arena_alloc(struct wow_arena *arena, size_t size)
+{
+	struct wow_arena_chunk *c = arena->head;
+	struct wow_arena_chunk **spare;
+	void *result;
+	
+	size = WOW_ARENA_ALIGN(size);
+	if (size < 16)
+		size = 16;
+	
+	/* doesn't fit: reuse a spare chunk, or make a new one */
+	if (!c || c->cap - c->used < size)
+	{
+		for (spare = &arena->spare; *spare; spare = &(*spare)->prev)
+			if ((*spare)->cap >= size)
+				break;
+		
+		if ((c = *spare))
+			*spare = c->prev;
+		else
+		{
+			size_t cap = arena->chunk_size ? arena->chunk_size : 64 * 1024;
+			
+			if (cap < size)
+				cap = size;
+			cap = WOW_ARENA_ALIGN(cap);
+			if (!(c = (malloc)(sizeof(*c) + cap)))
+				wow_die("memory error");
+			c->cap = cap;
+			private_arena_map_add(arena, c);
+		}
+		c->used = 0;
+		c->prev = arena->head;
+		arena->head = c;
+	}
+	
+	result = WOW_ARENA_DATA(c) + c->used;
+	c->used += size;
+	
+	return result;
+}
+
+WOW_API_PREFIX void *wow_arena_calloc(struct wow_arena *arena, size_t nmemb, size_t size)
+{
+	void *result;
+	
+	if (size && nmemb > (size_t)-1 / size)
+		wow_die("memory error");
+	
+	result = wow_arena_alloc(arena, nmemb * size);
+	memset(result, 0, nmemb * size);
+	
+	return result;
+}
+
+WOW_API_PREFIX char *wow_arena_strdup(struct wow_arena *arena, const char *s)
+{
+	if (!s)
+		return 0;
+	
+	return wow_arena_memdup(arena, s, strlen(s) + 1);
+}
+
+WOW_API_PREFIX void *wow_arena_memdup(struct wow_arena *arena, const void *ptr, size_t size)
+{
+	void *result;
+	
+	if (!ptr || !size)
+		return 0;
+	
+	result = wow_arena_alloc(arena, size);
+	memcpy(result, ptr, size);
+	
+	return result;
+}
+
+WOW_API_PREFIX struct wow_arena_mark wow_arena_mark(struct wow_arena *arena)
+{
+	struct wow_arena_mark mark = { arena->head, 0 };
+	
+	if (arena->head)
+		mark.used = arena->head->used;
+	
+	return mark;
+}
+
+WOW_API_PREFIX void wow_arena_reset(struct wow_arena *arena, struct wow_arena_mark mark)
+{
+	struct wow_arena_chunk *c;
+	
+	/* chunks made after the mark become spares */
+	while ((c = arena->head) && c != mark.chunk)
+	{
+		arena->head = c->prev;
+		c->prev = arena->spare;
+		c->used = 0;
+		arena->spare = c;
+	}
+	
+	if (arena->head)
+		arena->head->used = mark.used;
+}
+
+WOW_API_PREFIX void wow_arena_release(struct wow_arena *arena)
+{
+	struct wow_arena_chunk *c;
+	
+	wow_arena_reset(arena, (struct wow_arena_mark){0});
+	
+	while ((c = arena->spare))
+	{
+		arena->spare = c->prev;
+		free(c);
+	}
+	
+	free(arena->map);
+	arena->map = 0;
+	arena->map_cap = 0;
+	arena->map_used = 0;
+}
+
+WOW_API_PREFIX void wow_arena_push_scope(struct wow_arena *arena)
+{
+	arena->scope_prev = private_arena_scope;
+	private_arena_scope = arena;
+}
+
+WOW_API_PREFIX void wow_arena_pop_scope(void)
+{
+	if (private_arena_scope)
+		private_arena_scope = private_arena_scope->scope_prev;
+}
+
+
+#if defined(WOW_SIMD_SSE2) || defined(WOW_SIMD_AVX2)
+/* count trailing zeros of a non-zero mask */
+static
+int
+private_ctz(unsigned x)
+{
+#if defined(__GNUC__)
+	return __builtin_ctz(x);
+#else
+	int n = 0;
+	
+	while (!(x & 1))
+	{
+		x >>= 1;
+		n += 1;
+	}
+	
+	return n;
+#endif
+}
+#endif
+
+/* returns the length of the ascii run at the start of s */
+static
+size_t
+private_ascii_run(const unsigned char *s, size_t n)
+{
+	size_t i = 0;
+	
+#if defined(WOW_SIMD_AVX2)
+	for (; i + 32 <= n; i += 32)
+	{
+		unsigned m = _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)(s + i)));
+		
+		if (m)
+			return i + private_ctz(m);
+	}
+#endif
+#if defined(WOW_SIMD_SSE2)
+	for (; i + 16 <= n; i += 16)
+	{
+		unsigned m = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(s + i)));
+		
+		if (m)
+			return i + private_ctz(m);
+	}
+#elif defined(WOW_SIMD_NEON)
+	for (; i + 16 <= n; i += 16)
+		if (vmaxvq_u8(vld1q_u8(s + i)) >= 0x80)
+			break;
+#endif
+	while (i < n && s[i] < 0x80)
+		++i;
+	
+	return i;
+}
+
+/* returns the length of the ascii run at the start of s */
+static
+size_t
+private_utf16_ascii_run(const uint16_t *s, size_t n)
+{
+	size_t i = 0;
+	
+#if defined(WOW_SIMD_AVX2)
+	const __m256i hi8 = _mm256_set1_epi16((short)0xff80);
+	for (; i + 16 <= n; i += 16)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+		unsigned m = ~_mm256_movemask_epi8(
+			_mm256_cmpeq_epi16(_mm256_and_si256(v, hi8), _mm256_setzero_si256())
+		);
+		
+		if (m)
+			return i + private_ctz(m) / 2;
+	}
+#endif
+#if defined(WOW_SIMD_SSE2)
+	const __m128i hi = _mm_set1_epi16((short)0xff80);
+	for (; i + 8 <= n; i += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+		unsigned m = ~_mm_movemask_epi8(
+			_mm_cmpeq_epi16(_mm_and_si128(v, hi), _mm_setzero_si128())
+		) & 0xffff;
+		
+		if (m)
+			return i + private_ctz(m) / 2;
+	}
+#elif defined(WOW_SIMD_NEON)
+	for (; i + 8 <= n; i += 8)
+		if (vmaxvq_u16(vld1q_u16(s + i)) >= 0x80)
+			break;
+#endif
+	while (i < n && s[i] < 0x80)
+		++i;
+	
+	return i;
+}
+
+/* ascii bytes -> utf-16 units */
+static
+void
+private_ascii_widen(uint16_t *d, const unsigned char *s, size_t n)
+{
+	size_t i = 0;
+	
+#if defined(WOW_SIMD_AVX2)
+	for (; i + 16 <= n; i += 16)
+		_mm256_storeu_si256((__m256i*)(d + i)
+			, _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(s + i)))
+		);
+#elif defined(WOW_SIMD_SSE2)
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+		
+		_mm_storeu_si128((__m128i*)(d + i), _mm_unpacklo_epi8(v, _mm_setzero_si128()));
+		_mm_storeu_si128((__m128i*)(d + i + 8), _mm_unpackhi_epi8(v, _mm_setzero_si128()));
+	}
+#elif defined(WOW_SIMD_NEON)
+	for (; i + 16 <= n; i += 16)
+	{
+		uint8x16_t v = vld1q_u8(s + i);
+		
+		vst1q_u16(d + i, vmovl_u8(vget_low_u8(v)));
+		vst1q_u16(d + i + 8, vmovl_high_u8(v));
+	}
+#endif
+	for (; i < n; ++i)
+		d[i] = s[i];
+}
+
+/* ascii utf-16 units -> bytes */
+static
+void
+private_ascii_narrow(unsigned char *d, const uint16_t *s, size_t n)
+{
+	size_t i = 0;
+	
+#if defined(WOW_SIMD_SSE2)
+	for (; i + 16 <= n; i += 16)
+		_mm_storeu_si128((__m128i*)(d + i), _mm_packus_epi16(
+			_mm_loadu_si128((const __m128i*)(s + i))
+			, _mm_loadu_si128((const __m128i*)(s + i + 8))
+		));
+#elif defined(WOW_SIMD_NEON)
+	for (; i + 16 <= n; i += 16)
+		vst1q_u8(d + i, vcombine_u8(vmovn_u16(vld1q_u16(s + i)), vmovn_u16(vld1q_u16(s + i + 8))));
+#endif
+	for (; i < n; ++i)
+		d[i] = (unsigned char)s[i];
+}
+
+/* decodes one code point from a non-empty s; returns bytes used, *
+ * and stores U+FFFD for a malformed byte (which uses up 1 byte)  */
+static
+size_t
+private_utf8_decode(const unsigned char *s, size_t n, uint32_t *cp)
+{
+	unsigned c = s[0];
+	uint32_t x;
+	
+	if (c < 0x80)
+	{
+		*cp = c;
+		return 1;
+	}
+	if (c >= 0xc2 && c <= 0xdf)
+	{
+		if (n >= 2 && (s[1] & 0xc0) == 0x80)
+		{
+			*cp = ((c & 0x1f) << 6) | (s[1] & 0x3f);
+			return 2;
+		}
+	}
+	else if (c >= 0xe0 && c <= 0xef)
+	{
+		if (n >= 3 && (s[1] & 0xc0) == 0x80 && (s[2] & 0xc0) == 0x80)
+		{
+			x = ((c & 0x0f) << 12) | ((s[1] & 0x3f) << 6) | (s[2] & 0x3f);
+			/* no overlongs, no surrogates */
+			if (x >= 0x800 && (x < 0xd800 || x > 0xdfff))
+			{
+				*cp = x;
+				return 3;
+			}
+		}
+	}
+	else if (c >= 0xf0 && c <= 0xf4)
+	{
+		if (n >= 4
+			&& (s[1] & 0xc0) == 0x80
+			&& (s[2] & 0xc0) == 0x80
+			&& (s[3] & 0xc0) == 0x80
+		)
+		{
+			x = ((uint32_t)(c & 0x07) << 18) | ((s[1] & 0x3f) << 12)
+				| ((s[2] & 0x3f) << 6) | (s[3] & 0x3f);
+			if (x >= 0x10000 && x <= 0x10ffff)
+			{
+				*cp = x;
+				return 4;
+			}
+		}
+	}
+	
+	*cp = 0xfffd;
+	return 1;
+}
+
+WOW_API_PREFIX
+size_t
+wow_utf8_to_utf16(uint16_t *dst, size_t dst_max, const char *src, size_t src_len)
+{
+	const unsigned char *s = (const unsigned char*)src;
+	size_t i = 0;
+	size_t o = 0;
+	uint32_t cp;
+	size_t run;
+	
+	while (i < src_len)
+	{
+		if (s[i] < 0x80)
+		{
+			run = private_ascii_run(s + i, src_len - i);
+			if (o < dst_max)
+				private_ascii_widen(dst + o, s + i
+					, (run < dst_max - o) ? run : dst_max - o
+				);
+			i += run;
+			o += run;
+			continue;
+		}
+		
+		i += private_utf8_decode(s + i, src_len - i, &cp);
+		if (cp >= 0x10000)
+		{
+			if (o + 1 < dst_max)
+			{
+				cp -= 0x10000;
+				dst[o] = 0xd800 | (cp >> 10);
+				dst[o + 1] = 0xdc00 | (cp & 0x3ff);
+			}
+			o += 2;
+		}
+		else
+		{
+			if (o < dst_max)
+				dst[o] = cp;
+			o += 1;
+		}
+	}
+	
+	return o;
+}
+
+WOW_API_PREFIX
+size_t
+wow_utf16_to_utf8(char *dst, size_t dst_max, const uint16_t *src, size_t src_len)
+{
+	unsigned char *d = (unsigned char*)dst;
+	size_t i = 0;
+	size_t o = 0;
+	uint32_t cp;
+	size_t run;
+	
+	while (i < src_len)
+	{
+		if (src[i] < 0x80)
+		{
+			run = private_utf16_ascii_run(src + i, src_len - i);
+			if (o < dst_max)
+				private_ascii_narrow(d + o, src + i
+					, (run < dst_max - o) ? run : dst_max - o
+				);
+			i += run;
+			o += run;
+			continue;
+		}
+		
+		cp = src[i++];
+		if (cp >= 0xd800 && cp <= 0xdbff
+			&& i < src_len
+			&& src[i] >= 0xdc00 && src[i] <= 0xdfff
+		)
+			cp = 0x10000 + ((cp - 0xd800) << 10) + (src[i++] - 0xdc00);
+		else if (cp >= 0xd800 && cp <= 0xdfff)
+			cp = 0xfffd;
+		
+		if (cp < 0x800)
+		{
+			if (o + 2 <= dst_max)
+			{
+				d[o] = 0xc0 | (cp >> 6);
+				d[o + 1] = 0x80 | (cp & 0x3f);
+			}
+			o += 2;
+		}
+		else if (cp < 0x10000)
+		{
+			if (o + 3 <= dst_max)
+			{
+				d[o] = 0xe0 | (cp >> 12);
+				d[o + 1] = 0x80 | ((cp >> 6) & 0x3f);
+				d[o + 2] = 0x80 | (cp & 0x3f);
+			}
+			o += 3;
+		}
+		else
+		{
+			if (o + 4 <= dst_max)
+			{
+				d[o] = 0xf0 | (cp >> 18);
+				d[o + 1] = 0x80 | ((cp >> 12) & 0x3f);
+				d[o + 2] = 0x80 | ((cp >> 6) & 0x3f);
+				d[o + 3] = 0x80 | (cp & 0x3f);
+			}
+			o += 4;
+		}
+	}
+	
+	return o;
+}
+
+WOW_API_PREFIX
+uint16_t *
+wow_utf16_buf_init(struct wow_utf16_buf *buf, const char *str)
+{
+	size_t len;
+	
+	buf->str = 0;
+	if (!str)
+		return 0;
+	
+	len = strlen(str);
+	if (wow_utf8_valid(str, len) != len)
+	{
+		errno = EILSEQ;
+		return 0;
+	}
+	
+	/* never more utf-16 units than utf-8 bytes, so one pass does it */
+	buf->str = buf->stack;
+	if (len >= WOW_UTF16_BUF_STACK)
+		buf->str = wow_malloc_die((len + 1) * sizeof(*buf->str));
+	buf->str[wow_utf8_to_utf16(buf->str, len, str, len)] = 0;
+	
+	return buf->str;
+}
+
+WOW_API_PREFIX
+void
+wow_utf16_buf_free(struct wow_utf16_buf *buf)
+{
+	if (buf->str && buf->str != buf->stack)
+		wow_free(buf->str);
+	buf->str = 0;
+}
+
+
+#if defined(WOW_SIMD_AVX2)
+/* checks 32 bytes at a time with three nibble lookups per byte *
+ * (after Keiser and Lemire, "Validating UTF-8 In Less Than One *
+ * Instruction Per Byte"); returns how far it got without error *
+ * and without ending on an unfinished sequence                 */
+static
+size_t
+private_utf8_valid_avx2(const unsigned char *s, size_t len)
+{
+	#define TOO_SHORT  (1 << 0)
+	#define TOO_LONG   (1 << 1)
+	#define OVERLONG_3 (1 << 2)
+	#define TOO_LARGE  (1 << 3)
+	#define SURROGATE  (1 << 4)
+	#define OVERLONG_2 (1 << 5)
+	#define TOO_LARGE_1000 (1 << 6)
+	#define OVERLONG_4 (1 << 6)
+	#define TWO_CONTS  (1 << 7)
+	#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+	#define TABLE(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+	const __m256i byte_1_high_tab = TABLE(
+		/* 0_______: ascii */
+		TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG
+		, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG
+		/* 10______: continuation */
+		, TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS
+		/* 1100____, 1101____: two byte lead */
+		, TOO_SHORT | OVERLONG_2
+		, TOO_SHORT
+		/* 1110____: three byte lead */
+		, TOO_SHORT | OVERLONG_3 | SURROGATE
+		/* 1111____: four byte lead */
+		, TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+	);
+	const __m256i byte_1_low_tab = TABLE(
+		CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4
+		, CARRY | OVERLONG_2
+		, CARRY
+		, CARRY
+		, CARRY | TOO_LARGE
+		, CARRY | TOO_LARGE | TOO_LARGE_1000
+		, CARRY | TOO_LARGE | TOO_LARGE_1000
+		, CARRY | TOO_LARGE | TOO_LARGE_1000
+		, CARRY | TOO_LARGE | TOO_LARGE_1000
+		, CARRY | TOO_LARGE | TOO_LARGE_1000
+		, CARRY | TOO_LARGE | TOO_LARGE_1000
+		, CARRY | TOO_LARGE | TOO_LARGE_1000
+		, CARRY | TOO_LARGE | TOO_LARGE_1000
+		, CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE
+		, CARRY | TOO_LARGE | TOO_LARGE_1000
+		, CARRY | TOO_LARGE | TOO_LARGE_1000
+	);
+	const __m256i byte_2_high_tab = TABLE(
+		/* 0_______: ascii */
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+		, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+		/* 1000____, 1001____, 101_____: continuation */
+		, TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4
+		, TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE
+		, TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE
+		, TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE
+		/* 11______: lead */
+		, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+	);
+	/* a lead byte in the last 1-3 bytes needs the next block */
+	const __m256i max_tail = _mm256_setr_epi8(
+		-1, -1, -1, -1, -1, -1, -1, -1
+		, -1, -1, -1, -1, -1, -1, -1, -1
+		, -1, -1, -1, -1, -1, -1, -1, -1
+		, -1, -1, -1, -1, -1, 0xf0 - 1, 0xe0 - 1, 0xc0 - 1
+	);
+	#undef TABLE
+	const __m256i nib = _mm256_set1_epi8(0x0f);
+	__m256i prev = _mm256_setzero_si256();
+	__m256i incomplete = _mm256_setzero_si256();
+	size_t i;
+	
+	for (i = 0; i + 32 <= len; i += 32)
+	{
+		__m256i in = _mm256_loadu_si256((const __m256i*)(s + i));
+		__m256i err;
+		
+		if (!_mm256_movemask_epi8(in))
+		{
+			/* ascii can't finish what the last block started */
+			if (!_mm256_testz_si256(incomplete, incomplete))
+				break;
+		}
+		else
+		{
+			/* the 16 bytes straddling prev and in, to shift from */
+			__m256i straddle = _mm256_permute2x128_si256(prev, in, 0x21);
+			__m256i prev1 = _mm256_alignr_epi8(in, straddle, 16 - 1);
+			__m256i prev2 = _mm256_alignr_epi8(in, straddle, 16 - 2);
+			__m256i prev3 = _mm256_alignr_epi8(in, straddle, 16 - 3);
+			__m256i special = _mm256_and_si256(
+				_mm256_and_si256(
+					_mm256_shuffle_epi8(byte_1_high_tab
+						, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nib)
+					)
+					, _mm256_shuffle_epi8(byte_1_low_tab
+						, _mm256_and_si256(prev1, nib)
+					)
+				)
+				, _mm256_shuffle_epi8(byte_2_high_tab
+					, _mm256_and_si256(_mm256_srli_epi16(in, 4), nib)
+				)
+			);
+			/* third and fourth bytes of a sequence must be continuations */
+			__m256i must23 = _mm256_or_si256(
+				_mm256_subs_epu8(prev2, _mm256_set1_epi8(0xe0 - 0x80))
+				, _mm256_subs_epu8(prev3, _mm256_set1_epi8(0xf0 - 0x80))
+			);
+			
+			err = _mm256_xor_si256(
+				_mm256_and_si256(must23, _mm256_set1_epi8((char)0x80))
+				, special
+			);
+			if (!_mm256_testz_si256(err, err))
+				break;
+			incomplete = _mm256_subs_epu8(in, max_tail);
+		}
+		prev = in;
+	}
+	#undef TOO_SHORT
+	#undef TOO_LONG
+	#undef OVERLONG_3
+	#undef TOO_LARGE
+	#undef SURROGATE
+	#undef OVERLONG_2
+	#undef TOO_LARGE_1000
+	#undef OVERLONG_4
+	#undef TWO_CONTS
+	#undef CARRY
+	
+	/* back up to the start of the character the block boundary split */
+	{
+		size_t k = i;
+		
+		while (k > 0 && i - k < 3 && (s[k - 1] & 0xc0) == 0x80)
+			--k;
+		if (k > 0 && s[k - 1] >= 0xc0)
+			--k;
+		return k;
+	}
+}
+#endif
+
+WOW_API_PREFIX
+size_t
+wow_utf8_valid(const char *s, size_t len)
+{
+	const unsigned char *u = (const unsigned char*)s;
+	size_t i = 0;
+	uint32_t cp;
+	size_t n;
+	
+#if defined(WOW_SIMD_AVX2)
+	/* the vector pass stops short of errors, the rest pins them down */
+	if (len >= 64)
+		i = private_utf8_valid_avx2(u, len);
+#endif
+	
+	while (i < len)
+	{
+		if (u[i] < 0x80)
+		{
+			n = private_ascii_run(u + i, len - i);
+			i += n;
+			continue;
+		}
+		
+		/* valid multi-byte sequences are never decoded from 1 byte */
+		if ((n = private_utf8_decode(u + i, len - i, &cp)) == 1)
+			break;
+		i += n;
+	}
+	
+	return i;
+}
+
+WOW_API_PREFIX
+size_t
+wow_utf8_ascii_run(const char *s, size_t len)
+{
+	return private_ascii_run((const unsigned char*)s, len);
+}
+
+WOW_API_PREFIX
+uint32_t
+wow_utf8_next(const char **s, const char *end)
+{
+	const unsigned char *u = (const unsigned char*)*s;
+	uint32_t cp;
+	
+	if (*u < 0x80)
+	{
+		*s += 1;
+		return *u;
+	}
+	
+	*s += private_utf8_decode(u, end - *s, &cp);
+	
+	return cp;
+}
+
+
+WOW_API_PREFIX
+void *
+wow_utf8_to_wchar(const char *str)
+{
+	if (!str)
+		return 0;
+#if defined(_WIN32) && defined(_UNICODE)
+	size_t length = strlen(str);
+	wchar_t *out;
+	
+	/* never more units than bytes, so convert once into the worst case */
+	out = (malloc)((length + 1) * sizeof(*out));
+	if (out)
+		out[wow_utf8_to_utf16((uint16_t*)out, length, str, length)] = L'\0';
+	return out;
+#else
+    return strdup(str);
+#endif
+}
+
+
+WOW_API_PREFIX
+void *
+wow_utf8_to_wchar_die(const char *str)
+{
+	void *result = wow_utf8_to_wchar(str);
+	
+	if (!result)
+		wow_die("memory error");
+	
+	return result;
+}
+
+WOW_API_PREFIX
+char *
+wow_wchar_to_utf8_buf(void *wstr, void *dst, int dst_max)
+{
+#if defined(_WIN32) && defined(_UNICODE)
+    size_t length;
+    
+    if (dst_max <= 0)
+        return 0;
+    length = wow_utf16_to_utf8(dst, dst_max - 1, wstr, wcslen(wstr));
+    if (length >= (size_t)dst_max) /* doesn't fit */
+        return 0;
+    ((char*)dst)[length] = '\0';
+    return dst;
+#else
+    (void)dst_max; /* unused parameter */
+    return strcpy(dst, wstr);
+#endif
+}
+
+WOW_API_PREFIX
+char *
+wow_wchar_to_utf8(void *wstr)
+{
+	if (!wstr)
+		return 0;
+#if defined(_WIN32) && defined(_UNICODE)
+	size_t length = wcslen(wstr);
+	char *out;
+	
+	/* at most 3 bytes per unit (a pair of units makes 4 bytes) */
+	out = (malloc)(length * 3 + 1);
+	if (out)
+		out[wow_utf16_to_utf8(out, length * 3, wstr, length)] = '\0';
+	return out;
+#else
+    return strdup(wstr);
+#endif
+}
+
+WOW_API_PREFIX
+char *
+wow_wchar_to_utf8_die(void *wstr)
+{
+	char *result = wow_wchar_to_utf8(wstr);
+	
+	if (!result)
+		wow_die("memory error");
+	
+	return result;
+}
+
+WOW_API_PREFIX
+char *
+wow_wchar_to_utf8_inplace(void *wstr)
+{
+#if defined(_WIN32) && defined(_UNICODE)
     char buf[4096];
     char *str;
-    int wstr_len = wcslen(wstr);
-    unsigned str_sz = (wstr_len + 1) * sizeof(*str);
-    if (str_sz >= sizeof(buf))
+    size_t wstr_len = wcslen(wstr);
+    size_t str_sz = wstr_len * 3 + 1;
+    size_t room = (wstr_len + 1) * sizeof(wchar_t) - 1; /* bytes wstr can hold */
+    size_t length;
+    if (str_sz > sizeof(buf))
         str = wow_malloc_die(str_sz);
     else
         str = buf;
-    WideCharToMultiByte(CP_UTF8, 0, wstr, -1, str, str_sz, 0, 0);
-    memcpy(wstr, str, wstr_len + 1);
-    ((char*)wstr)[wstr_len+1] = '\0';
+    length = wow_utf16_to_utf8(str, str_sz - 1, wstr, wstr_len);
+    if (length > room)
+        length = room;
+    memcpy(wstr, str, length);
+    ((char*)wstr)[length] = '\0';
     if (str != buf)
-        free(str);
+        wow_free(str);
+    return wstr;
+#else
     return wstr;
+#endif
+}
+
+
+/* argument abstraction: converts argv[] from wchar to char win32 */
+WOW_API_PREFIX
+void *
+wow_conv_args(int argc, void *argv[])
+{
+#if defined(_WIN32) && defined(_UNICODE)
+	int i;
+	for (i = 0; i < argc; ++i)
+	{
+		//fprintf(stderr, "[%d]: %s\n", i, argv[i]);
+		//fwprintf(stderr, L"[%d]: %s\n", i, (wchar_t*)argv[i]);
+		argv[i] = wow_wchar_to_utf8_inplace(argv[i]);
+		//fwprintf(stderr, L"[%d]: %s\n", i, wow_utf8_to_wchar_die(argv[i]));
+	}
+#else
+	(void)argc; /* unused parameter */
+#endif
+	return argv;
+}
+
+/* returns non-zero if path is a directory */
+static
+int
+private_is_dir_root(void const *path)
+{
+	struct stat s;
+#if defined(_WIN32) && defined(_UNICODE)
+	if (wstat(path, &s) == 0)
+#else
+	if (stat(path, &s) == 0)
+#endif
+	{
+		if (s.st_mode & S_IFDIR)
+			return 1;
+	}
+	
+	return 0;
+}
+
+
+/* returns non-zero if path is a directory */
+WOW_API_PREFIX
+int
+wow_is_dir(char const *path)
+{
+	int rv;
+	
+#if defined(_WIN32) && defined(_UNICODE)
+	struct wow_utf16_buf wpath;
+	rv = 0;
+	if (wow_utf16_buf_init(&wpath, path))
+		rv = private_is_dir_root(wpath.str);
+	wow_utf16_buf_free(&wpath);
+#else
+	rv = private_is_dir_root(path);
+#endif
+	
+	return rv;
+}
+
+
+/* fread abstraction that falls back to buffer-based fread *
+ * if a big fread fails; if that still fails, returns 0    */
+WOW_API_PREFIX
+size_t
+wow_fread_bytes(void *ptr, size_t bytes, FILE *stream)
+{
+	wow_trace_scope("wow_fread_bytes");
+	
+	if (!stream || !ptr || !bytes)
+		return 0;
+	
+	unsigned char *ptr8 = ptr;
+	size_t Oofs;
+	size_t bufsz = 1024 * 1024; /* 1 mb at a time */
+	size_t Obytes = bytes;
+	size_t rem;
+	size_t got;
+	
+	/* everything worked (a short read without an error *
+	 * means the end of the file was reached, which is ok */
+	got = (fread)(ptr, 1, bytes, stream);
+	if (got == bytes || !ferror(stream))
+		return Obytes;
+	
+	/* failed: try falling back to slower buffered read; *
+	 * only now is it worth seeking to find the file size */
+	clearerr(stream);
+	Oofs = ftell(stream) - got;
+	fseek(stream, 0, SEEK_END);
+	rem = ftell(stream) - Oofs;
+	fseek(stream, Oofs, SEEK_SET);
+	
+	if (bytes > rem)
+		bytes = rem;
+	
+	while (bytes)
+	{
+		/* don't read past end */
+		if (bytes < bufsz)
+			bufsz = bytes;
+		if (bufsz > rem)
+		{
+			bytes = rem;
+			bufsz = rem;
+		}
+		
+		/* still failed */
+		if ((fread)(ptr8, 1, bufsz, stream) != bufsz)
+			return 0;
+		
+		/* advance */
+		ptr8 += bufsz;
+		bytes -= bufsz;
+		rem -= bufsz;
+	}
+	
+	/* success */
+	return Obytes;
+}
+
+
+/* number of online processors, at least 1 */
+static
+int
+private_cpu_count(void)
+{
+#if defined(_WIN32)
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return si.dwNumberOfProcessors ? si.dwNumberOfProcessors : 1;
+#elif defined(_SC_NPROCESSORS_ONLN)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0) ? n : 1;
+#else
+	return 1;
+#endif
+}
+
+#if defined(WOW_USE_PTHREAD) && !defined(_WIN32)
+/* shared state for wow_fread_bytes_parallel */
+struct private_pread_job
+{
+	unsigned char *dst;
+	int fd;
+	uint64_t ofs;     /* file offset of dst[0] */
+	size_t bytes;
+	size_t chunk;
+	size_t next;      /* next chunk to claim */
+	int failed;
+};
+
+static
+void *
+private_pread_worker(void *udata)
+{
+	struct private_pread_job *job = udata;
+	size_t nchunks = (job->bytes + job->chunk - 1) / job->chunk;
+	size_t i;
+	
+	while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < nchunks)
+	{
+		size_t at = i * job->chunk;
+		size_t n = job->bytes - at;
+		long long got;
+		
+		if (n > job->chunk)
+			n = job->chunk;
+		
+		while (n)
+		{
+			got = pread(job->fd, job->dst + at, n, job->ofs + at);
+			if (got < 0 && errno == EINTR)
+				continue;
+			
+			/* error, or the file got shorter */
+			if (got <= 0)
+			{
+				__atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+				return 0;
+			}
+			at += got;
+			n -= got;
+		}
+		
+		if (__atomic_load_n(&job->failed, __ATOMIC_RELAXED))
+			break;
+	}
+	
+	return 0;
+}
+#endif /* WOW_USE_PTHREAD */
+
+
+/* wow_fread_bytes, but a big read is split into chunks that *
+ * several threads fill at once with pread; threads 0 uses one *
+ * per processor, chunk 0 uses 8 mb; falls back to a plain     *
+ * wow_fread_bytes without WOW_USE_PTHREAD or for non-files    */
+WOW_API_PREFIX
+size_t
+wow_fread_bytes_parallel(
+	void *ptr
+	, size_t bytes
+	, FILE *stream
+	, int threads
+	, size_t chunk
+)
+{
+	wow_trace_scope("wow_fread_bytes_parallel");
+#if defined(WOW_USE_PTHREAD) && !defined(_WIN32)
+	struct private_pread_job job;
+	pthread_t tid[64];
+	struct stat s;
+	size_t Obytes = bytes;
+	long Oofs;
+	int started = 0;
+	
+	if (!stream || !ptr || !bytes)
+		return 0;
+	
+	if (!chunk)
+		chunk = 8 * 1024 * 1024;
+	if (threads <= 0)
+		threads = private_cpu_count();
+	if (threads > 64)
+		threads = 64;
+	
+	/* not worth splitting, or not something pread works on */
+	if (threads == 1
+		|| bytes <= chunk
+		|| fstat(fileno(stream), &s)
+		|| !S_ISREG(s.st_mode)
+		|| (Oofs = ftell(stream)) < 0
+	)
+		return wow_fread_bytes(ptr, bytes, stream);
+	
+	/* like wow_fread_bytes, reading past the end is not an error */
+	if ((uint64_t)Oofs >= (uint64_t)s.st_size)
+		return Obytes;
+	if (bytes > (uint64_t)s.st_size - Oofs)
+		bytes = s.st_size - Oofs;
+	
+	/* fseek flushes pending writes and drops stdio's read buffer */
+	fseek(stream, Oofs, SEEK_SET);
+	
+	memset(&job, 0, sizeof(job));
+	job.dst = ptr;
+	job.fd = fileno(stream);
+	job.ofs = Oofs;
+	job.bytes = bytes;
+	job.chunk = chunk;
+	if ((size_t)threads > (bytes + chunk - 1) / chunk)
+		threads = (bytes + chunk - 1) / chunk;
+	
+	/* the calling thread does its share too */
+	while (started < threads - 1
+		&& !pthread_create(&tid[started], 0, private_pread_worker, &job)
+	)
+		started += 1;
+	private_pread_worker(&job);
+	while (started)
+		pthread_join(tid[--started], 0);
+	
+	/* failed: try falling back to the single-threaded path */
+	if (job.failed)
+	{
+		fseek(stream, Oofs, SEEK_SET);
+		return wow_fread_bytes(ptr, Obytes, stream);
+	}
+	
+	/* leave the stream where fread would have */
+	fseek(stream, Oofs + bytes, SEEK_SET);
+	
+	return Obytes;
+#else
+	(void)threads; /* unused parameter */
+	(void)chunk; /* unused parameter */
+	return wow_fread_bytes(ptr, bytes, stream);
+#endif
+}
+
+
+/* fwrite abstraction that falls back to buffer-based fwrite *
+ * if a big fwrite fails; if that still fails, returns 0     */
+WOW_API_PREFIX
+size_t
+wow_fwrite_bytes(const void *ptr, size_t bytes, FILE *stream)
+{
+	wow_trace_scope("wow_fwrite_bytes");
+	
+	if (!stream || !ptr || !bytes)
+		return 0;
+	
+	const unsigned char *ptr8 = ptr;
+	size_t bufsz = 1024 * 1024; /* 1 mb at a time */
+	size_t Obytes = bytes;
+	
+	size_t done;
+	
+	/* everything worked */
+	if ((done = (fwrite)(ptr, 1, bytes, stream)) == bytes)
+		return bytes;
+	
+	/* failed: try falling back to slower buffered write, *
+	 * picking up after the last byte that was written    */
+	clearerr(stream);
+	ptr8 += done;
+	bytes -= done;
+	while (bytes)
+	{
+		/* don't read past end */
+		if (bytes < bufsz)
+			bufsz = bytes;
+		
+		/* still failed */
+		if ((fwrite)(ptr8, 1, bufsz, stream) != bufsz)
+			return 0;
+		
+		/* advance */
+		ptr8 += bufsz;
+		bytes -= bufsz;
+	}
+	
+	/* success */
+	return Obytes;
+}
+
+
+/* fread abstraction that falls back to buffer-based fread *
+ * if a big fread fails; if that still fails, returns 0    */
+WOW_API_PREFIX
+size_t
+wow_fread(void *ptr, size_t size, size_t nmemb, FILE *stream)
+{
+	if (!stream || !ptr || !size || !nmemb)
+		return 0;
+	
+	if (wow_fread_bytes(ptr, size * nmemb, stream) == size * nmemb)
+		return nmemb;
+	
+	return 0;
+}
+
+
+/* fwrite abstraction that falls back to buffer-based fwrite *
+ * if a big fwrite fails; if that still fails, returns 0     */
+WOW_API_PREFIX
+size_t
+wow_fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream)
+{
+	if (!stream || !ptr || !size || !nmemb)
+		return 0;
+	
+	if (wow_fwrite_bytes(ptr, size * nmemb, stream) == size * nmemb)
+		return nmemb;
+	
+	return 0;
+}
+
+
+/* fopen abstraction for utf8 support on windows win32 */
+WOW_API_PREFIX
+FILE *
+wow_fopen(char const *name, char const *mode)
+{
+#if defined(_WIN32) && defined(_UNICODE)
+	struct wow_utf16_buf wname;
+	struct wow_utf16_buf wmode;
+	FILE *fp = 0;
+	
+	wow_utf16_buf_init(&wname, name);
+	wow_utf16_buf_init(&wmode, mode);
+	if (!wname.str || !wmode.str)
+		goto L_cleanup;
+	
+	/* TODO eventually, an error message would be cool */
+	if (private_is_dir_root(wname.str))
+		goto L_cleanup;
+	
+	fp = _wfopen((wchar_t*)wname.str, (wchar_t*)wmode.str);
+	
+L_cleanup:
+	wow_utf16_buf_free(&wname);
+	wow_utf16_buf_free(&wmode);
+	if (fp)
+		return fp;
+	return 0;
+#else
+	struct stat s;
+	FILE *fp;
+	int err;
+	
+	/* opening first and checking the descriptor avoids a second *
+	 * path lookup, and the race between the two                 */
+	if (!(fp = (fopen)(name, mode)))
+		return 0;
+	
+	/* TODO eventually, an error message would be cool */
+	if (fstat(fileno(fp), &s))
+	{
+		err = errno;
+		fclose(fp);
+		errno = err;
+		return 0;
+	}
+	if (S_ISDIR(s.st_mode))
+	{
+		fclose(fp);
+		errno = EISDIR;
+		return 0;
+	}
+	return fp;
+#endif
+}
+
+
+/* fopen-style mode -> open() flags, or -1 */
+static
+int
+private_file_flags(char const *mode)
+{
+	int plus = strchr(mode, '+') != 0;
+	int flags;
+	
+	switch (*mode)
+	{
+		case 'r': flags = plus ? O_RDWR : O_RDONLY; break;
+		case 'w': flags = (plus ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC; break;
+		case 'a': flags = (plus ? O_RDWR : O_WRONLY) | O_CREAT | O_APPEND; break;
+		default: return -1;
+	}
+	if (strchr(mode, 'x'))
+		flags |= O_EXCL;
+#if defined(_WIN32)
+	flags |= O_BINARY | O_NOINHERIT;
+#else
+	flags |= O_CLOEXEC;
+#endif
+	
+	return flags;
+}
+
+
+/* fills in a wow_file's type, size and mtime from a stat result */
+static
+void
+private_file_stat(
+	struct wow_file *file
+#if defined(_WIN32)
+	, const struct _stati64 *s
+#else
+	, const struct stat *s
+#endif
+)
+{
+	if (S_ISREG(s->st_mode))
+	{
+		file->type = WOW_FILE_REGULAR;
+		file->size = s->st_size;
+	}
+	else if (S_ISDIR(s->st_mode))
+		file->type = WOW_FILE_DIR;
+	else
+		file->type = WOW_FILE_OTHER;
+	
+	file->mtime_ns = (int64_t)s->st_mtime * 1000000000;
+#if defined(__linux__)
+	file->mtime_ns += s->st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+	file->mtime_ns += s->st_mtimespec.tv_nsec;
+#endif
+}
+
+
+WOW_API_PREFIX
+int
+wow_file_open(struct wow_file *file, char const *path, char const *mode)
+{
+#if defined(_WIN32)
+	struct _stati64 s;
+#else
+	struct stat s;
+#endif
+	int flags;
+	
+	memset(file, 0, sizeof(*file));
+	file->fd = -1;
+	
+	if (!path || !mode || (flags = private_file_flags(mode)) < 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	
+	if ((file->fd = wow_open(path, flags, 0666)) < 0)
+		return -1;
+	file->flags = flags;
+	
+#if defined(_WIN32)
+	if (_fstati64(file->fd, &s))
+#else
+	if (fstat(file->fd, &s))
+#endif
+	{
+		close(file->fd);
+		file->fd = -1;
+		return -1;
+	}
+	
+	private_file_stat(file, &s);
+	
+	return 0;
+}
+
+
+WOW_API_PREFIX
+FILE *
+wow_file_stream(struct wow_file *file)
+{
+	const char *mode;
+	int access = file->flags & (O_WRONLY | O_RDWR);
+	
+	if (file->fp || file->fd < 0 || file->type == WOW_FILE_DIR)
+		return file->fp;
+	
+	/* a mode matching how the descriptor was opened */
+	if (access == O_WRONLY)
+		mode = (file->flags & O_APPEND) ? "ab" : "wb";
+	else if (access == O_RDWR)
+		mode = (file->flags & O_APPEND) ? "a+b" : "r+b";
+	else
+		mode = "rb";
+	
+#if defined(_WIN32)
+	file->fp = _fdopen(file->fd, mode);
+#else
+	file->fp = fdopen(file->fd, mode);
+#endif
+	
+	return file->fp;
+}
+
+
+WOW_API_PREFIX
+int
+wow_file_close(struct wow_file *file)
+{
+	int rval = 0;
+	
+	if (file->fp)
+		rval = fclose(file->fp);
+	else if (file->fd >= 0)
+		rval = close(file->fd);
+	
+	file->fp = 0;
+	file->fd = -1;
+	
+	return rval;
+}
+
+
+WOW_API_PREFIX
+int
+wow_file_stat(struct wow_file *file, char const *path)
+{
+#if defined(_WIN32)
+	struct _stati64 s;
+#else
+	struct stat s;
+#endif
+	int rval;
+	
+	memset(file, 0, sizeof(*file));
+	file->fd = -1;
+	
+	if (!path)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	
+#if defined(_WIN32) && defined(_UNICODE)
+	{
+		struct wow_utf16_buf wpath;
+		
+		if (!wow_utf16_buf_init(&wpath, path))
+			return -1;
+		rval = _wstati64((wchar_t*)wpath.str, &s);
+		wow_utf16_buf_free(&wpath);
+	}
+#elif defined(_WIN32)
+	rval = _stati64(path, &s);
+#else
+	rval = stat(path, &s);
+#endif
+	if (rval)
+		return -1;
+	
+	private_file_stat(file, &s);
+	
+	return 0;
+}
+
+
+#if defined(_WIN32)
+/* wow_file_map fallback: read the whole file into a buffer */
+static
+int
+private_file_map_read(struct wow_map *map, char const *path)
+{
+	struct wow_file file;
+	FILE *fp;
+	unsigned char *buf = 0;
+	size_t cap = 0;
+	size_t len = 0;
+	size_t got;
+	
+	if (wow_file_open(&file, path, "rb"))
+		return -1;
+	
+	/* wow_fopen refuses directories, so this does too */
+	if (!(fp = wow_file_stream(&file)))
+	{
+		wow_file_close(&file);
+		return -1;
+	}
+	
+	/* regular file: size is known up front */
+	if (file.type == WOW_FILE_REGULAR && file.size > 0 && file.size <= SIZE_MAX)
+	{
+		buf = wow_malloc_die(file.size);
+		if (wow_fread_bytes(buf, file.size, fp) != file.size)
+			goto L_fail;
+		len = file.size;
+	}
+	
+	/* pipes and the like: read until there is nothing left */
+	else
+	{
+		do
+		{
+			if (len == cap)
+			{
+				cap = cap ? cap * 2 : 64 * 1024;
+				buf = wow_realloc_die(buf, cap);
+			}
+			got = (fread)(buf + len, 1, cap - len, fp);
+			len += got;
+		} while (got);
+		
+		if (ferror(fp))
+			goto L_fail;
+		
+		/* nothing was read */
+		if (!len)
+		{
+			wow_free(buf);
+			buf = 0;
+		}
+	}
+	
+	wow_file_close(&file);
+	map->data = buf;
+	map->size = len;
+	map->is_mapped = 0;
+	return 0;
+	
+L_fail:
+	if (buf)
+		wow_free(buf);
+	wow_file_close(&file);
+	return -1;
+}
+#else /* ! _WIN32 */
+/* wow_file_map fallback: read the whole file into a buffer through *
+ * the descriptor already open, since opening a pipe or device a    *
+ * second time could block or miss what the first open let through  */
+static
+int
+private_file_map_read(struct wow_map *map, int fd, const struct stat *s)
+{
+	unsigned char *buf = 0;
+	size_t cap = 0;
+	size_t len = 0;
+	
+	/* regular file: size is known up front */
+	if (S_ISREG(s->st_mode) && s->st_size > 0 && (uintmax_t)s->st_size <= SIZE_MAX)
+		cap = s->st_size;
+	if (cap)
+		buf = wow_malloc_die(cap);
+	
+	for (;;)
+	{
+		long long got;
+		
+		if (len == cap)
+		{
+			/* all of a regular file is in */
+			if (S_ISREG(s->st_mode) && cap)
+				break;
+			cap = cap ? cap * 2 : 64 * 1024;
+			buf = wow_realloc_die(buf, cap);
+		}
+		got = read(fd, buf + len, cap - len);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got < 0)
+		{
+			wow_free(buf);
+			return -1;
+		}
+		if (!got)
+			break;
+		len += got;
+	}
+	
+	/* nothing was read */
+	if (!len)
+	{
+		wow_free(buf);
+		buf = 0;
+	}
+	
+	map->data = buf;
+	map->size = len;
+	map->is_mapped = 0;
+	return 0;
+}
+#endif /* _WIN32 */
+
+
+/* maps a file into memory without copying it; falls back to *
+ * reading it into a buffer if it can't be mapped (pipes and *
+ * other special files); returns non-zero on failure         */
+WOW_API_PREFIX
+int
+wow_file_map(struct wow_map *map, char const *path, enum wow_map_mode mode)
+{
+	if (!map || !path)
+		return -1;
+	
+	memset(map, 0, sizeof(*map));
+	
+#if defined(_WIN32)
+	HANDLE fh;
+	HANDLE mh;
+	LARGE_INTEGER sz;
+	
+	#if defined(_UNICODE)
+	struct wow_utf16_buf wpath;
+	fh = CreateFileW((wchar_t*)wow_utf16_buf_init(&wpath, path)
+		, GENERIC_READ, FILE_SHARE_READ, 0
+		, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0
+	);
+	wow_utf16_buf_free(&wpath);
+	#else
+	fh = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0
+		, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0
+	);
+	#endif
+	if (fh == INVALID_HANDLE_VALUE)
+		return -1;
+	
+	if (GetFileType(fh) == FILE_TYPE_DISK
+		&& GetFileSizeEx(fh, &sz)
+		&& sz.QuadPart > 0
+		&& (unsigned long long)sz.QuadPart <= SIZE_MAX
+	)
+	{
+		mh = CreateFileMapping(fh, 0
+			, (mode == WOW_MAP_COPY) ? PAGE_WRITECOPY : PAGE_READONLY
+			, 0, 0, 0
+		);
+		if (mh)
+		{
+			/* the view keeps the mapping object alive */
+			map->data = MapViewOfFile(mh
+				, (mode == WOW_MAP_COPY) ? FILE_MAP_COPY : FILE_MAP_READ
+				, 0, 0, 0
+			);
+			CloseHandle(mh);
+		}
+		if (map->data)
+		{
+			map->size = sz.QuadPart;
+			map->is_mapped = 1;
+			CloseHandle(fh);
+			return 0;
+		}
+	}
+	CloseHandle(fh);
+	
+	/* failed: fall back to reading the file */
+	return private_file_map_read(map, path);
+#else /* ! _WIN32 */
+	struct stat s;
+	void *data;
+	int fd;
+	int rval;
+	
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+	
+	if (fstat(fd, &s))
+	{
+		close(fd);
+		return -1;
+	}
+	
+	/* wow_fopen refuses directories, so this does too */
+	if (S_ISDIR(s.st_mode))
+	{
+		close(fd);
+		return -1;
+	}
+	
+	if (S_ISREG(s.st_mode)
+		&& s.st_size > 0
+		&& (uintmax_t)s.st_size <= SIZE_MAX
+	)
+	{
+		data = mmap(0, s.st_size
+			, PROT_READ | ((mode == WOW_MAP_COPY) ? PROT_WRITE : 0)
+			, MAP_PRIVATE, fd, 0
+		);
+		if (data != MAP_FAILED)
+		{
+			close(fd);
+			map->data = data;
+			map->size = s.st_size;
+			map->is_mapped = 1;
+			return 0;
+		}
+	}
+	
+	/* failed: fall back to reading the file */
+	rval = private_file_map_read(map, fd, &s);
+	close(fd);
+	return rval;
+#endif
+}
+
+
+/* releases a mapping created by wow_file_map */
+WOW_API_PREFIX
+void
+wow_file_unmap(struct wow_map *map)
+{
+	if (!map)
+		return;
+	
+	if (map->data)
+	{
+		if (!map->is_mapped)
+			wow_free(map->data);
+#if defined(_WIN32)
+		else
+			UnmapViewOfFile(map->data);
+#else
+		else
+			munmap(map->data, map->size);
+#endif
+	}
+	
+	memset(map, 0, sizeof(*map));
+}
+
+
+/* wow_filecache internals; an entry and its contents are one *
+ * allocation, so a buffer finds its way back to its entry    */
+struct private_filecache_entry
+{
+	struct private_filecache_entry *hash_next;
+	struct private_filecache_entry *lru_prev; /* more recently used */
+	struct private_filecache_entry *lru_next; /* less recently used */
+	struct wow_filecache *cache; /* 0 once dropped from the cache */
+	const char *path;            /* stored after the contents */
+	uint32_t hash;
+	uint64_t size;
+	int64_t mtime_ns;
+	size_t refs; /* holders, plus one while it's in the cache */
+};
+
+#define WOW_FILECACHE_HEAD \
+	((sizeof(struct private_filecache_entry) + 15) & ~(size_t)15)
+
+struct wow_filecache
+{
+	struct private_filecache_entry **buckets;
+	size_t bucket_count; /* power of two */
+	size_t count;
+	struct private_filecache_entry *lru_head;
+	struct private_filecache_entry *lru_tail;
+	size_t budget;
+	size_t used;
+	int lock;
+};
+
+static
+uint32_t
+private_filecache_hash(const char *path)
+{
+	uint32_t hash = 2166136261u;
+	
+	while (*path)
+		hash = (hash ^ (unsigned char)*path++) * 16777619u;
+	
+	return hash;
+}
+
+static
+struct private_filecache_entry *
+private_filecache_find(struct wow_filecache *cache, const char *path, uint32_t hash)
+{
+	struct private_filecache_entry *entry;
+	
+	entry = cache->buckets[hash & (cache->bucket_count - 1)];
+	for ( ; entry; entry = entry->hash_next)
+		if (entry->hash == hash && !strcmp(entry->path, path))
+			return entry;
+	
+	return 0;
+}
+
+static
+void
+private_filecache_lru_unlink(struct wow_filecache *cache, struct private_filecache_entry *entry)
+{
+	if (entry->lru_prev)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		cache->lru_head = entry->lru_next;
+	if (entry->lru_next)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		cache->lru_tail = entry->lru_prev;
+	entry->lru_prev = entry->lru_next = 0;
+}
+
+static
+void
+private_filecache_lru_push(struct wow_filecache *cache, struct private_filecache_entry *entry)
+{
+	entry->lru_prev = 0;
+	entry->lru_next = cache->lru_head;
+	if (cache->lru_head)
+		cache->lru_head->lru_prev = entry;
+	else
+		cache->lru_tail = entry;
+	cache->lru_head = entry;
+}
+
+/* takes an entry out of the cache, along with the cache's own  *
+ * reference; if nobody else holds it, it goes on the 'dead'    *
+ * list, to be freed once the lock is released                  */
+static
+void
+private_filecache_drop(
+	struct wow_filecache *cache
+	, struct private_filecache_entry *entry
+	, struct private_filecache_entry **dead
+)
+{
+	struct private_filecache_entry **link;
+	
+	link = &cache->buckets[entry->hash & (cache->bucket_count - 1)];
+	while (*link != entry)
+		link = &(*link)->hash_next;
+	*link = entry->hash_next;
+	
+	private_filecache_lru_unlink(cache, entry);
+	cache->count -= 1;
+	cache->used -= entry->size;
+	
+	/* holders free it on their last release from now on */
+	__atomic_store_n(&entry->cache, 0, __ATOMIC_RELEASE);
+	if (!__atomic_sub_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL))
+	{
+		entry->hash_next = *dead;
+		*dead = entry;
+	}
+}
+
+/* drops unheld entries, oldest first, until used fits the budget */
+static
+void
+private_filecache_trim(struct wow_filecache *cache, struct private_filecache_entry **dead)
+{
+	struct private_filecache_entry *entry = cache->lru_tail;
+	
+	while (entry && cache->used > cache->budget)
+	{
+		struct private_filecache_entry *prev = entry->lru_prev;
+		
+		if (__atomic_load_n(&entry->refs, __ATOMIC_ACQUIRE) == 1)
+			private_filecache_drop(cache, entry, dead);
+		entry = prev;
+	}
+}
+
+static
+void
+private_filecache_free_dead(struct private_filecache_entry *dead)
+{
+	while (dead)
+	{
+		struct private_filecache_entry *next = dead->hash_next;
+		
+		free(dead);
+		dead = next;
+	}
+}
+
+/* doubles the bucket count; quietly stays put if that fails */
+static
+void
+private_filecache_grow(struct wow_filecache *cache)
+{
+	size_t count = cache->bucket_count * 2;
+	struct private_filecache_entry **buckets = calloc(count, sizeof(*buckets));
+	size_t i;
+	
+	if (!buckets)
+		return;
+	
+	for (i = 0; i < cache->bucket_count; ++i)
+	{
+		struct private_filecache_entry *entry = cache->buckets[i];
+		
+		while (entry)
+		{
+			struct private_filecache_entry *next = entry->hash_next;
+			struct private_filecache_entry **link = &buckets[entry->hash & (count - 1)];
+			
+			entry->hash_next = *link;
+			*link = entry;
+			entry = next;
+		}
+	}
+	
+	free(cache->buckets);
+	cache->buckets = buckets;
+	cache->bucket_count = count;
+}
+
+/* reads path into a new entry; 0 on failure */
+static
+struct private_filecache_entry *
+private_filecache_read(char const *path, uint32_t hash)
+{
+	struct private_filecache_entry *entry;
+	struct wow_file file;
+	size_t path_len = strlen(path) + 1;
+	unsigned char *data;
+	size_t got = 0;
+	FILE *fp;
+	
+	if (wow_file_open(&file, path, "rb"))
+		return 0;
+	
+	if (file.type != WOW_FILE_REGULAR
+		|| file.size > SIZE_MAX - WOW_FILECACHE_HEAD - path_len
+	)
+	{
+		wow_file_close(&file);
+		errno = (file.type != WOW_FILE_REGULAR) ? EINVAL : ENOMEM;
+		return 0;
+	}
+	
+	/* plain malloc: the entry outlives any arena scope */
+	if (!(entry = malloc(WOW_FILECACHE_HEAD + file.size + path_len)))
+	{
+		wow_file_close(&file);
+		errno = ENOMEM;
+		return 0;
+	}
+	data = (unsigned char*)entry + WOW_FILECACHE_HEAD;
+	
+	/* counted by hand: wow_fread_bytes reports the size asked for *
+	 * even when it comes up short, and a file that shrank since   *
+	 * the stat would leave the end of data unset                  */
+	fp = file.size ? wow_file_stream(&file) : 0;
+	while (fp && got < file.size)
+	{
+		size_t n = fread(data + got, 1, file.size - got, fp);
+		
+		if (!n)
+			break;
+		got += n;
+	}
+	if (got < file.size)
+	{
+		wow_file_close(&file);
+		free(entry);
+		errno = EIO;
+		return 0;
+	}
+	wow_file_close(&file);
+	
+	memset(entry, 0, sizeof(*entry));
+	memcpy(data + file.size, path, path_len);
+	entry->path = (const char*)data + file.size;
+	entry->hash = hash;
+	entry->size = file.size;
+	entry->mtime_ns = file.mtime_ns;
+	entry->refs = 2; /* the caller's, and the cache's */
+	
+	return entry;
+}
+
+WOW_API_PREFIX
+struct wow_filecache *
+wow_filecache_new(size_t budget)
+{
+	struct wow_filecache *cache = calloc(1, sizeof(*cache));
+	
+	if (!cache)
+		return 0;
+	
+	/* plain calloc, like the entries: the cache outlives arena scopes */
+	cache->bucket_count = 64;
+	if (!(cache->buckets = calloc(cache->bucket_count, sizeof(*cache->buckets))))
+	{
+		free(cache);
+		return 0;
+	}
+	cache->budget = budget;
+	
+	return cache;
+}
+
+WOW_API_PREFIX
+void
+wow_filecache_free(struct wow_filecache *cache)
+{
+	struct private_filecache_entry *dead = 0;
+	
+	if (!cache)
+		return;
+	
+	private_spin_lock(&cache->lock);
+	while (cache->lru_head)
+		private_filecache_drop(cache, cache->lru_head, &dead);
+	private_spin_unlock(&cache->lock);
+	
+	private_filecache_free_dead(dead);
+	free(cache->buckets);
+	free(cache);
+}
+
+WOW_API_PREFIX
+const void *
+wow_filecache_load(struct wow_filecache *cache, char const *path, size_t *size)
+{
+	struct private_filecache_entry *dead = 0;
+	struct private_filecache_entry *entry;
+	struct wow_file file;
+	uint32_t hash;
+	
+	if (!cache || !path || !size)
+	{
+		errno = EINVAL;
+		return 0;
+	}
+	hash = private_filecache_hash(path);
+	
+	/* the one syscall a cached, unchanged file costs */
+	if (wow_file_stat(&file, path))
+		return 0;
+	
+	private_spin_lock(&cache->lock);
+	entry = private_filecache_find(cache, path, hash);
+	if (entry && entry->size == file.size && entry->mtime_ns == file.mtime_ns)
+	{
+		__atomic_add_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL);
+		private_filecache_lru_unlink(cache, entry);
+		private_filecache_lru_push(cache, entry);
+		private_spin_unlock(&cache->lock);
+		
+		*size = entry->size;
+		return (unsigned char*)entry + WOW_FILECACHE_HEAD;
+	}
+	private_spin_unlock(&cache->lock);
+	
+	if (file.type != WOW_FILE_REGULAR)
+	{
+		errno = EINVAL;
+		return 0;
+	}
+	
+	/* new or changed: read it outside the lock, keyed by the size *
+	 * and mtime of what was actually read                         */
+	if (!(entry = private_filecache_read(path, hash)))
+		return 0;
+	
+	private_spin_lock(&cache->lock);
+	{
+		struct private_filecache_entry *old;
+		
+		if ((old = private_filecache_find(cache, path, hash)))
+			private_filecache_drop(cache, old, &dead);
+	}
+	if (cache->count >= cache->bucket_count)
+		private_filecache_grow(cache);
+	entry->hash_next = cache->buckets[hash & (cache->bucket_count - 1)];
+	cache->buckets[hash & (cache->bucket_count - 1)] = entry;
+	entry->cache = cache;
+	private_filecache_lru_push(cache, entry);
+	cache->count += 1;
+	cache->used += entry->size;
+	private_filecache_trim(cache, &dead);
+	private_spin_unlock(&cache->lock);
+	
+	private_filecache_free_dead(dead);
+	
+	*size = entry->size;
+	return (unsigned char*)entry + WOW_FILECACHE_HEAD;
+}
+
+WOW_API_PREFIX
+void
+wow_filecache_release(const void *data)
+{
+	struct private_filecache_entry *entry;
+	struct private_filecache_entry *dead = 0;
+	struct wow_filecache *cache;
+	
+	if (!data)
+		return;
+	
+	entry = (void*)((unsigned char*)data - WOW_FILECACHE_HEAD);
+	
+	/* still cached: references only change under the lock */
+	if ((cache = __atomic_load_n(&entry->cache, __ATOMIC_ACQUIRE)))
+	{
+		private_spin_lock(&cache->lock);
+		if (entry->cache)
+		{
+			if (__atomic_sub_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL) == 1)
+				private_filecache_trim(cache, &dead);
+			private_spin_unlock(&cache->lock);
+			private_filecache_free_dead(dead);
+			return;
+		}
+		private_spin_unlock(&cache->lock);
+	}
+	
+	/* dropped from the cache while held: the last one out frees it */
+	if (!__atomic_sub_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL))
+		free(entry);
+}
+
+
+/* one value, however it's aligned */
+static inline
+uint16_t
+private_bswap16(uint16_t v)
+{
+	return v >> 8 | v << 8;
+}
+
+static inline
+uint32_t
+private_bswap32(uint32_t v)
+{
+#if defined(__GNUC__)
+	return __builtin_bswap32(v);
+#else
+	return v >> 24 | (v >> 8 & 0xff00) | (v << 8 & 0xff0000) | v << 24;
+#endif
+}
+
+static inline
+uint64_t
+private_bswap64(uint64_t v)
+{
+#if defined(__GNUC__)
+	return __builtin_bswap64(v);
+#else
+	return (uint64_t)private_bswap32(v) << 32 | private_bswap32(v >> 32);
+#endif
+}
+
+/* the shared kernel; size is a constant in each caller, so *
+ * the checks on it are resolved at compile time            */
+static inline
+void
+private_bswap_array(void *dst, const void *src, size_t count, const int size)
+{
+	unsigned char *d = dst;
+	const unsigned char *s = src;
+	size_t n = count * size;
+	size_t i = 0;
+	
+#if defined(WOW_SIMD_SSSE3)
+	/* byte k of each 16 comes from byte mask[k] */
+	const __m128i mask = (size == 2)
+		? _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14)
+		: (size == 4)
+		? _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12)
+		: _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8)
+	;
+#endif
+#if defined(WOW_SIMD_AVX2)
+	const __m256i mask2 = _mm256_broadcastsi128_si256(mask);
+	for (; i + 64 <= n; i += 64)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i*)(s + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(s + i + 32));
+		
+		_mm256_storeu_si256((__m256i*)(d + i), _mm256_shuffle_epi8(a, mask2));
+		_mm256_storeu_si256((__m256i*)(d + i + 32), _mm256_shuffle_epi8(b, mask2));
+	}
+#endif
+#if defined(WOW_SIMD_SSSE3)
+	for (; i + 16 <= n; i += 16)
+		_mm_storeu_si128((__m128i*)(d + i)
+			, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(s + i)), mask)
+		);
+#elif defined(WOW_SIMD_SSE2)
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+		
+		/* put the 16-bit halves in order, then swap within them */
+		if (size == 4)
+		{
+			v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+			v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+		}
+		else if (size == 8)
+		{
+			v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+			v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+		}
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i*)(d + i), v);
+	}
+#elif defined(WOW_SIMD_NEON)
+	for (; i + 16 <= n; i += 16)
+	{
+		uint8x16_t v = vld1q_u8(s + i);
+		
+		if (size == 2)
+			v = vrev16q_u8(v);
+		else if (size == 4)
+			v = vrev32q_u8(v);
+		else
+			v = vrev64q_u8(v);
+		vst1q_u8(d + i, v);
+	}
+#endif
+	
+	/* the rest, one value at a time */
+	for (; i < n; i += size)
+	{
+		if (size == 2)
+		{
+			uint16_t v;
+			memcpy(&v, s + i, 2);
+			v = private_bswap16(v);
+			memcpy(d + i, &v, 2);
+		}
+		else if (size == 4)
+		{
+			uint32_t v;
+			memcpy(&v, s + i, 4);
+			v = private_bswap32(v);
+			memcpy(d + i, &v, 4);
+		}
+		else
+		{
+			uint64_t v;
+			memcpy(&v, s + i, 8);
+			v = private_bswap64(v);
+			memcpy(d + i, &v, 8);
+		}
+	}
+}
+
+WOW_API_PREFIX
+void
+wow_bswap16_array(void *dst, const void *src, size_t count)
+{
+	if (dst && src)
+		private_bswap_array(dst, src, count, 2);
+}
+
+WOW_API_PREFIX
+void
+wow_bswap32_array(void *dst, const void *src, size_t count)
+{
+	if (dst && src)
+		private_bswap_array(dst, src, count, 4);
+}
+
+WOW_API_PREFIX
+void
+wow_bswap64_array(void *dst, const void *src, size_t count)
+{
+	if (dst && src)
+		private_bswap_array(dst, src, count, 8);
+}
+
+
+/* wow_reader internals */
+struct wow_reader
+{
+	int fd;
+	int owns_fd;       /* fd is closed by wow_reader_close */
+	int seekable;      /* regular file, so pread is used */
+	int eof;
+	int error;
+	unsigned char *buf_alloc;
+	unsigned char *buf; /* aligned within buf_alloc */
+	size_t buf_cap;
+	size_t pos;        /* next unread byte in buf */
+	size_t end;        /* one past the last valid byte in buf */
+	uint64_t size;     /* file size, or 0 if it isn't a regular file */
+	uint64_t ofs;      /* file offset of buf[end] */
+	int swap;          /* value size for wow_reader_swap, 0 = off */
+	uint64_t swap_start; /* offset the values are counted from */
+	uint64_t swap_val_ofs; /* where swap_val is from, UINT64_MAX = nowhere */
+	unsigned char swap_val[8]; /* a value a read stopped inside, swapped */
+#ifdef WOW_USE_PTHREAD
+	/* prefetching: blocks land in pf_buf[buf_cap..], leaving   *
+	 * room in front of them for leftovers of the current block */
+	int prefetch;
+	enum {
+		WOW_READER_PF_IDLE = 0
+		, WOW_READER_PF_BUSY
+		, WOW_READER_PF_READY
+		, WOW_READER_PF_QUIT
+	} pf_state;
+	pthread_t pf_thread;
+	pthread_mutex_t pf_lock;
+	pthread_cond_t pf_cond;
+	unsigned char *pf_alloc;
+	unsigned char *pf_buf;
+	uint64_t pf_ofs;
+	long long pf_got;
+#endif
+};
+
+#define WOW_READER_BUFSZ (1024 * 1024) /* 1 mb */
+#define WOW_IO_ALIGN 4096
+
+/* one read syscall at the current file offset */
+static
+size_t
+private_reader_sysread(struct wow_reader *r, void *dst, size_t bytes)
+{
+	long long got;
+	
+	if (r->eof || r->error || !bytes)
+		return 0;
+	
+	/* the size is known, so the end is known without asking */
+	if (r->seekable)
+	{
+		if (r->ofs >= r->size)
+		{
+			r->eof = 1;
+			return 0;
+		}
+		if (bytes > r->size - r->ofs)
+			bytes = r->size - r->ofs;
+	}
+	
+	do
+	{
+#if defined(_WIN32)
+		if (bytes > 0x40000000)
+			bytes = 0x40000000;
+		got = read(r->fd, dst, bytes);
+#else
+		if (r->seekable)
+			got = pread(r->fd, dst, bytes, r->ofs);
+		else
+			got = read(r->fd, dst, bytes);
+#endif
+	} while (got < 0 && errno == EINTR);
+	
+	if (got < 0)
+	{
+		r->error = 1;
+		return 0;
+	}
+	if (!got)
+		r->eof = 1;
+	
+	r->ofs += got;
+	return got;
+}
+
+/* allocates a buffer aligned to WOW_IO_ALIGN */
+static
+unsigned char *
+private_io_alloc(size_t bytes, unsigned char **alloc)
+{
+	*alloc = wow_malloc_die(bytes + WOW_IO_ALIGN - 1);
+	
+	return (void*)(((uintptr_t)*alloc + WOW_IO_ALIGN - 1)
+		& ~(uintptr_t)(WOW_IO_ALIGN - 1)
+	);
+}
+
+#ifdef WOW_USE_PTHREAD
+/* prefetch thread: reads one block each time it is asked to */
+static
+void *
+private_reader_thread(void *udata)
+{
+	struct wow_reader *r = udata;
+	unsigned char *dst;
+	uint64_t ofs;
+	size_t bytes;
+	long long got;
+	
+	pthread_mutex_lock(&r->pf_lock);
+	for (;;)
+	{
+		while (r->pf_state != WOW_READER_PF_BUSY
+			&& r->pf_state != WOW_READER_PF_QUIT
+		)
+			pthread_cond_wait(&r->pf_cond, &r->pf_lock);
+		
+		if (r->pf_state == WOW_READER_PF_QUIT)
+			break;
+		
+		dst = r->pf_buf + r->buf_cap;
+		ofs = r->pf_ofs;
+		bytes = r->buf_cap;
+		if (bytes > r->size - ofs)
+			bytes = r->size - ofs;
+		pthread_mutex_unlock(&r->pf_lock);
+		
+		do
+			got = pread(r->fd, dst, bytes, ofs);
+		while (got < 0 && errno == EINTR);
+		
+		pthread_mutex_lock(&r->pf_lock);
+		r->pf_got = got;
+		r->pf_state = WOW_READER_PF_READY;
+		pthread_cond_broadcast(&r->pf_cond);
+	}
+	pthread_mutex_unlock(&r->pf_lock);
+	
+	return 0;
+}
+
+/* waits for the prefetch thread to finish what it's doing; *
+ * call with pf_lock held                                   */
+static
+void
+private_reader_wait(struct wow_reader *r)
+{
+	while (r->pf_state == WOW_READER_PF_BUSY)
+		pthread_cond_wait(&r->pf_cond, &r->pf_lock);
+}
+
+/* asks the prefetch thread for the block at r->ofs; *
+ * call with pf_lock held                            */
+static
+void
+private_reader_request(struct wow_reader *r)
+{
+	if (r->ofs >= r->size)
+	{
+		r->pf_state = WOW_READER_PF_IDLE;
+		return;
+	}
+	r->pf_ofs = r->ofs;
+	r->pf_state = WOW_READER_PF_BUSY;
+	pthread_cond_broadcast(&r->pf_cond);
+}
+
+/* swaps in the prefetched block, keeping leftovers in front of it */
+static
+size_t
+private_reader_take(struct wow_reader *r)
+{
+	size_t have = r->end - r->pos;
+	unsigned char *tmp;
+	long long got;
+	
+	if (r->eof || r->error)
+		return 0;
+	
+	pthread_mutex_lock(&r->pf_lock);
+	private_reader_wait(r);
+	
+	if (r->pf_state != WOW_READER_PF_READY || r->pf_got <= 0)
+	{
+		if (r->pf_state == WOW_READER_PF_READY && r->pf_got < 0)
+			r->error = 1;
+		else
+			r->eof = 1;
+		r->pf_state = WOW_READER_PF_IDLE;
+		pthread_mutex_unlock(&r->pf_lock);
+		return 0;
+	}
+	got = r->pf_got;
+	
+	memcpy(r->pf_buf + r->buf_cap - have, r->buf + r->pos, have);
+	tmp = r->buf; r->buf = r->pf_buf; r->pf_buf = tmp;
+	tmp = r->buf_alloc; r->buf_alloc = r->pf_alloc; r->pf_alloc = tmp;
+	r->pos = r->buf_cap - have;
+	r->end = r->buf_cap + got;
+	r->ofs += got;
+	
+	/* get started on the next one */
+	private_reader_request(r);
+	pthread_mutex_unlock(&r->pf_lock);
+	
+	return got;
+}
+#endif /* WOW_USE_PTHREAD */
+
+/* keeps unread bytes and appends the next block; returns bytes added */
+static
+size_t
+private_reader_refill(struct wow_reader *r)
+{
+	size_t have = r->end - r->pos;
+	size_t got;
+	
+#ifdef WOW_USE_PTHREAD
+	if (r->prefetch)
+		return private_reader_take(r);
+#endif
+	
+	/* move leftovers to the front */
+	if (r->pos)
+	{
+		memmove(r->buf, r->buf + r->pos, have);
+		r->pos = 0;
+		r->end = have;
+	}
+	
+	got = private_reader_sysread(r, r->buf + r->end, r->buf_cap - r->end);
+	r->end += got;
+	
+	return got;
+}
+
+/* returns non-zero if blocks are being read ahead */
+static
+int
+private_reader_is_prefetching(struct wow_reader *r)
+{
+#ifdef WOW_USE_PTHREAD
+	return r->prefetch;
+#else
+	(void)r; /* unused parameter */
+	return 0;
+#endif
+}
+
+/* ensures at least 'bytes' bytes are buffered, if possible */
+static
+int
+private_reader_fill(struct wow_reader *r, size_t bytes)
+{
+	while (r->end - r->pos < bytes)
+		if (!private_reader_refill(r))
+			return 0;
+	
+	return 1;
+}
+
+
+/* reads from an open file descriptor, starting from its *
+ * current offset; the descriptor is not closed for you, *
+ * and directories are refused                           */
+WOW_API_PREFIX
+struct wow_reader *
+wow_reader_fdopen(int fd, size_t bufsz)
+{
+	struct wow_reader *r;
+	struct stat s;
+	
+	if (fd < 0 || fstat(fd, &s))
+		return 0;
+	
+	/* wow_fopen refuses directories, so this does too */
+	if (S_ISDIR(s.st_mode))
+	{
+		errno = EISDIR;
+		return 0;
+	}
+	
+	if (!bufsz)
+		bufsz = WOW_READER_BUFSZ;
+	
+	r = wow_calloc_die(1, sizeof(*r));
+	r->fd = fd;
+	r->buf_cap = bufsz;
+	r->buf = private_io_alloc(bufsz, &r->buf_alloc);
+	
+	/* the only seek a reader ever does */
+	if (S_ISREG(s.st_mode))
+	{
+		long long ofs = lseek(fd, 0, SEEK_CUR);
+		
+		r->seekable = 1;
+		r->size = s.st_size;
+		r->ofs = (ofs > 0) ? ofs : 0;
+	}
+	
+	return r;
+}
+
+
+/* opens a file for reading; returns 0 on failure */
+WOW_API_PREFIX
+struct wow_reader *
+wow_reader_open(char const *path, size_t bufsz)
+{
+	struct wow_reader *r;
+	int fd;
+	
+	if (!path)
+		return 0;
+	
+	/* directories are turned away by wow_reader_fdopen's fstat */
+#if defined(_WIN32)
+	fd = wow_open(path, O_RDONLY | O_BINARY, 0);
+#else
+	fd = wow_open(path, O_RDONLY | O_CLOEXEC, 0);
+#endif
+	if (fd < 0)
+		return 0;
+	
+	if (!(r = wow_reader_fdopen(fd, bufsz)))
+	{
+		close(fd);
+		return 0;
+	}
+	r->owns_fd = 1;
+	
+	return r;
+}
+
+
+/* closes a reader */
+WOW_API_PREFIX
+void
+wow_reader_close(struct wow_reader *r)
+{
+	if (!r)
+		return;
+	
+#ifdef WOW_USE_PTHREAD
+	if (r->prefetch)
+	{
+		pthread_mutex_lock(&r->pf_lock);
+		r->pf_state = WOW_READER_PF_QUIT;
+		pthread_cond_broadcast(&r->pf_cond);
+		pthread_mutex_unlock(&r->pf_lock);
+		pthread_join(r->pf_thread, 0);
+		pthread_cond_destroy(&r->pf_cond);
+		pthread_mutex_destroy(&r->pf_lock);
+		wow_free(r->pf_alloc);
+	}
+#endif
+	
+	if (r->owns_fd)
+		close(r->fd);
+	
+	wow_free(r->buf_alloc);
+	wow_free(r);
+}
+
+
+/* reads the next block on a helper thread while the current one *
+ * is consumed; returns non-zero if prefetching isn't available  *
+ * (no WOW_USE_PTHREAD, or not a regular file), in which case    *
+ * the reader keeps working as before                            */
+WOW_API_PREFIX
+int
+wow_reader_prefetch(struct wow_reader *r)
+{
+#if defined(WOW_USE_PTHREAD) && !defined(_WIN32)
+	unsigned char *alloc;
+	unsigned char *buf;
+	size_t have;
+	
+	if (!r || !r->seekable)
+		return -1;
+	
+	if (r->prefetch)
+		return 0;
+	
+	/* both buffers get room for leftovers in front of each block */
+	have = r->end - r->pos;
+	buf = private_io_alloc(r->buf_cap * 2, &alloc);
+	memcpy(buf + r->buf_cap - have, r->buf + r->pos, have);
+	wow_free(r->buf_alloc);
+	r->buf_alloc = alloc;
+	r->buf = buf;
+	r->pos = r->buf_cap - have;
+	r->end = r->buf_cap;
+	r->pf_buf = private_io_alloc(r->buf_cap * 2, &r->pf_alloc);
+	
+	pthread_mutex_init(&r->pf_lock, 0);
+	pthread_cond_init(&r->pf_cond, 0);
+	r->pf_state = WOW_READER_PF_IDLE;
+	if (pthread_create(&r->pf_thread, 0, private_reader_thread, r))
+	{
+		pthread_cond_destroy(&r->pf_cond);
+		pthread_mutex_destroy(&r->pf_lock);
+		wow_free(r->pf_alloc);
+		r->pf_alloc = r->pf_buf = 0;
+		return -1;
+	}
+	r->prefetch = 1;
+	
+	pthread_mutex_lock(&r->pf_lock);
+	private_reader_request(r);
+	pthread_mutex_unlock(&r->pf_lock);
+	
+	return 0;
+#else
+	(void)r; /* unused parameter */
+	return -1;
+#endif
+}
+
+
+/* swaps n bytes' worth of whole size-byte values */
+static
+void
+private_reader_swap_out(void *dst, const void *src, size_t n, size_t size)
+{
+	if (size == 2)
+		private_bswap_array(dst, src, n / 2, 2);
+	else if (size == 4)
+		private_bswap_array(dst, src, n / 4, 4);
+	else
+		private_bswap_array(dst, src, n / 8, 8);
+}
+
+/* wow_reader_read under wow_reader_swap: whole values are swapped *
+ * on their way out of the buffer, or in place after a big read    *
+ * that bypassed it, as in wow_reader_read; a read that stops      *
+ * partway into a value keeps it swapped in swap_val, and the next *
+ * one carries on from there                                       */
+static
+size_t
+private_reader_read_swapped(struct wow_reader *r, unsigned char *dst, size_t bytes)
+{
+	const size_t size = r->swap;
+	size_t done = 0;
+	
+	while (bytes)
+	{
+		uint64_t ofs = wow_reader_tell(r);
+		size_t phase = (ofs - r->swap_start) % size;
+		size_t n = r->end - r->pos;
+		
+		/* the rest of a value an earlier read stopped partway into */
+		if (phase)
+		{
+			if (n > size - phase)
+				n = size - phase;
+			if (n > bytes)
+				n = bytes;
+			if (!n)
+			{
+				if (!private_reader_refill(r))
+					break;
+				continue;
+			}
+			
+			/* not kept only when the file ends inside the value */
+			if (r->swap_val_ofs == ofs - phase)
+				memcpy(dst, r->swap_val + phase, n);
+			else
+				memcpy(dst, r->buf + r->pos, n);
+		}
+		
+		else if (!n && bytes >= r->buf_cap && !private_reader_is_prefetching(r))
+		{
+			size_t part;
+			
+			if (!(n = private_reader_sysread(r, dst, bytes - bytes % size)))
+				break;
+			
+			/* a value cut in two stays unread, in the buffer */
+			part = n % size;
+			n -= part;
+			memcpy(r->buf, dst + n, part);
+			r->pos = 0;
+			r->end = part;
+			private_reader_swap_out(dst, dst, n, size);
+			dst += n;
+			bytes -= n;
+			done += n;
+			continue;
+		}
+		
+		/* whole values out of the buffer */
+		else if ((n = ((n < bytes) ? n : bytes) / size * size))
+			private_reader_swap_out(dst, r->buf + r->pos, n, size);
+		
+		/* less than a value is wanted or at hand */
+		else if (r->end - r->pos < size && private_reader_refill(r))
+			continue;
+		
+		else if ((n = r->end - r->pos) >= size)
+		{
+			/* bytes < size, so this read stops partway into it */
+			private_reader_swap_out(r->swap_val, r->buf + r->pos, size, size);
+			r->swap_val_ofs = ofs;
+			n = bytes;
+			memcpy(dst, r->swap_val, n);
+		}
+		
+		/* the file ends partway into this value */
+		else
+		{
+			if (n > bytes)
+				n = bytes;
+			if (!n)
+				break;
+			memcpy(dst, r->buf + r->pos, n);
+		}
+		
+		r->pos += n;
+		dst += n;
+		bytes -= n;
+		done += n;
+	}
+	
+	return done;
+}
+
+
+/* reads up to bytes; returns bytes read, which is less than *
+ * requested only at the end of the file or on error        */
+WOW_API_PREFIX
+size_t
+wow_reader_read(struct wow_reader *r, void *dst, size_t bytes)
+{
+	unsigned char *dst8 = dst;
+	size_t done = 0;
+	size_t n;
+	
+	if (!r || !dst)
+		return 0;
+	
+	if (r->swap)
+		return private_reader_read_swapped(r, dst8, bytes);
+	
+	while (bytes)
+	{
+		/* drain what is buffered */
+		if ((n = r->end - r->pos))
+		{
+			if (n > bytes)
+				n = bytes;
+			memcpy(dst8, r->buf + r->pos, n);
+			r->pos += n;
+		}
+		
+		/* big reads bypass the buffer, unless it's being prefetched */
+		else if (bytes >= r->buf_cap && !private_reader_is_prefetching(r))
+		{
+			if (!(n = private_reader_sysread(r, dst8, bytes)))
+				break;
+		}
+		
+		/* refill */
+		else
+		{
+			if (!private_reader_refill(r))
+				break;
+			continue;
+		}
+		
+		dst8 += n;
+		bytes -= n;
+		done += n;
+	}
+	
+	return done;
+}
+
+
+/* makes wow_reader_read reverse the byte order of each size-byte *
+ * value (2, 4 or 8) as it is read, counting from the current     *
+ * offset; values stay on that grid across reads and skips of any *
+ * length, and only one cut short by the end of the file is       *
+ * copied as it is; 0 turns it off again; returns non-zero for    *
+ * any other size                                                 */
+WOW_API_PREFIX
+int
+wow_reader_swap(struct wow_reader *r, int size)
+{
+	if (!r || (size && size != 2 && size != 4 && size != 8))
+		return -1;
+	
+	/* a whole value has to fit in the buffer */
+	if ((size_t)size > r->buf_cap)
+		return -1;
+	
+	r->swap = size;
+	r->swap_start = wow_reader_tell(r);
+	r->swap_val_ofs = UINT64_MAX;
+	
+	return 0;
+}
+
+
+/* returns a pointer to the next bytes without consuming them, *
+ * or 0 if fewer remain (or bytes is larger than the buffer)   */
+WOW_API_PREFIX
+const void *
+wow_reader_peek(struct wow_reader *r, size_t bytes)
+{
+	if (!r || bytes > r->buf_cap)
+		return 0;
+	
+	if (!private_reader_fill(r, bytes))
+		return 0;
+	
+	return r->buf + r->pos;
+}
+
+
+/* wow_reader_skip with no regard for wow_reader_swap */
+static
+size_t
+private_reader_skip(struct wow_reader *r, size_t bytes)
+{
+	size_t done = 0;
+	size_t n;
+	
+	/* buffered bytes first */
+	n = r->end - r->pos;
+	if (n > bytes)
+		n = bytes;
+	r->pos += n;
+	bytes -= n;
+	done += n;
+	
+	if (!bytes || r->eof || r->error)
+		return done;
+	
+#if !defined(_WIN32)
+	/* reads are positioned, so skipping is just arithmetic */
+	if (r->seekable)
+	{
+		n = (r->ofs < r->size) ? r->size - r->ofs : 0;
+		if (n > bytes)
+			n = bytes;
+	#ifdef WOW_USE_PTHREAD
+		/* the block being prefetched is no longer the next one */
+		if (r->prefetch)
+		{
+			pthread_mutex_lock(&r->pf_lock);
+			private_reader_wait(r);
+			r->ofs += n;
+			private_reader_request(r);
+			pthread_mutex_unlock(&r->pf_lock);
+			return done + n;
+		}
+	#endif
+		r->ofs += n;
+		return done + n;
+	}
+#endif
+	
+	/* everything else has to be read and discarded */
+	while (bytes)
+	{
+		if (!private_reader_refill(r))
+			break;
+		n = r->end - r->pos;
+		if (n > bytes)
+			n = bytes;
+		r->pos += n;
+		bytes -= n;
+		done += n;
+	}
+	
+	return done;
+}
+
+
+/* skips bytes without reading them; returns bytes skipped */
+WOW_API_PREFIX
+size_t
+wow_reader_skip(struct wow_reader *r, size_t bytes)
+{
+	unsigned char value[8];
+	size_t tail;
+	size_t done = 0;
+	
+	if (!r)
+		return 0;
+	
+	if (!r->swap)
+		return private_reader_skip(r, bytes);
+	
+	/* swapped: skip to the start of the value the skip ends in, *
+	 * then read up to the end of the skip, so the next read can *
+	 * carry on with that value                                  */
+	tail = (wow_reader_tell(r) + bytes - r->swap_start) % r->swap;
+	if (bytes > tail)
+	{
+		done = private_reader_skip(r, bytes - tail);
+		if (done < bytes - tail)
+			return done;
+	}
+	else
+		tail = bytes;
+	
+	return done + private_reader_read_swapped(r, value, tail);
+}
+
+
+/* returns the current read offset */
+WOW_API_PREFIX
+uint64_t
+wow_reader_tell(struct wow_reader *r)
+{
+	if (!r)
+		return 0;
+	
+	return r->ofs - (r->end - r->pos);
+}
+
+
+/* returns the size of the file, or 0 if it isn't a regular file */
+WOW_API_PREFIX
+uint64_t
+wow_reader_size(struct wow_reader *r)
+{
+	if (!r)
+		return 0;
+	
+	return r->size;
+}
+
+
+/* returns non-zero if a read error occurred */
+WOW_API_PREFIX
+int
+wow_reader_error(struct wow_reader *r)
+{
+	if (!r)
+		return 1;
+	
+	return r->error;
+}
+
+
+/* wow_codec internals: Yaz0 and LZ77 are the same kind of LZ77, *
+ * with a flag byte ahead of every 8 items, each a literal byte  *
+ * or a 12-bit distance back-reference into the last 4 kb        */
+#define WOW_LZ_WINDOW 4096
+
+struct private_lz
+{
+	unsigned char window[WOW_LZ_WINDOW]; /* ring of the latest output */
+	uint64_t total;     /* bytes produced so far */
+	uint64_t size;      /* bytes to produce in all */
+	unsigned code;      /* flag byte, current flag in bit 7 */
+	int bits;           /* flags left in code */
+	size_t copy_len;    /* back-reference that didn't fit last time */
+	size_t copy_dist;
+};
+
+/* how many 1 bits a byte starts with, i.e. how many literals in a *
+ * row a Yaz0 flag byte announces (LZ77 uses it on the inverse)    */
+static const unsigned char private_lz_ones[256] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+	4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 7, 8
+};
+
+/* the byte 'dist' back from dst[out], wherever it lives */
+static
+unsigned char
+private_lz_at(const struct private_lz *lz, const unsigned char *dst, size_t out, size_t dist)
+{
+	if (out >= dist)
+		return dst[out - dist];
+	
+	return lz->window[(lz->total + out - dist) & (WOW_LZ_WINDOW - 1)];
+}
+
+/* keeps the last bytes of this call's output for later references */
+static
+void
+private_lz_remember(struct private_lz *lz, const unsigned char *dst, size_t out)
+{
+	size_t at;
+	size_t n;
+	
+	if (out > WOW_LZ_WINDOW)
+	{
+		dst += out - WOW_LZ_WINDOW;
+		lz->total += out - WOW_LZ_WINDOW;
+		out = WOW_LZ_WINDOW;
+	}
+	
+	at = lz->total & (WOW_LZ_WINDOW - 1);
+	n = WOW_LZ_WINDOW - at;
+	if (n > out)
+		n = out;
+	memcpy(lz->window + at, dst, n);
+	memcpy(lz->window, dst + n, out - n);
+	lz->total += out;
+}
+
+/* the shared decoder; yaz0 is a constant in each caller, so the *
+ * format checks below are resolved at compile time              */
+static inline
+int
+private_lz_decode(
+	struct private_lz *lz
+	, unsigned char *dst
+	, size_t *dst_len
+	, const unsigned char *src
+	, size_t *src_len
+	, const int yaz0
+)
+{
+	const unsigned char *s = src;
+	const unsigned char *s_end = src + *src_len;
+	size_t out = 0;
+	size_t max = *dst_len;
+	int rval = 0;
+	
+	if (max > lz->size - lz->total)
+		max = lz->size - lz->total;
+	
+	while (out < max)
+	{
+		size_t len;
+		size_t dist;
+		
+		/* a back-reference, either cut short by the end of dst last *
+		 * time, or one that reaches back past the start of dst      */
+		if (lz->copy_len)
+		{
+			len = lz->copy_len;
+			dist = lz->copy_dist;
+			if (len > max - out)
+				len = max - out;
+			lz->copy_len -= len;
+			
+			/* all of it is in dst: plain forward copy */
+			if (out >= dist)
+			{
+				const unsigned char *from = dst + out - dist;
+				unsigned char *to = dst + out;
+				
+				out += len;
+				if (dist >= len)
+					memcpy(to, from, len);
+				else
+					while (len--)
+						*to++ = *from++;
+			}
+			else
+				while (len--)
+				{
+					dst[out] = private_lz_at(lz, dst, out, dist);
+					++out;
+				}
+			continue;
+		}
+		
+		if (!lz->bits)
+		{
+			if (s == s_end)
+				break;
+			lz->code = *s++;
+			lz->bits = 8;
+		}
+		
+		/* literals: the table says how many follow in a row */
+		len = private_lz_ones[(yaz0 ? lz->code : ~lz->code) & 0xff];
+		if (len)
+		{
+			if (len > (size_t)lz->bits)
+				len = lz->bits;
+			if (len > max - out)
+				len = max - out;
+			if (len > (size_t)(s_end - s))
+				len = s_end - s;
+			if (!len)
+				break;
+			memcpy(dst + out, s, len);
+			s += len;
+			out += len;
+			lz->code <<= len;
+			lz->bits -= len;
+			continue;
+		}
+		
+		/* back-reference: 2 bytes, Yaz0 takes 3 for long ones */
+		if (s_end - s < 2)
+			break;
+		dist = (((size_t)s[0] & 0xf) << 8 | s[1]) + 1;
+		if (yaz0)
+		{
+			if (s[0] >> 4)
+			{
+				len = (s[0] >> 4) + 2;
+				s += 2;
+			}
+			else
+			{
+				if (s_end - s < 3)
+					break;
+				len = s[2] + 0x12;
+				s += 3;
+			}
+		}
+		else
+		{
+			len = (s[0] >> 4) + 3;
+			s += 2;
+		}
+		lz->code <<= 1;
+		lz->bits -= 1;
+		
+		/* reaching back before the start of the data */
+		if (dist > lz->total + out)
+		{
+			rval = -1;
+			break;
+		}
+		lz->copy_len = len;
+		lz->copy_dist = dist;
+	}
+	
+	private_lz_remember(lz, dst, out);
+	*dst_len = out;
+	*src_len = s - src;
+	
+	if (rval)
+		return rval;
+	
+	return lz->total == lz->size && !lz->copy_len;
+}
+
+static
+void *
+private_lz_open(uint64_t size)
+{
+	struct private_lz *lz = wow_calloc_die(1, sizeof(*lz));
+	
+	lz->size = size;
+	
+	return lz;
+}
+
+/* "Yaz0", u32 big-endian decoded size, 8 bytes unused */
+static
+void *
+private_yaz0_open(const unsigned char *header, uint64_t *size)
+{
+	*size = (uint32_t)header[4] << 24
+		| (uint32_t)header[5] << 16
+		| (uint32_t)header[6] << 8
+		| header[7]
+	;
+	
+	return private_lz_open(*size);
+}
+
+static
+int
+private_yaz0_decode(
+	void *state
+	, unsigned char *dst
+	, size_t *dst_len
+	, const unsigned char *src
+	, size_t *src_len
+)
+{
+	return private_lz_decode(state, dst, dst_len, src, src_len, 1);
+}
+
+/* "LZ77", then type 0x10 and a u24 little-endian decoded size */
+static
+void *
+private_lz77_open(const unsigned char *header, uint64_t *size)
+{
+	if (header[4] != 0x10)
+		return 0;
+	
+	*size = header[5] | (uint32_t)header[6] << 8 | (uint32_t)header[7] << 16;
+	
+	return private_lz_open(*size);
+}
+
+static
+int
+private_lz77_decode(
+	void *state
+	, unsigned char *dst
+	, size_t *dst_len
+	, const unsigned char *src
+	, size_t *src_len
+)
+{
+	return private_lz_decode(state, dst, dst_len, src, src_len, 0);
+}
+
+static
+void
+private_lz_close(void *state)
+{
+	wow_free(state);
+}
+
+/* greedy encoder for both formats: positions are hashed on their *
+ * first 3 bytes into chains through the last 4 kb, and the       *
+ * longest match found in a few steps down the chain is taken     */
+#define WOW_LZ_HASH_BITS 13
+#define WOW_LZ_CHAIN 16
+
+static inline
+size_t
+private_lz_hash(const unsigned char *s)
+{
+	uint32_t v = (uint32_t)s[0] << 16 | (uint32_t)s[1] << 8 | s[2];
+	
+	return (v * 2654435761u) >> (32 - WOW_LZ_HASH_BITS);
+}
+
+static inline
+void *
+private_lz_encode(const void *src_, size_t len, size_t *packed_len, const int yaz0)
+{
+	const unsigned char *src = src_;
+	const size_t head_len = yaz0 ? 16 : 8;
+	const size_t max_len = yaz0 ? 0x111 : 18;
+	unsigned char *out;
+	unsigned char *o;
+	size_t *head; /* latest position + 1 per hash, 0 = none */
+	size_t *prev; /* earlier position + 1 with the same hash */
+	size_t i = 0;
+	
+	if ((uint64_t)len > (yaz0 ? 0xffffffffu : 0xffffffu))
+		return 0;
+	
+	/* all literals is the worst case */
+	out = wow_malloc_die(head_len + len + (len + 7) / 8);
+	head = wow_calloc_die((1 << WOW_LZ_HASH_BITS) + WOW_LZ_WINDOW, sizeof(*head));
+	prev = head + (1 << WOW_LZ_HASH_BITS);
+	
+	if (yaz0)
+	{
+		memcpy(out, "Yaz0", 4);
+		out[4] = len >> 24;
+		out[5] = len >> 16;
+		out[6] = len >> 8;
+		out[7] = len;
+		memset(out + 8, 0, 8);
+	}
+	else
+	{
+		memcpy(out, "LZ77", 4);
+		out[4] = 0x10;
+		out[5] = len;
+		out[6] = len >> 8;
+		out[7] = len >> 16;
+	}
+	o = out + head_len;
+	
+	while (i < len)
+	{
+		unsigned char *flags = o++;
+		unsigned bit;
+		
+		*flags = 0;
+		for (bit = 0x80; bit && i < len; bit >>= 1)
+		{
+			size_t limit = (len - i < max_len) ? len - i : max_len;
+			size_t best = 0;
+			size_t best_dist = 0;
+			size_t k;
+			
+			if (limit >= 3)
+			{
+				size_t at = head[private_lz_hash(src + i)];
+				int depth = WOW_LZ_CHAIN;
+				
+				while (at && i - (at - 1) <= WOW_LZ_WINDOW && depth--)
+				{
+					const unsigned char *a = src + at - 1;
+					const unsigned char *b = src + i;
+					
+					/* can't beat the best without matching its last byte */
+					if (a[best] == b[best])
+					{
+						size_t n = 0;
+						
+						while (n < limit && a[n] == b[n])
+							++n;
+						if (n > best)
+						{
+							best = n;
+							best_dist = i - (at - 1);
+							if (n == limit)
+								break;
+						}
+					}
+					at = prev[(at - 1) & (WOW_LZ_WINDOW - 1)];
+				}
+			}
+			
+			if (best >= 3)
+			{
+				size_t d = best_dist - 1;
+				
+				if (!yaz0)
+				{
+					*flags |= bit;
+					*o++ = (best - 3) << 4 | d >> 8;
+					*o++ = d;
+				}
+				else if (best < 0x12)
+				{
+					*o++ = (best - 2) << 4 | d >> 8;
+					*o++ = d;
+				}
+				else
+				{
+					*o++ = d >> 8;
+					*o++ = d;
+					*o++ = best - 0x12;
+				}
+			}
+			else
+			{
+				if (yaz0)
+					*flags |= bit;
+				*o++ = src[i];
+				best = 1;
+			}
+			
+			for (k = i; k < i + best && k + 2 < len; ++k)
+			{
+				size_t h = private_lz_hash(src + k);
+				
+				prev[k & (WOW_LZ_WINDOW - 1)] = head[h];
+				head[h] = k + 1;
+			}
+			i += best;
+		}
+	}
+	
+	wow_free(head);
+	*packed_len = o - out;
+	
+	return out;
+}
+
+static
+void *
+private_yaz0_encode(const void *src, size_t len, size_t *packed_len)
+{
+	return private_lz_encode(src, len, packed_len, 1);
+}
+
+static
+void *
+private_lz77_encode(const void *src, size_t len, size_t *packed_len)
+{
+	return private_lz_encode(src, len, packed_len, 0);
+}
+
+/* big-endian fields of the block container */
+static inline
+uint32_t
+private_get_be32(const unsigned char *s)
+{
+	return (uint32_t)s[0] << 24 | (uint32_t)s[1] << 16 | (uint32_t)s[2] << 8 | s[3];
+}
+
+static inline
+uint64_t
+private_get_be64(const unsigned char *s)
+{
+	return (uint64_t)private_get_be32(s) << 32 | private_get_be32(s + 4);
+}
+
+static inline
+void
+private_put_be32(unsigned char *d, uint32_t v)
+{
+	d[0] = v >> 24;
+	d[1] = v >> 16;
+	d[2] = v >> 8;
+	d[3] = v;
+}
+
+static inline
+void
+private_put_be64(unsigned char *d, uint64_t v)
+{
+	private_put_be32(d, v >> 32);
+	private_put_be32(d + 4, v);
+}
+
+/* WOWB, defined below since it looks up the codecs of its blocks */
+static void *private_blocks_open(const unsigned char *header, uint64_t *size);
+static int private_blocks_decode(void *, unsigned char *, size_t *, const unsigned char *, size_t *);
+static void private_blocks_close(void *state);
+
+#define WOW_CODEC_MAX 16
+
+static const struct wow_codec *private_codecs[WOW_CODEC_MAX] = {
+	&(const struct wow_codec){
+		"Yaz0", "Yaz0", 4, 16
+		, private_yaz0_open, private_yaz0_decode, private_lz_close
+		, private_yaz0_encode
+	}
+	, &(const struct wow_codec){
+		"LZ77", "LZ77", 4, 8
+		, private_lz77_open, private_lz77_decode, private_lz_close
+		, private_lz77_encode
+	}
+	, &(const struct wow_codec){
+		"WOWB", "WOWB", 4, 16
+		, private_blocks_open, private_blocks_decode, private_blocks_close
+		, 0
+	}
+};
+static int private_codec_count = 3;
+
+/* WOWB, the block container wow_writer_compress writes; all *
+ * numbers are big-endian:                                   *
+ *   header   "WOWB", u32 block size, u64 decoded size       *
+ *   blocks   u32 packed size, u32 decoded size, then the    *
+ *            block as a complete stream in another format   *
+ *   end      u32 0, u32 0                                   *
+ *   index    per block: u64 file offset of its stream, u64  *
+ *            offset of its first byte in the decoded data   *
+ *   trailer  u64 index offset, u64 block count, u64 decoded *
+ *            size, "WOWBINDX"                               *
+ * decoding stops at the end marker, so the index is only    *
+ * read by wow_block_index                                   */
+#define WOW_BLOCKS_TRAILER 32
+
+struct private_blocks
+{
+	const struct wow_codec *codec; /* current block's, 0 between blocks */
+	void *state;
+	uint64_t left;      /* packed bytes of the current block not yet decoded */
+	uint64_t total;     /* bytes produced so far */
+	uint64_t size;      /* bytes to produce in all */
+};
+
+static
+void *
+private_blocks_open(const unsigned char *header, uint64_t *size)
+{
+	struct private_blocks *bs = wow_calloc_die(1, sizeof(*bs));
+	
+	*size = bs->size = private_get_be64(header + 8);
+	
+	return bs;
+}
+
+static
+int
+private_blocks_decode(
+	void *state
+	, unsigned char *dst
+	, size_t *dst_len
+	, const unsigned char *src
+	, size_t *src_len
+)
+{
+	struct private_blocks *bs = state;
+	const unsigned char *s = src;
+	const unsigned char *s_end = src + *src_len;
+	unsigned char *d = dst;
+	unsigned char *d_end = dst + *dst_len;
+	int rval = 0;
+	
+	while (!rval)
+	{
+		size_t in;
+		size_t out;
+		int got;
+		
+		/* the next block's header, and that of the stream in it */
+		if (!bs->codec)
+		{
+			const struct wow_codec *codec = 0;
+			uint64_t packed;
+			uint64_t raw;
+			uint64_t size;
+			int i;
+			
+			if (s_end - s < 8)
+				break;
+			packed = private_get_be32(s);
+			raw = private_get_be32(s + 4);
+			if (!packed)
+			{
+				s += 8;
+				rval = (bs->total == bs->size && !raw) ? 1 : -1;
+				break;
+			}
+			
+			for (i = private_codec_count - 1; i >= 0; --i)
+			{
+				codec = private_codecs[i];
+				if (codec->decode == private_blocks_decode
+					|| codec->header_len > packed
+				)
+					continue;
+				if ((size_t)(s_end - s) < 8 + codec->header_len)
+					break;
+				if (!memcmp(s + 8, codec->magic, codec->magic_len))
+					break;
+			}
+			if (i >= 0 && (size_t)(s_end - s) < 8 + codec->header_len)
+				break;
+			if (i < 0 || !(bs->state = codec->open(s + 8, &size)))
+			{
+				rval = -1;
+				break;
+			}
+			bs->codec = codec;
+			if (size != raw)
+			{
+				rval = -1;
+				break;
+			}
+			bs->left = packed - codec->header_len;
+			s += 8 + codec->header_len;
+			continue;
+		}
+		
+		in = s_end - s;
+		if (in > bs->left)
+			in = bs->left;
+		out = d_end - d;
+		got = bs->codec->decode(bs->state, d, &out, s, &in);
+		s += in;
+		d += out;
+		bs->left -= in;
+		bs->total += out;
+		
+		if (got < 0)
+			rval = -1;
+		else if (got > 0)
+		{
+			bs->codec->close(bs->state);
+			bs->codec = 0;
+			if (bs->left)
+				rval = -1;
+		}
+		else if (!in && !out)
+		{
+			/* out of room, or out of input for now; with the *
+			 * whole block consumed, there is no more coming  */
+			if (!bs->left && d < d_end)
+				rval = -1;
+			break;
+		}
+	}
+	
+	*dst_len = d - dst;
+	*src_len = s - src;
+	
+	return rval;
+}
+
+static
+void
+private_blocks_close(void *state)
+{
+	struct private_blocks *bs = state;
+	
+	if (bs->codec)
+		bs->codec->close(bs->state);
+	wow_free(bs);
+}
+
+struct wow_decoder
+{
+	struct wow_reader *r;
+	const struct wow_codec *codec; /* 0 = passed through */
+	void *state;
+	uint64_t size;
+	int done;
+	int error;
+};
+
+WOW_API_PREFIX
+int
+wow_codec_register(const struct wow_codec *codec)
+{
+	if (!codec || private_codec_count == WOW_CODEC_MAX)
+		return -1;
+	
+	private_codecs[private_codec_count++] = codec;
+	
+	return 0;
+}
+
+WOW_API_PREFIX
+const struct wow_codec *
+wow_codec_find(const char *name)
+{
+	int i;
+	
+	if (!name)
+		return 0;
+	
+	for (i = private_codec_count - 1; i >= 0; --i)
+		if (!strcmp(private_codecs[i]->name, name))
+			return private_codecs[i];
+	
+	return 0;
+}
+
+WOW_API_PREFIX
+struct wow_decoder *
+wow_decoder_open(struct wow_reader *r)
+{
+	struct wow_decoder *d;
+	int i;
+	
+	if (!r)
+		return 0;
+	
+	d = wow_calloc_die(1, sizeof(*d));
+	d->r = r;
+	
+	/* the latest registered codec wins */
+	for (i = private_codec_count - 1; i >= 0; --i)
+	{
+		const struct wow_codec *codec = private_codecs[i];
+		const unsigned char *header = wow_reader_peek(r, codec->header_len);
+		
+		if (!header || memcmp(header, codec->magic, codec->magic_len))
+			continue;
+		
+		if (!(d->state = codec->open(header, &d->size)))
+		{
+			wow_free(d);
+			return 0;
+		}
+		d->codec = codec;
+		wow_reader_skip(r, codec->header_len);
+		
+		return d;
+	}
+	
+	if (r->error)
+	{
+		wow_free(d);
+		return 0;
+	}
+	
+	/* no known format */
+	if (r->size)
+		d->size = r->size - wow_reader_tell(r);
+	
+	return d;
+}
+
+WOW_API_PREFIX
+size_t
+wow_decoder_read(struct wow_decoder *d, void *dst, size_t bytes)
+{
+	unsigned char *dst8 = dst;
+	struct wow_reader *r;
+	size_t done = 0;
+	
+	if (!d || !dst)
+		return 0;
+	
+	r = d->r;
+	if (!d->codec)
+		return wow_reader_read(r, dst, bytes);
+	
+	while (bytes && !d->done && !d->error)
+	{
+		size_t out = bytes;
+		size_t in = r->end - r->pos;
+		int rval;
+		
+		rval = d->codec->decode(d->state, dst8, &out, r->buf + r->pos, &in);
+		r->pos += in;
+		dst8 += out;
+		bytes -= out;
+		done += out;
+		
+		if (rval < 0)
+			d->error = 1;
+		else if (rval > 0)
+			d->done = 1;
+		
+		/* stuck: it takes more input to go on */
+		else if (!out && !in && !private_reader_refill(r))
+			d->error = 1;
+	}
+	
+	return done;
+}
+
+WOW_API_PREFIX
+uint64_t
+wow_decoder_size(struct wow_decoder *d)
+{
+	if (!d)
+		return 0;
+	
+	return d->size;
+}
+
+WOW_API_PREFIX
+const char *
+wow_decoder_format(struct wow_decoder *d)
+{
+	if (!d || !d->codec)
+		return "raw";
+	
+	return d->codec->name;
+}
+
+WOW_API_PREFIX
+int
+wow_decoder_error(struct wow_decoder *d)
+{
+	if (!d)
+		return 1;
+	
+	return d->error || d->r->error;
+}
+
+WOW_API_PREFIX
+void
+wow_decoder_close(struct wow_decoder *d)
+{
+	if (!d)
+		return;
+	
+	if (d->codec)
+		d->codec->close(d->state);
+	wow_free(d);
+}
+
+
+/* loads one file of a batch the ordinary way */
+static
+void
+private_batch_load_one(struct wow_batch_file *f)
+{
+	unsigned char *buf = 0;
+	struct stat s;
+	size_t got = 0;
+	long long n;
+	int fd;
+	
+	f->data = 0;
+	f->size = 0;
+	f->error = 0;
+	
+#if defined(_WIN32)
+	fd = wow_open(f->path, O_RDONLY | O_BINARY, 0);
+#else
+	fd = wow_open(f->path, O_RDONLY | O_CLOEXEC, 0);
+#endif
+	if (fd < 0)
+	{
+		f->error = errno;
+		return;
+	}
+	
+	if (fstat(fd, &s))
+	{
+		f->error = errno;
+		goto L_cleanup;
+	}
+	if (S_ISDIR(s.st_mode))
+	{
+		f->error = EISDIR;
+		goto L_cleanup;
+	}
+	
+	if (s.st_size > 0)
+		buf = wow_malloc_die(s.st_size);
+	
+	while (got < (size_t)s.st_size)
+	{
+#if defined(_WIN32)
+		n = read(fd, buf + got, s.st_size - got);
+#else
+		n = pread(fd, buf + got, s.st_size - got, got);
+#endif
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+		{
+			f->error = errno;
+			wow_free(buf);
+			goto L_cleanup;
+		}
+		
+		/* file got shorter */
+		if (!n)
+			break;
+		
+		got += n;
+	}
+	
+	if (!got && buf)
+	{
+		wow_free(buf);
+		buf = 0;
+	}
+	f->data = buf;
+	f->size = got;
+	
+L_cleanup:
+	close(fd);
+}
+
+#ifdef WOW_USE_PTHREAD
+/* thread pool fallback for batch loading */
+struct private_batch_pool
+{
+	struct wow_batch_file *files;
+	size_t count;
+	size_t next; /* claimed with atomic increments */
+};
+
+static
+void *
+private_batch_worker(void *udata)
+{
+	struct private_batch_pool *pool = udata;
+	size_t i;
+	
+	while ((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->count)
+		private_batch_load_one(&pool->files[i]);
+	
+	return 0;
+}
+#endif /* WOW_USE_PTHREAD */
+
+#ifdef WOW_HAVE_IO_URING
+/* a bare-bones io_uring, just enough for batch loading */
+struct private_uring
+{
+	int fd;
+	unsigned entries;
+	unsigned queued; /* sqes not yet submitted */
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr;
+	void *cq_ptr;
+	size_t sq_len;
+	size_t cq_len;
+	size_t sqes_len;
+};
+
+/* per-file progress through open -> statx -> read(s) -> close */
+struct private_uring_file
+{
+	enum {
+		WOW_URING_OPEN = 0
+		, WOW_URING_STAT
+		, WOW_URING_READ
+		, WOW_URING_CLOSE
+		, WOW_URING_DONE
+	} stage;
+	int busy; /* an op is in flight */
+	int fd;
+	size_t want;
+	struct statx stx;
+};
+
+static
+void
+private_uring_quit(struct private_uring *ring)
+{
+	if (ring->sqes && ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_ptr && ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr)
+		munmap(ring->cq_ptr, ring->cq_len);
+	if (ring->sq_ptr && ring->sq_ptr != MAP_FAILED)
+		munmap(ring->sq_ptr, ring->sq_len);
+	if (ring->fd >= 0)
+		close(ring->fd);
+}
+
+/* returns non-zero if io_uring or the needed ops are unavailable */
+static
+int
+private_uring_init(struct private_uring *ring, unsigned entries)
+{
+	static const unsigned char ops[] = {
+		IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE
+	};
+	struct io_uring_params p;
+	struct io_uring_probe *probe;
+	unsigned char *sq;
+	unsigned char *cq;
+	unsigned i;
+	
+	memset(ring, 0, sizeof(*ring));
+	memset(&p, 0, sizeof(p));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0)
+		return -1;
+	
+	/* older kernels have io_uring, but not the ops used here */
+	probe = wow_calloc_die(1, sizeof(*probe) + 256 * sizeof(probe->ops[0]));
+	if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256))
+	{
+		wow_free(probe);
+		goto L_fail;
+	}
+	for (i = 0; i < sizeof(ops) / sizeof(ops[0]); ++i)
+	{
+		if (ops[i] > probe->last_op
+			|| !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)
+		)
+		{
+			wow_free(probe);
+			goto L_fail;
+		}
+	}
+	wow_free(probe);
+	
+	ring->entries = p.sq_entries;
+	ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (ring->cq_len > ring->sq_len)
+			ring->sq_len = ring->cq_len;
+		ring->cq_len = ring->sq_len;
+	}
+	ring->sq_ptr = mmap(0, ring->sq_len, PROT_READ | PROT_WRITE
+		, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING
+	);
+	if (ring->sq_ptr == MAP_FAILED)
+		goto L_fail;
+	
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring->cq_ptr = ring->sq_ptr;
+	else
+	{
+		ring->cq_ptr = mmap(0, ring->cq_len, PROT_READ | PROT_WRITE
+			, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING
+		);
+		if (ring->cq_ptr == MAP_FAILED)
+			goto L_fail;
+	}
+	ring->sqes = mmap(0, ring->sqes_len, PROT_READ | PROT_WRITE
+		, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES
+	);
+	if (ring->sqes == MAP_FAILED)
+		goto L_fail;
+	
+	sq = ring->sq_ptr;
+	cq = ring->cq_ptr;
+	ring->sq_head = (void*)(sq + p.sq_off.head);
+	ring->sq_tail = (void*)(sq + p.sq_off.tail);
+	ring->sq_mask = (void*)(sq + p.sq_off.ring_mask);
+	ring->sq_array = (void*)(sq + p.sq_off.array);
+	ring->cq_head = (void*)(cq + p.cq_off.head);
+	ring->cq_tail = (void*)(cq + p.cq_off.tail);
+	ring->cq_mask = (void*)(cq + p.cq_off.ring_mask);
+	ring->cqes = (void*)(cq + p.cq_off.cqes);
+	
+	return 0;
+	
+L_fail:
+	private_uring_quit(ring);
+	return -1;
+}
+
+/* submits everything queued, then waits for at least 'wait' completions */
+static
+int
+private_uring_enter(struct private_uring *ring, unsigned wait)
+{
+	long rv;
+	
+	do
+		rv = syscall(__NR_io_uring_enter, ring->fd, ring->queued, wait
+			, wait ? IORING_ENTER_GETEVENTS : 0, 0, 0
+		);
+	while (rv < 0 && errno == EINTR);
+	
+	if (rv < 0)
+		return -1;
+	
+	ring->queued -= rv;
+	return 0;
+}
+
+/* returns a zeroed sqe tagged with user_data, or 0 if the ring is broken */
+static
+struct io_uring_sqe *
+private_uring_sqe(struct private_uring *ring, size_t user_data)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail = *ring->sq_tail;
+	unsigned idx;
+	
+	/* full: submit what is there to make room */
+	while (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->entries)
+		if (private_uring_enter(ring, 0))
+			return 0;
+	
+	idx = tail & *ring->sq_mask;
+	sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = user_data;
+	ring->sq_array[idx] = idx;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->queued += 1;
+	
+	return sqe;
+}
+
+/* queues the next step for one file; returns non-zero on failure */
+static
+int
+private_uring_step(
+	struct private_uring *ring
+	, struct wow_batch_file *files
+	, struct private_uring_file *st
+	, size_t i
+)
+{
+	struct io_uring_sqe *sqe;
+	
+	if (!(sqe = private_uring_sqe(ring, i)))
+		return -1;
+	
+	switch (st[i].stage)
+	{
+		case WOW_URING_OPEN:
+			sqe->opcode = IORING_OP_OPENAT;
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (uintptr_t)files[i].path;
+			sqe->open_flags = O_RDONLY | O_CLOEXEC;
+			break;
+		
+		case WOW_URING_STAT:
+			sqe->opcode = IORING_OP_STATX;
+			sqe->fd = st[i].fd;
+			sqe->addr = (uintptr_t)"";
+			sqe->len = STATX_TYPE | STATX_SIZE;
+			sqe->off = (uintptr_t)&st[i].stx;
+			sqe->statx_flags = AT_EMPTY_PATH;
+			break;
+		
+		case WOW_URING_READ:
+			sqe->opcode = IORING_OP_READ;
+			sqe->fd = st[i].fd;
+			sqe->addr = (uintptr_t)files[i].data + files[i].size;
+			sqe->len = (st[i].want - files[i].size > 0x40000000)
+				? 0x40000000
+				: st[i].want - files[i].size
+			;
+			sqe->off = files[i].size;
+			break;
+		
+		case WOW_URING_CLOSE:
+			sqe->opcode = IORING_OP_CLOSE;
+			sqe->fd = st[i].fd;
+			break;
+		
+		case WOW_URING_DONE:
+			break;
+	}
+	st[i].busy = 1;
+	
+	return 0;
+}
+
+/* batch load through io_uring; returns non-zero if io_uring *
+ * can't be used, in which case nothing has been touched     */
+static
+int
+private_batch_uring(struct wow_batch_file *files, size_t count)
+{
+	struct private_uring ring;
+	struct private_uring_file *st;
+	struct io_uring_cqe *cqe;
+	struct wow_batch_file *f;
+	unsigned inflight = 0;
+	unsigned head;
+	size_t next = 0;
+	size_t done = 0;
+	size_t i;
+	int res;
+	
+	if (private_uring_init(&ring, (count < 64) ? count : 64))
+		return -1;
+	
+	st = wow_calloc_die(count, sizeof(*st));
+	for (i = 0; i < count; ++i)
+	{
+		files[i].data = 0;
+		files[i].size = 0;
+		files[i].error = 0;
+	}
+	
+	while (done < count)
+	{
+		/* every file in flight has exactly one op in flight */
+		while (next < count && inflight < ring.entries)
+		{
+			if (private_uring_step(&ring, files, st, next))
+				goto L_broken;
+			next += 1;
+			inflight += 1;
+		}
+		
+		if (private_uring_enter(&ring, 1))
+			goto L_broken;
+		
+		head = *ring.cq_head;
+		while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE))
+		{
+			cqe = &ring.cqes[head & *ring.cq_mask];
+			i = cqe->user_data;
+			res = cqe->res;
+			f = &files[i];
+			head += 1;
+			__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+			st[i].busy = 0;
+			
+			switch (st[i].stage)
+			{
+				case WOW_URING_OPEN:
+					if (res < 0)
+					{
+						f->error = -res;
+						st[i].stage = WOW_URING_DONE;
+						inflight -= 1;
+						done += 1;
+						continue;
+					}
+					st[i].fd = res;
+					st[i].stage = WOW_URING_STAT;
+					break;
+				
+				case WOW_URING_STAT:
+					if (res < 0)
+						f->error = -res;
+					else if (S_ISDIR(st[i].stx.stx_mode))
+						f->error = EISDIR;
+					else if (st[i].stx.stx_size > SIZE_MAX)
+						f->error = EFBIG;
+					else if (st[i].stx.stx_size)
+					{
+						st[i].want = st[i].stx.stx_size;
+						f->data = wow_malloc_die(st[i].want);
+						st[i].stage = WOW_URING_READ;
+						break;
+					}
+					st[i].stage = WOW_URING_CLOSE;
+					break;
+				
+				case WOW_URING_READ:
+					if (res < 0)
+						f->error = -res;
+					else
+						f->size += res;
+					
+					/* short reads mean more to read, unless the file shrank */
+					if (res > 0 && f->size < st[i].want)
+						break;
+					if (f->error || !f->size)
+					{
+						wow_free(f->data);
+						f->data = 0;
+						f->size = 0;
+					}
+					st[i].stage = WOW_URING_CLOSE;
+					break;
+				
+				case WOW_URING_CLOSE:
+				case WOW_URING_DONE:
+					st[i].stage = WOW_URING_DONE;
+					inflight -= 1;
+					done += 1;
+					continue;
+			}
+			
+			if (private_uring_step(&ring, files, st, i))
+				goto L_broken;
+		}
+	}
+	
+	wow_free(st);
+	private_uring_quit(&ring);
+	return 0;
+
+L_broken:
+	/* the ring stopped working partway, which shouldn't happen; *
+	 * wait out what the kernel still owns, then start over      */
+	for (inflight = 0, i = 0; i < count; ++i)
+		inflight += st[i].busy;
+	while (inflight && !private_uring_enter(&ring, 1))
+	{
+		head = *ring.cq_head;
+		while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE))
+		{
+			cqe = &ring.cqes[head & *ring.cq_mask];
+			i = cqe->user_data;
+			if (st[i].stage == WOW_URING_OPEN)
+			{
+				st[i].stage = (cqe->res >= 0) ? WOW_URING_STAT : WOW_URING_DONE;
+				st[i].fd = cqe->res;
+			}
+			else if (st[i].stage == WOW_URING_CLOSE)
+				st[i].stage = WOW_URING_DONE;
+			st[i].busy = 0;
+			inflight -= 1;
+			head += 1;
+		}
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+	}
+	for (i = 0; i < count; ++i)
+	{
+		if (st[i].stage != WOW_URING_OPEN && st[i].stage != WOW_URING_DONE)
+			close(st[i].fd);
+		
+		/* buffers the kernel may still write to are leaked */
+		if (!st[i].busy)
+			wow_free(files[i].data);
+		files[i].data = 0;
+		files[i].size = 0;
+	}
+	wow_free(st);
+	private_uring_quit(&ring);
+	return -1;
+}
+#endif /* WOW_HAVE_IO_URING */
+
+
+/* loads many whole files at once; opens and reads are queued *
+ * through io_uring on linux, otherwise they are spread over a *
+ * few threads (or done one by one without WOW_USE_PTHREAD);   *
+ * returns how many files were loaded successfully             */
+WOW_API_PREFIX
+size_t
+wow_file_load_batch(struct wow_batch_file *files, size_t count)
+{
+	size_t ok = 0;
+	size_t i;
+	
+	if (!files || !count)
+		return 0;
+	
+#ifdef WOW_HAVE_IO_URING
+	if (!private_batch_uring(files, count))
+		goto L_count;
+#endif
+	
+#ifdef WOW_USE_PTHREAD
+	{
+		struct private_batch_pool pool = { files, count, 0 };
+		pthread_t threads[16];
+		int nthreads = private_cpu_count();
+		int started = 0;
+		
+		if (nthreads > 16)
+			nthreads = 16;
+		if ((size_t)nthreads > count)
+			nthreads = count;
+		
+		/* the calling thread does its share too */
+		while (started < nthreads - 1
+			&& !pthread_create(&threads[started], 0, private_batch_worker, &pool)
+		)
+			started += 1;
+		private_batch_worker(&pool);
+		while (started)
+			pthread_join(threads[--started], 0);
+	}
 #else
-    return wstr;
+	for (i = 0; i < count; ++i)
+		private_batch_load_one(&files[i]);
+#endif
+	
+#if defined(WOW_HAVE_IO_URING)
+L_count:
+#endif
+	for (i = 0; i < count; ++i)
+		ok += !files[i].error;
+	
+	return ok;
+}
+
+
+/* wow_writer internals */
+struct wow_writer
+{
+	int fd;
+	int error;
+	char *path;
+	char *tmp;          /* temporary file, renamed to path on commit */
+	unsigned char *buf_alloc;
+	unsigned char *buf; /* aligned within buf_alloc */
+	size_t buf_cap;
+	size_t len;         /* bytes waiting in buf */
+	uint64_t ofs;       /* bytes written so far, buffered or not */
+	struct private_writer_blocks *blocks; /* 0 = not compressing */
+};
+
+/* writes two pieces back to back, resuming after partial writes; *
+ * returns non-zero on failure                                    */
+static
+int
+private_writer_syswrite(
+	struct wow_writer *w
+	, const void *a
+	, size_t a_len
+	, const void *b
+	, size_t b_len
+)
+{
+	long long got;
+	
+	if (w->error)
+		return -1;
+	
+	while (a_len || b_len)
+	{
+#if defined(_WIN32)
+		if (!a_len)
+		{
+			a = b;
+			a_len = b_len;
+			b_len = 0;
+		}
+		got = write(w->fd, a, (a_len > 0x40000000) ? 0x40000000 : a_len);
+#else
+		struct iovec iov[2] = {
+			{ (void*)a, a_len }
+			, { (void*)b, b_len }
+		};
+		
+		/* one syscall for both pieces */
+		if (a_len)
+			got = writev(w->fd, iov, b_len ? 2 : 1);
+		else
+			got = writev(w->fd, iov + 1, 1);
+#endif
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+		{
+			w->error = 1;
+			return -1;
+		}
+		
+		/* advance past what made it out */
+		if ((size_t)got >= a_len)
+		{
+			got -= a_len;
+			a_len = 0;
+			b = (const unsigned char*)b + got;
+			b_len -= got;
+		}
+		else
+		{
+			a = (const unsigned char*)a + got;
+			a_len -= got;
+		}
+	}
+	
+	return 0;
+}
+
+/* wow_writer_write without compression */
+static
+size_t
+private_writer_put(struct wow_writer *w, const void *src, size_t bytes)
+{
+	if (w->error)
+		return 0;
+	
+	/* fits in the buffer */
+	if (bytes <= w->buf_cap - w->len)
+	{
+		memcpy(w->buf + w->len, src, bytes);
+		w->len += bytes;
+		w->ofs += bytes;
+		return bytes;
+	}
+	
+	/* doesn't fit: send the buffer and the new bytes together */
+	if (private_writer_syswrite(w, w->buf, w->len, src, bytes))
+		return 0;
+	w->len = 0;
+	w->ofs += bytes;
+	
+	return bytes;
+}
+
+/* one block of a compressing writer, from the time it's full *
+ * until it has been written out                              */
+struct private_writer_job
+{
+	unsigned char *raw;
+	size_t raw_len;
+	void *packed;       /* 0 if encoding failed */
+	size_t packed_len;
+	int done;
+};
+
+/* block compression state: jobs[n % slots] is block n, for n in *
+ * [written, submitted), and the workers take them in order      */
+struct private_writer_blocks
+{
+	const struct wow_codec *codec;
+	size_t block_size;
+	unsigned char *cur; /* block being filled */
+	size_t cur_len;
+	uint64_t total;     /* decoded bytes in the blocks written */
+	unsigned char *index; /* entries as they go in the file */
+	size_t count;
+	size_t index_cap;
+	struct private_writer_job *jobs;
+	size_t slots;
+	size_t submitted;
+	size_t claimed;
+	size_t written;
+#ifdef WOW_USE_PTHREAD
+	pthread_t *threads;
+	int thread_count;   /* 0 = blocks are encoded in place */
+	int quit;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t finished;
 #endif
+};
+
+#ifdef WOW_USE_PTHREAD
+static
+void *
+private_writer_worker(void *arg)
+{
+	struct private_writer_blocks *b = arg;
+	
+	pthread_mutex_lock(&b->lock);
+	for (;;)
+	{
+		struct private_writer_job *job;
+		
+		while (b->claimed == b->submitted && !b->quit)
+			pthread_cond_wait(&b->work, &b->lock);
+		if (b->claimed == b->submitted)
+			break;
+		job = b->jobs + b->claimed++ % b->slots;
+		pthread_mutex_unlock(&b->lock);
+		
+		job->packed = b->codec->encode(job->raw, job->raw_len, &job->packed_len);
+		
+		pthread_mutex_lock(&b->lock);
+		job->done = 1;
+		pthread_cond_signal(&b->finished);
+	}
+	pthread_mutex_unlock(&b->lock);
+	
+	return 0;
+}
+#endif /* WOW_USE_PTHREAD */
+
+/* writes out the oldest block, first waiting for it if asked to; *
+ * returns 1 if it was written, 0 if it isn't ready, -1 on error  */
+static
+int
+private_writer_block_out(struct wow_writer *w, int wait)
+{
+	struct private_writer_blocks *b = w->blocks;
+	struct private_writer_job *job = b->jobs + b->written % b->slots;
+	unsigned char head[8];
+	
+#ifdef WOW_USE_PTHREAD
+	if (b->thread_count)
+	{
+		int done;
+		
+		pthread_mutex_lock(&b->lock);
+		while (!job->done && wait)
+			pthread_cond_wait(&b->finished, &b->lock);
+		done = job->done;
+		pthread_mutex_unlock(&b->lock);
+		if (!done)
+			return 0;
+	}
+#else
+	(void)wait; /* unused parameter */
+#endif
+	b->written += 1;
+	
+	if (!job->packed || job->packed_len > 0xffffffffu)
+		w->error = 1;
+	else
+	{
+		unsigned char *entry;
+		
+		if (b->count == b->index_cap)
+		{
+			b->index_cap = b->index_cap ? b->index_cap * 2 : 64;
+			b->index = wow_realloc_die(b->index, b->index_cap * 16);
+		}
+		entry = b->index + b->count++ * 16;
+		private_put_be64(entry, w->ofs + sizeof(head));
+		private_put_be64(entry + 8, b->total);
+		
+		private_put_be32(head, job->packed_len);
+		private_put_be32(head + 4, job->raw_len);
+		private_writer_put(w, head, sizeof(head));
+		private_writer_put(w, job->packed, job->packed_len);
+		b->total += job->raw_len;
+	}
+	
+	wow_free(job->raw);
+	wow_free(job->packed);
+	job->raw = 0;
+	job->packed = 0;
+	
+	return w->error ? -1 : 1;
+}
+
+/* hands the block being filled to the workers; returns non-zero *
+ * on failure                                                    */
+static
+int
+private_writer_block_submit(struct wow_writer *w)
+{
+	struct private_writer_blocks *b = w->blocks;
+	struct private_writer_job *job;
+	
+	/* every slot taken: the oldest block has to go out first */
+	if (b->submitted - b->written == b->slots
+		&& private_writer_block_out(w, 1) < 0
+	)
+		return -1;
+	
+	job = b->jobs + b->submitted % b->slots;
+	job->raw = b->cur;
+	job->raw_len = b->cur_len;
+	job->packed = 0;
+	job->done = 0;
+	b->cur = 0;
+	b->cur_len = 0;
+	
+#ifdef WOW_USE_PTHREAD
+	if (b->thread_count)
+	{
+		pthread_mutex_lock(&b->lock);
+		b->submitted += 1;
+		pthread_cond_signal(&b->work);
+		pthread_mutex_unlock(&b->lock);
+		
+		/* whatever is ready goes out now, in order */
+		while (b->written != b->submitted)
+		{
+			int rval = private_writer_block_out(w, 0);
+			
+			if (rval < 0)
+				return -1;
+			if (!rval)
+				break;
+		}
+		return 0;
+	}
+#endif
+	
+	job->packed = b->codec->encode(job->raw, job->raw_len, &job->packed_len);
+	job->done = 1;
+	b->submitted += 1;
+	
+	return private_writer_block_out(w, 1) < 0;
+}
+
+/* wow_writer_write with compression */
+static
+size_t
+private_writer_blocks_write(struct wow_writer *w, const void *src, size_t bytes)
+{
+	struct private_writer_blocks *b = w->blocks;
+	const unsigned char *s = src;
+	size_t left = bytes;
+	
+	while (left)
+	{
+		size_t n = b->block_size - b->cur_len;
+		
+		if (n > left)
+			n = left;
+		if (!b->cur)
+			b->cur = wow_malloc_die(b->block_size);
+		memcpy(b->cur + b->cur_len, s, n);
+		b->cur_len += n;
+		s += n;
+		left -= n;
+		
+		if (b->cur_len == b->block_size && private_writer_block_submit(w))
+			return 0;
+	}
+	
+	return bytes;
 }
 
+/* writes the last blocks, the index and the trailer, then fills  *
+ * in the decoded size in the header; returns non-zero on failure */
+static
+int
+private_writer_blocks_finish(struct wow_writer *w)
+{
+	struct private_writer_blocks *b = w->blocks;
+	unsigned char tail[WOW_BLOCKS_TRAILER];
+	uint64_t index_ofs;
+	
+	if (b->cur_len && private_writer_block_submit(w))
+		return -1;
+	while (b->written != b->submitted)
+		if (private_writer_block_out(w, 1) < 0)
+			return -1;
+	
+	/* an empty block marks the end */
+	memset(tail, 0, 8);
+	private_writer_put(w, tail, 8);
+	
+	index_ofs = w->ofs;
+	if (b->count)
+		private_writer_put(w, b->index, b->count * 16);
+	private_put_be64(tail, index_ofs);
+	private_put_be64(tail + 8, b->count);
+	private_put_be64(tail + 16, b->total);
+	memcpy(tail + 24, "WOWBINDX", 8);
+	private_writer_put(w, tail, sizeof(tail));
+	
+	if (private_writer_syswrite(w, w->buf, w->len, 0, 0))
+		return -1;
+	w->len = 0;
+	
+	private_put_be64(tail, b->total);
+	if (lseek(w->fd, 8, SEEK_SET) != 8 || write(w->fd, tail, 8) != 8)
+		w->error = 1;
+	
+	return w->error;
+}
 
-/* argument abstraction: converts argv[] from wchar to char win32 */
-WOW_API_PREFIX
-void *
-wow_conv_args(int argc, void *argv[])
+/* stops the workers and frees what's left of the blocks */
+static
+void
+private_writer_blocks_free(struct private_writer_blocks *b)
 {
-#if defined(_WIN32) && defined(_UNICODE)
-	int i;
-	for (i = 0; i < argc; ++i)
+	size_t i;
+	
+#ifdef WOW_USE_PTHREAD
+	if (b->thread_count)
 	{
-		//fprintf(stderr, "[%d]: %s\n", i, argv[i]);
-		//fwprintf(stderr, L"[%d]: %s\n", i, (wchar_t*)argv[i]);
-		argv[i] = wow_wchar_to_utf8_inplace(argv[i]);
-		//fwprintf(stderr, L"[%d]: %s\n", i, wow_utf8_to_wchar_die(argv[i]));
+		int k;
+		
+		/* blocks nobody has started on are dropped */
+		pthread_mutex_lock(&b->lock);
+		b->quit = 1;
+		b->submitted = b->claimed;
+		pthread_cond_broadcast(&b->work);
+		pthread_mutex_unlock(&b->lock);
+		for (k = 0; k < b->thread_count; ++k)
+			pthread_join(b->threads[k], 0);
+		pthread_mutex_destroy(&b->lock);
+		pthread_cond_destroy(&b->work);
+		pthread_cond_destroy(&b->finished);
 	}
-#else
-	(void)argc; /* unused parameter */
+	wow_free(b->threads);
 #endif
-	return argv;
+	for (i = 0; i < b->slots; ++i)
+	{
+		wow_free(b->jobs[i].raw);
+		wow_free(b->jobs[i].packed);
+	}
+	wow_free(b->jobs);
+	wow_free(b->cur);
+	wow_free(b->index);
+	wow_free(b);
 }
 
-/* returns non-zero if path is a directory */
+/* frees a writer and everything it owns */
 static
-int
-private_is_dir_root(void const *path)
+void
+private_writer_free(struct wow_writer *w)
 {
-	struct stat s;
-#if defined(_WIN32) && defined(_UNICODE)
-	if (wstat(path, &s) == 0)
+	if (w->blocks)
+		private_writer_blocks_free(w->blocks);
+	wow_free(w->path);
+	wow_free(w->tmp);
+	wow_free(w->buf_alloc);
+	wow_free(w);
+}
+
+
+/* starts writing a file; returns 0 on failure */
+WOW_API_PREFIX
+struct wow_writer *
+wow_writer_open(char const *path, size_t bufsz)
+{
+	struct wow_writer *w;
+	unsigned i;
+	
+	if (!path || wow_is_dir(path))
+		return 0;
+	
+	if (!bufsz)
+		bufsz = 1024 * 1024;
+	
+	w = wow_calloc_die(1, sizeof(*w));
+	w->path = wow_strdup_die(path);
+	w->tmp = wow_malloc_die(strlen(path) + 64);
+	w->buf_cap = bufsz;
+	w->buf = private_io_alloc(bufsz, &w->buf_alloc);
+	
+	/* pick a temporary name nobody else is using */
+	for (i = 0; i < 100; ++i)
+	{
+		sprintf(w->tmp, "%s.%ld.%u.tmp", path, (long)getpid(), i);
+#if defined(_WIN32)
+		w->fd = wow_open(w->tmp, O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0666);
 #else
-	if (stat(path, &s) == 0)
+		w->fd = wow_open(w->tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
 #endif
+		if (w->fd >= 0 || errno != EEXIST)
+			break;
+	}
+	if (w->fd < 0)
 	{
-		if (s.st_mode & S_IFDIR)
-			return 1;
+		private_writer_free(w);
+		return 0;
 	}
 	
-	return 0;
+#if !defined(_WIN32)
+	/* replacing a file keeps its permissions */
+	{
+		struct stat s;
+		if (!stat(path, &s))
+			fchmod(w->fd, s.st_mode & 07777);
+	}
+#endif
+	
+	return w;
 }
 
 
-/* returns non-zero if path is a directory */
+/* writes bytes; returns bytes written, which is less than *
+ * requested only on error (see wow_writer_error)          */
 WOW_API_PREFIX
-int
-wow_is_dir(char const *path)
+size_t
+wow_writer_write(struct wow_writer *w, const void *src, size_t bytes)
 {
-	int rv;
-	void *wpath = 0;
+	if (!w || !src || !bytes || w->error)
+		return 0;
 	
-#if defined(_WIN32) && defined(_UNICODE)
-	wpath = wow_utf8_to_wchar_die(path);
-	rv = private_is_dir_root(wpath);
-#else
-	rv = private_is_dir_root(path);
-#endif
-	if (wpath)
-		free(wpath);
+	if (w->blocks)
+		return private_writer_blocks_write(w, src, bytes);
 	
-	return rv;
+	return private_writer_put(w, src, bytes);
 }
 
 
-/* fread abstraction that falls back to buffer-based fread *
- * if a big fread fails; if that still fails, returns 0    */
+/* switches a writer that hasn't written anything yet to block  *
+ * compression: the data is cut into block_size pieces (0 uses  *
+ * 1 mb), each compressed on its own with codec by one of       *
+ * 'threads' workers (0 = one per processor; without            *
+ * WOW_USE_PTHREAD it's done in place), and the blocks are      *
+ * written out in order, followed by an index of where each one *
+ * starts (see wow_block_index); wow_decoder reads it all back  *
+ * as one stream; returns non-zero if codec can't encode        */
 WOW_API_PREFIX
-size_t
-wow_fread_bytes(void *ptr, size_t bytes, FILE *stream)
+int
+wow_writer_compress(
+	struct wow_writer *w
+	, const struct wow_codec *codec
+	, size_t block_size
+	, int threads
+)
 {
-	if (!stream || !ptr || !bytes)
-		return 0;
+	struct private_writer_blocks *b;
+	unsigned char head[16];
 	
-	unsigned char *ptr8 = ptr;
-	size_t Oofs = ftell(stream);
-	size_t bufsz = 1024 * 1024; /* 1 mb at a time */
-	size_t Obytes = bytes;
-	size_t rem;
+	if (!w || w->ofs || w->blocks || !codec || !codec->encode)
+		return -1;
 	
-	fseek(stream, 0, SEEK_END);
-	rem = ftell(stream) - Oofs;
-	fseek(stream, Oofs, SEEK_SET);
+	if (!block_size)
+		block_size = 1024 * 1024;
+	if ((uint64_t)block_size > 0xffffffffu)
+		return -1;
 	
-	if (bytes > rem)
-		bytes = rem;
+	b = wow_calloc_die(1, sizeof(*b));
+	b->codec = codec;
+	b->block_size = block_size;
+	b->slots = 1;
 	
-	/* everything worked */
-	if ((fread)(ptr, 1, bytes, stream) == bytes)
-		return Obytes;
+#ifdef WOW_USE_PTHREAD
+	if (threads <= 0)
+		threads = private_cpu_count();
 	
-	/* failed: try falling back to slower buffered read */
-	fseek(stream, Oofs, SEEK_SET);
-	while (bytes)
+	/* two blocks per worker keeps them busy while the oldest *
+	 * one waits to be written                                */
+	b->slots = threads * 2;
+	b->threads = wow_malloc_die(threads * sizeof(*b->threads));
+	pthread_mutex_init(&b->lock, 0);
+	pthread_cond_init(&b->work, 0);
+	pthread_cond_init(&b->finished, 0);
+	for (; b->thread_count < threads; ++b->thread_count)
+		if (pthread_create(b->threads + b->thread_count, 0, private_writer_worker, b))
+			break;
+	if (!b->thread_count)
 	{
-		/* don't read past end */
-		if (bytes < bufsz)
-			bufsz = bytes;
-		if (bufsz > rem)
-		{
-			bytes = rem;
-			bufsz = rem;
-		}
-		
-		/* still failed */
-		if ((fread)(ptr8, 1, bufsz, stream) != bufsz)
-			return 0;
-		
-		/* advance */
-		ptr8 += bufsz;
-		bytes -= bufsz;
-		rem -= bufsz;
+		pthread_mutex_destroy(&b->lock);
+		pthread_cond_destroy(&b->work);
+		pthread_cond_destroy(&b->finished);
+		b->slots = 1;
 	}
+#else
+	(void)threads; /* unused parameter */
+#endif
+	b->jobs = wow_calloc_die(b->slots, sizeof(*b->jobs));
 	
-	/* success */
-	return Obytes;
+	/* the decoded size is filled in on commit */
+	memcpy(head, "WOWB", 4);
+	private_put_be32(head + 4, block_size);
+	memset(head + 8, 0, 8);
+	private_writer_put(w, head, sizeof(head));
+	w->blocks = b;
+	
+	return 0;
 }
 
 
-/* fwrite abstraction that falls back to buffer-based fwrite *
- * if a big fwrite fails; if that still fails, returns 0     */
+/* flushes, syncs to disk, and replaces the destination with *
+ * what was written; the writer is freed either way; returns *
+ * non-zero on failure, leaving the destination untouched    */
 WOW_API_PREFIX
-size_t
-wow_fwrite_bytes(const void *ptr, size_t bytes, FILE *stream)
+int
+wow_writer_commit(struct wow_writer *w)
 {
-	if (!stream || !ptr || !bytes)
-		return 0;
+	int rval = -1;
 	
-	const unsigned char *ptr8 = ptr;
-	size_t bufsz = 1024 * 1024; /* 1 mb at a time */
-	size_t Obytes = bytes;
+	if (!w)
+		return -1;
 	
-	/* everything worked */
-	if ((fwrite)(ptr, 1, bytes, stream) == bytes)
-		return bytes;
+	if (w->blocks && private_writer_blocks_finish(w))
+		goto L_cleanup;
 	
-	/* failed: try falling back to slower buffered read */
-	while (bytes)
+	if (private_writer_syswrite(w, w->buf, w->len, 0, 0))
+		goto L_cleanup;
+	w->len = 0;
+	
+#if defined(_WIN32)
+	if (_commit(w->fd))
+		goto L_cleanup;
+	close(w->fd);
+	w->fd = -1;
 	{
-		/* don't read past end */
-		if (bytes < bufsz)
-			bufsz = bytes;
+	#if defined(_UNICODE)
+		struct wow_utf16_buf wtmp;
+		struct wow_utf16_buf wpath;
+		int ok = MoveFileExW(
+			(wchar_t*)wow_utf16_buf_init(&wtmp, w->tmp)
+			, (wchar_t*)wow_utf16_buf_init(&wpath, w->path)
+			, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH
+		);
+		wow_utf16_buf_free(&wtmp);
+		wow_utf16_buf_free(&wpath);
+	#else
+		int ok = MoveFileExA(w->tmp, w->path
+			, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH
+		);
+	#endif
+		if (!ok)
+			goto L_cleanup;
+	}
+#else /* ! _WIN32 */
+	if (fsync(w->fd))
+		goto L_cleanup;
+	close(w->fd);
+	w->fd = -1;
+	if (rename(w->tmp, w->path))
+		goto L_cleanup;
+	
+	/* make the rename itself durable */
+	{
+		char *slash = strrchr(w->path, '/');
+		int dfd;
 		
-		/* still failed */
-		if ((fwrite)(ptr8, 1, bufsz, stream) != bufsz)
-			return 0;
+		if (slash == w->path)
+			dfd = open("/", O_RDONLY);
+		else if (slash)
+		{
+			*slash = '\0';
+			dfd = open(w->path, O_RDONLY);
+			*slash = '/';
+		}
+		else
+			dfd = open(".", O_RDONLY);
 		
-		/* advance */
-		ptr8 += bufsz;
-		bytes -= bufsz;
+		if (dfd >= 0)
+		{
+			fsync(dfd);
+			close(dfd);
+		}
 	}
+#endif
+	rval = 0;
 	
-	/* success */
-	return Obytes;
+L_cleanup:
+	if (w->fd >= 0)
+		close(w->fd);
+	if (rval)
+		wow_remove(w->tmp);
+	private_writer_free(w);
+	return rval;
 }
 
 
-/* fread abstraction that falls back to buffer-based fread *
- * if a big fread fails; if that still fails, returns 0    */
+/* throws away everything written and frees the writer */
 WOW_API_PREFIX
-size_t
-wow_fread(void *ptr, size_t size, size_t nmemb, FILE *stream)
+void
+wow_writer_abort(struct wow_writer *w)
 {
-	if (!stream || !ptr || !size || !nmemb)
-		return 0;
-	
-	if (wow_fread_bytes(ptr, size * nmemb, stream) == size * nmemb)
-		return nmemb;
+	if (!w)
+		return;
 	
-	return 0;
+	close(w->fd);
+	wow_remove(w->tmp);
+	private_writer_free(w);
 }
 
 
-/* fwrite abstraction that falls back to buffer-based fwrite *
- * if a big fwrite fails; if that still fails, returns 0     */
+/* returns non-zero if a write error occurred */
 WOW_API_PREFIX
-size_t
-wow_fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream)
+int
+wow_writer_error(struct wow_writer *w)
 {
-	if (!stream || !ptr || !size || !nmemb)
-		return 0;
-	
-	if (wow_fwrite_bytes(ptr, size * nmemb, stream) == size * nmemb)
-		return nmemb;
+	if (!w)
+		return 1;
 	
-	return 0;
+	return w->error;
 }
 
 
-/* fopen abstraction for utf8 support on windows win32 */
+/* loads the index of a file written by a compressing wow_writer; *
+ * returns count blocks plus one more past the end, whose pos is  *
+ * the decoded size (free with wow_free), or 0 if the file isn't  *
+ * one; a block ends where the next one starts, so ranges can be  *
+ * decoded in parallel, each thread with its own wow_reader       *
+ * skipped to ofs                                                 */
 WOW_API_PREFIX
-FILE *
-wow_fopen(char const *name, char const *mode)
+struct wow_block *
+wow_block_index(char const *path, size_t *count)
 {
-#if defined(_WIN32) && defined(_UNICODE)
-	void *wname = 0;
-	void *wmode = 0;
-	FILE *fp = 0;
+	struct wow_reader *r;
+	struct wow_block *blocks = 0;
+	unsigned char tail[WOW_BLOCKS_TRAILER];
+	unsigned char *index = 0;
+	uint64_t size;
+	uint64_t index_ofs;
+	uint64_t n;
+	uint64_t total;
+	uint64_t i;
 	
-	wname = wow_utf8_to_wchar_die(name);
-	if (!wname)
-		goto L_cleanup;
+	if (!count || !(r = wow_reader_open(path, 0)))
+		return 0;
 	
-	/* TODO eventually, an error message would be cool */
-	if (private_is_dir_root(wname))
+	/* the trailer says where the index is */
+	size = wow_reader_size(r);
+	if (size < 16 + 8 + sizeof(tail)
+		|| wow_reader_skip(r, size - sizeof(tail)) != size - sizeof(tail)
+		|| wow_reader_read(r, tail, sizeof(tail)) != sizeof(tail)
+		|| memcmp(tail + 24, "WOWBINDX", 8)
+	)
+		goto L_cleanup;
+	index_ofs = private_get_be64(tail);
+	n = private_get_be64(tail + 8);
+	total = private_get_be64(tail + 16);
+	if (index_ofs < 16 + 8
+		|| n > (size - sizeof(tail) - index_ofs) / 16
+		|| index_ofs + n * 16 != size - sizeof(tail)
+	)
 		goto L_cleanup;
 	
-	wmode = wow_utf8_to_wchar_die(mode);
-	if (!wmode)
+	/* reading only goes forward */
+	wow_reader_close(r);
+	if (!(r = wow_reader_open(path, 0)))
+		return 0;
+	index = wow_malloc_die(n * 16 + 1);
+	if (wow_reader_skip(r, index_ofs) != index_ofs
+		|| wow_reader_read(r, index, n * 16) != n * 16
+	)
 		goto L_cleanup;
 	
-	fp = _wfopen(wname, wmode);
+	blocks = wow_malloc_die((n + 1) * sizeof(*blocks));
+	for (i = 0; i < n; ++i)
+	{
+		blocks[i].ofs = private_get_be64(index + i * 16);
+		blocks[i].pos = private_get_be64(index + i * 16 + 8);
+		
+		/* in order, and within the file and the data */
+		if (blocks[i].ofs >= index_ofs
+			|| blocks[i].pos > total
+			|| (i && (blocks[i].ofs <= blocks[i - 1].ofs
+				|| blocks[i].pos <= blocks[i - 1].pos)
+			)
+		)
+		{
+			wow_free(blocks);
+			blocks = 0;
+			goto L_cleanup;
+		}
+	}
+	blocks[n].ofs = index_ofs;
+	blocks[n].pos = total;
+	*count = n;
 	
 L_cleanup:
-	if (wname) free(wname);
-	if (wmode) free(wmode);
-	if (fp)
-		return fp;
-	return 0;
-#else
-	/* TODO eventually, an error message would be cool */
-	if (private_is_dir_root(name))
-		return 0;
-	return (fopen)(name, mode);
-#endif
+	wow_free(index);
+	wow_reader_close(r);
+	return blocks;
 }
 
 
@@ -653,9 +7791,11 @@ wow_open(const char *path, int flags, int mode)
 	int fd;
 	
 #if defined(_WIN32) && defined(_UNICODE)
-	void *p = wow_utf8_to_wchar_die(path);
-	fd = _wopen(p, flags, mode);
-	free(p);
+	struct wow_utf16_buf p;
+	fd = -1;
+	if (wow_utf16_buf_init(&p, path))
+		fd = _wopen((wchar_t*)p.str, flags, mode);
+	wow_utf16_buf_free(&p);
 #else
 	fd = open(path, flags, mode);
 #endif
@@ -669,18 +7809,138 @@ int
 wow_remove(char const *path)
 {
 #if defined(_WIN32) && defined(_UNICODE)
-	void *wpath = 0;
+	struct wow_utf16_buf wpath;
 	int rval;
 	
-	wpath = wow_utf8_to_wchar_die(path);
-	if (!wpath)
+	if (!wow_utf16_buf_init(&wpath, path))
+		return -1;
+	
+	rval = _wremove((wchar_t*)wpath.str);
+	wow_utf16_buf_free(&wpath);
+	return rval;
+#else
+	return remove(path);
+#endif
+}
+
+
+/* copies a file, letting the kernel do the work where it can *
+ * (reflink, copy_file_range, sendfile on linux; CopyFile on  *
+ * win32); returns non-zero on failure                        */
+WOW_API_PREFIX
+int
+wow_copy_file(char const *src, char const *dst)
+{
+	if (!src || !dst)
+		return -1;
+	
+#if defined(_WIN32)
+	int ok;
+	
+	/* CopyFile is happy to copy directories; wow_fopen isn't */
+	if (wow_is_dir(src))
+		return -1;
+	
+	#if defined(_UNICODE)
+	struct wow_utf16_buf wsrc;
+	struct wow_utf16_buf wdst;
+	ok = CopyFileW((wchar_t*)wow_utf16_buf_init(&wsrc, src)
+		, (wchar_t*)wow_utf16_buf_init(&wdst, dst), FALSE
+	);
+	wow_utf16_buf_free(&wsrc);
+	wow_utf16_buf_free(&wdst);
+	#else
+	ok = CopyFileA(src, dst, FALSE);
+	#endif
+	
+	return !ok;
+#else /* ! _WIN32 */
+	unsigned char *buf = 0;
+	struct stat s;
+	struct stat d;
+	long long n;
+	long long w;
+	int rval = -1;
+	int in;
+	int out = -1;
+	
+	if ((in = open(src, O_RDONLY | O_CLOEXEC)) < 0)
 		return -1;
 	
-	rval = _wremove(wpath);
-	free(wpath);
+	if (fstat(in, &s) || S_ISDIR(s.st_mode))
+		goto L_cleanup;
+	
+	/* don't truncate until it's certain dst isn't src */
+	if ((out = open(dst, O_WRONLY | O_CREAT | O_CLOEXEC, s.st_mode & 0777)) < 0)
+		goto L_cleanup;
+	if (fstat(out, &d)
+		|| (d.st_dev == s.st_dev && d.st_ino == s.st_ino)
+		|| ftruncate(out, 0)
+	)
+		goto L_cleanup;
+	
+#ifdef __linux__
+	/* kernel-side copies are only tried on files with a known *
+	 * size; anything they leave behind is picked up below     */
+	if (S_ISREG(s.st_mode) && s.st_size > 0)
+	{
+	#ifdef FICLONE
+		/* reflink: shares the blocks on copy-on-write filesystems */
+		if (!ioctl(out, FICLONE, in))
+		{
+			rval = 0;
+			goto L_cleanup;
+		}
+	#endif
+		
+	#ifdef __NR_copy_file_range
+		do
+			n = syscall(__NR_copy_file_range, in, 0, out, 0, 0x40000000, 0);
+		while (n > 0 || (n < 0 && errno == EINTR));
+		
+		if (n < 0)
+	#endif
+		{
+			do
+				n = sendfile(out, in, 0, 0x40000000);
+			while (n > 0 || (n < 0 && errno == EINTR));
+		}
+	}
+#endif
+	
+	/* plain read/write loop, which also finishes the job for *
+	 * files that report a size of 0 but aren't empty (proc)  */
+	buf = wow_malloc_die(1024 * 1024);
+	for (;;)
+	{
+		n = read(in, buf, 1024 * 1024);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			goto L_cleanup;
+		if (!n)
+			break;
+		
+		/* resume after partial writes */
+		for (w = 0; w < n; )
+		{
+			long long got = write(out, buf + w, n - w);
+			if (got < 0 && errno == EINTR)
+				continue;
+			if (got <= 0)
+				goto L_cleanup;
+			w += got;
+		}
+	}
+	rval = 0;
+	
+L_cleanup:
+	if (buf)
+		wow_free(buf);
+	if (out >= 0 && close(out))
+		rval = -1;
+	close(in);
 	return rval;
-#else
-	return remove(path);
 #endif
 }
 
@@ -692,17 +7952,15 @@ wow_mkdir(char const *path)
 {
 #if defined(_WIN32) && defined(_UNICODE)
 extern int _wmkdir(const wchar_t *);
-	void *wname = 0;
+	struct wow_utf16_buf wname;
 	int rval;
 	
-	wname = wow_utf8_to_wchar_die(path);
-	if (!wname)
+	if (!wow_utf16_buf_init(&wname, path))
 		return -1;
 	
-	rval = _wmkdir(wname);
+	rval = _wmkdir((wchar_t*)wname.str);
 	
-	if (wname)
-		free(wname);
+	wow_utf16_buf_free(&wname);
 	
 	return rval;
 #elif defined(_WIN32) /* win32 no unicode */
@@ -721,17 +7979,15 @@ wow_chdir(char const *path)
 {
 #if defined(_WIN32) && defined(_UNICODE)
 extern int _wchdir(const wchar_t *);
-	void *wname = 0;
+	struct wow_utf16_buf wname;
 	int rval;
 	
-	wname = wow_utf8_to_wchar_die(path);
-	if (!wname)
+	if (!wow_utf16_buf_init(&wname, path))
 		return -1;
 	
-	rval = _wchdir(wname);
+	rval = _wchdir((wchar_t*)wname.str);
 	
-	if (wname)
-		free(wname);
+	wow_utf16_buf_free(&wname);
 	
 	return rval;
 #elif defined(_WIN32) /* win32 no unicode */
@@ -762,13 +8018,13 @@ wow_chdir_file(char const *path)
 	slash = (slash1 > slash) ? slash1 : slash;
 	if (!slash) /* already in the same directory */
 	{
-		free(p);
+		wow_free(p);
 		return 0;
 	}
 	*slash = '\0';
 	
 	rval = wow_chdir(p);
-	free(p);
+	wow_free(p);
 	
 	return rval;
 }
@@ -819,17 +8075,15 @@ int
 wow_system(char const *path)
 {
 #if defined(_WIN32) && defined(_UNICODE)
-	void *wname = 0;
+	struct wow_utf16_buf wname;
 	int rval;
 	
-	wname = wow_utf8_to_wchar_die(path);
-	if (!wname)
+	if (!wow_utf16_buf_init(&wname, path))
 		return -1;
 	
-	rval = _wsystem(wname);
+	rval = _wsystem((wchar_t*)wname.str);
 	
-	if (wname)
-		free(wname);
+	wow_utf16_buf_free(&wname);
 	
 	return rval;
 #else /* not win32 unicode */
@@ -838,98 +8092,694 @@ wow_system(char const *path)
 }
 
 
-/* system_gui */
+#if !defined(_WIN32)
+/* splits a command line into argv[1..] by the rules the win32  *
+ * side's ShellExecute param goes through (CommandLineToArgvW): *
+ * blanks separate, "quotes" group, and backslashes are literal *
+ * except in front of a quote; out needs strlen(param) + 1      *
+ * bytes and argv (strlen(param) + 1) / 2 + 2 slots; returns    *
+ * the argument count, argv[0] included                         */
+static
+int
+private_system_gui_split(char *out, char const **argv, const char *param)
+{
+	int argc = 1;
+	int quoted = 0;
+	size_t slashes;
+	
+	for (;;)
+	{
+		while (*param == ' ' || *param == '\t')
+			++param;
+		if (!*param)
+			break;
+		
+		argv[argc++] = out;
+		for (; *param; ++param)
+		{
+			if (!quoted && (*param == ' ' || *param == '\t'))
+				break;
+			
+			if (*param == '\\')
+			{
+				for (slashes = 0; *param == '\\'; ++param)
+					++slashes;
+				
+				/* literal, unless a quote follows */
+				if (*param != '"')
+				{
+					while (slashes--)
+						*out++ = '\\';
+					--param;
+					continue;
+				}
+				
+				/* 2n backslashes + quote -> n + a real quote, *
+				 * 2n + 1 -> n + a literal quote               */
+				for (; slashes > 1; slashes -= 2)
+					*out++ = '\\';
+				if (slashes)
+				{
+					*out++ = '"';
+					continue;
+				}
+			}
+			
+			if (*param != '"')
+				*out++ = *param;
+			else if (quoted && param[1] == '"')
+				*out++ = *++param; /* "" inside quotes */
+			else
+				quoted = !quoted;
+		}
+		*out++ = '\0';
+	}
+	argv[argc] = 0;
+	
+	return argc;
+}
+#endif
+
+/* system_gui */
+WOW_API_PREFIX
+int
+wow_system_gui(char const *name, const char *param)
+{
+#if defined(_WIN32)
+	STARTUPINFOW si;
+	PROCESS_INFORMATION pi;
+
+	ZeroMemory(&si, sizeof(si));
+	si.cb = sizeof(si);
+	ZeroMemory(&pi, sizeof(pi));
+	int rval = 0 /*success */;
+//extern int ShellExecuteA(void *hwnd, void *op, void *file, void *param, void *dir, int cmd);
+//extern int ShellExecuteW(void *hwnd, void *op, void *file, void *param, void *dir, int cmd);
+//const int SW_SHOWNORMAL = 1;
+	#if defined(_UNICODE)
+		struct wow_utf16_buf wname_buf;
+		struct wow_utf16_buf wparam_buf;
+		wchar_t *wname = (wchar_t*)wow_utf16_buf_init(&wname_buf, name);
+		wchar_t *wparam = (wchar_t*)wow_utf16_buf_init(&wparam_buf, param);
+		
+		if (!wname || !wparam)
+		{
+			wow_utf16_buf_free(&wname_buf);
+			wow_utf16_buf_free(&wparam_buf);
+			return -1;
+		}
+		
+#if 0
+		if (CreateProcessW(
+			wname, wparam
+			, NULL, NULL
+			, FALSE
+			, CREATE_NO_WINDOW
+			, NULL
+			, NULL
+			, &si, &pi)
+		)
+		{
+		//WaitForSingleObject(pi.hProcess, INFINITE);
+		//CloseHandle(pi.hProcess);
+		//CloseHandle(pi.hThread);
+		}
+		else
+			rval = 1;
+#else
+		rval = (int)ShellExecuteW(NULL, L"open", wname, wparam, L".", SW_SHOWNORMAL);
+		rval = rval <= 32;
+#endif
+		
+		wow_utf16_buf_free(&wname_buf);
+		wow_utf16_buf_free(&wparam_buf);
+	#else /* win32 non-unicode */
+#if 0
+		if (CreateProcessA(
+			name, x
+			, NULL, NULL
+			, FALSE
+			, CREATE_NO_WINDOW
+			, NULL
+			, NULL
+			, &si, &pi)
+		)
+		{
+		//WaitForSingleObject(pi.hProcess, INFINITE);
+		//CloseHandle(pi.hProcess);
+		//CloseHandle(pi.hThread);
+		}
+		else
+			rval = 1;
+#else
+		rval = (int)ShellExecuteA(NULL, "open", name, param, ".", SW_SHOWNORMAL);
+		rval = rval <= 32;
+#endif
+	#endif
+	return rval;//rval <= 32;
+#else /* not win32 */
+	/* no shell: param is split up here instead */
+	size_t len = param ? strlen(param) : 0;
+	char const **argv = wow_malloc_die(((len + 1) / 2 + 2) * sizeof(*argv));
+	char *args = wow_malloc_die(len + 1);
+	struct wow_spawn sp = { .argv = argv };
+	int rval;
+	
+	argv[0] = name;
+	private_system_gui_split(args, argv, param ? param : "");
+	rval = wow_spawn(&sp);
+	
+	wow_free(args);
+	wow_free(argv);
+	
+	return rval;
+#endif
+}
+
+
+#if defined(_WIN32)
+/* appends arg to cmd, quoted the way CommandLineToArgvW undoes */
+static
+size_t
+private_spawn_quote(char *cmd, const char *arg)
+{
+	size_t n = 0;
+	size_t slashes;
+	
+	cmd[n++] = '"';
+	for (; *arg; ++arg)
+	{
+		for (slashes = 0; *arg == '\\'; ++arg)
+			++slashes;
+		
+		/* backslashes only matter in front of a quote */
+		if (*arg == '"' || !*arg)
+			slashes *= 2;
+		while (slashes--)
+			cmd[n++] = '\\';
+		if (!*arg)
+			break;
+		if (*arg == '"')
+			cmd[n++] = '\\';
+		cmd[n++] = *arg;
+	}
+	cmd[n++] = '"';
+	cmd[n++] = ' ';
+	
+	return n;
+}
+#else /* ! _WIN32 */
+extern char **environ;
+
+/* writes to a pipe whose reader may be gone, without dying of SIGPIPE */
+static
+long
+private_spawn_write(int fd, const void *buf, size_t n)
+{
+	long w;
+#if defined(__APPLE__)
+	fcntl(fd, F_SETNOSIGPIPE, 1);
+	w = write(fd, buf, n);
+#else
+	sigset_t pipe_set;
+	sigset_t pending;
+	sigset_t old;
+	int was_pending;
+	
+	sigemptyset(&pipe_set);
+	sigaddset(&pipe_set, SIGPIPE);
+	#ifdef WOW_USE_PTHREAD
+	pthread_sigmask(SIG_BLOCK, &pipe_set, &old);
+	#else
+	sigprocmask(SIG_BLOCK, &pipe_set, &old);
+	#endif
+	sigpending(&pending);
+	was_pending = sigismember(&pending, SIGPIPE);
+	
+	w = write(fd, buf, n);
+	
+	/* take back the SIGPIPE this write raised */
+	if (w < 0 && errno == EPIPE && !was_pending)
+	{
+		struct timespec zero = { 0, 0 };
+		
+		while (sigtimedwait(&pipe_set, 0, &zero) < 0 && errno == EINTR)
+			;
+		errno = EPIPE;
+	}
+	#ifdef WOW_USE_PTHREAD
+	pthread_sigmask(SIG_SETMASK, &old, 0);
+	#else
+	sigprocmask(SIG_SETMASK, &old, 0);
+	#endif
+#endif
+	return w;
+}
+
+/* reads what's there into a growing 0-terminated buffer; *
+ * returns non-zero once the pipe is done with            */
+static
+int
+private_spawn_drain(int fd, char **buf, size_t *len, size_t *cap)
+{
+	long n;
+	
+	for (;;)
+	{
+		if (*len + 1 >= *cap)
+		{
+			*cap = *cap ? *cap * 2 : 4096;
+			*buf = wow_realloc_die(*buf, *cap);
+		}
+		n = read(fd, *buf + *len, *cap - *len - 1);
+		if (n > 0)
+		{
+			*len += n;
+			(*buf)[*len] = '\0';
+			continue;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		return 1; /* eof or error */
+	}
+}
+
+/* collects the exit status, without blocking unless block is set; *
+ * returns non-zero once the child is reaped                       */
+static
+int
+private_spawn_reap(struct wow_spawn *sp, int block)
+{
+	int status;
+	long r;
+	
+	if (sp->reaped)
+		return 1;
+	
+	while ((r = waitpid(sp->pid, &status, block ? 0 : WNOHANG)) < 0 && errno == EINTR)
+		;
+	if (r == 0)
+		return 0;
+	
+	if (r < 0)
+		sp->status = -1;
+	else if (WIFEXITED(status))
+		sp->status = WEXITSTATUS(status);
+	else if (WIFSIGNALED(status))
+		sp->status = 128 + WTERMSIG(status);
+	else
+		sp->status = -1;
+	sp->reaped = 1;
+	if (sp->pidfd >= 0)
+		close(sp->pidfd);
+	sp->pidfd = -1;
+	
+	return 1;
+}
+
+/* adds the descriptors sp is waiting on to p; returns how many */
+static
+int
+private_spawn_pollfds(struct wow_spawn *sp, struct pollfd *p)
+{
+	int n = 0;
+	int i;
+	
+	for (i = 0; i < 3; ++i)
+	{
+		if (sp->fd[i] < 0)
+			continue;
+		p[n].fd = sp->fd[i];
+		p[n].events = i ? POLLIN : POLLOUT;
+		p[n].revents = 0;
+		++n;
+	}
+	
+	/* the pidfd turns readable when the child exits */
+	if (sp->pidfd >= 0 && !sp->reaped)
+	{
+		p[n].fd = sp->pidfd;
+		p[n].events = POLLIN;
+		p[n].revents = 0;
+		++n;
+	}
+	
+	return n;
+}
+
+/* acts on what poll reported for the descriptors from      *
+ * private_spawn_pollfds; returns non-zero when done; block *
+ * says whether waiting for an exit without a pidfd is ok   */
+static
+int
+private_spawn_service(struct wow_spawn *sp, struct pollfd *p, int n, int block)
+{
+	int i;
+	
+	for (i = 0; i < n; ++i)
+	{
+		int fd = p[i].fd;
+		
+		if (!p[i].revents)
+			continue;
+		
+		if (fd == sp->fd[0])
+		{
+			long w = private_spawn_write(fd
+				, (const char*)sp->input + sp->input_ofs
+				, sp->input_len - sp->input_ofs
+			);
+			
+			if (w > 0)
+				sp->input_ofs += w;
+			if ((w < 0 && errno != EAGAIN && errno != EINTR)
+				|| sp->input_ofs >= sp->input_len
+			)
+			{
+				close(fd);
+				sp->fd[0] = -1;
+			}
+		}
+		else if (fd == sp->fd[1] || fd == sp->fd[2])
+		{
+			int k = (fd == sp->fd[1]) ? 1 : 2;
+			int done = (k == 1)
+				? private_spawn_drain(fd, &sp->output, &sp->output_len, &sp->output_cap)
+				: private_spawn_drain(fd, &sp->errors, &sp->errors_len, &sp->errors_cap)
+			;
+			
+			if (done)
+			{
+				close(fd);
+				sp->fd[k] = -1;
+			}
+		}
+		else if (fd == sp->pidfd)
+			private_spawn_reap(sp, 0);
+	}
+	
+	/* pipes are done; without a pidfd, the child gets waited for here */
+	if (sp->fd[0] < 0 && sp->fd[1] < 0 && sp->fd[2] < 0)
+		return private_spawn_reap(sp, block && sp->pidfd < 0);
+	
+	return 0;
+}
+#endif /* ! _WIN32 */
+
+
+WOW_API_PREFIX
+int
+wow_spawn_start(struct wow_spawn *sp)
+{
+	sp->status = -1;
+	sp->pid = -1;
+	sp->pidfd = -1;
+	sp->fd[0] = sp->fd[1] = sp->fd[2] = -1;
+	sp->input_ofs = 0;
+	sp->reaped = 0;
+	
+	if (!sp->argv || !sp->argv[0])
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	
+#if defined(_WIN32)
+	char *cmd;
+	size_t len = 0;
+	size_t i;
+	long rval;
+	
+	if (sp->io_in || sp->io_out || sp->io_err)
+	{
+		errno = ENOSYS;
+		return -1;
+	}
+	
+	/* worst case, every character is a quote or backslash */
+	for (i = 0; sp->argv[i]; ++i)
+		len += strlen(sp->argv[i]) * 2 + 3;
+	cmd = wow_malloc_die(len + 1);
+	for (len = 0, i = 0; sp->argv[i]; ++i)
+		len += private_spawn_quote(cmd + len, sp->argv[i]);
+	cmd[len - 1] = '\0';
+	
+	#if defined(_UNICODE)
+	{
+		struct wow_utf16_buf wcmd;
+		STARTUPINFOW si = { .cb = sizeof(si) };
+		PROCESS_INFORMATION pi;
+		
+		rval = wow_utf16_buf_init(&wcmd, cmd)
+			&& CreateProcessW(0, (wchar_t*)wcmd.str, 0, 0, FALSE, 0, 0, 0, &si, &pi);
+		wow_utf16_buf_free(&wcmd);
+	#else
+	{
+		STARTUPINFOA si = { .cb = sizeof(si) };
+		PROCESS_INFORMATION pi;
+		
+		rval = CreateProcessA(0, cmd, 0, 0, FALSE, 0, 0, 0, &si, &pi);
+	#endif
+		wow_free(cmd);
+		if (!rval)
+		{
+			errno = ENOENT;
+			return -1;
+		}
+		
+		DWORD code;
+		WaitForSingleObject(pi.hProcess, INFINITE);
+		if (GetExitCodeProcess(pi.hProcess, &code))
+			sp->status = code;
+		CloseHandle(pi.hProcess);
+		CloseHandle(pi.hThread);
+		sp->reaped = 1;
+	}
+	return 0;
+#else /* ! _WIN32 */
+	posix_spawn_file_actions_t fa;
+	enum wow_spawn_io io[3] = { sp->io_in, sp->io_out, sp->io_err };
+	int child[3] = { -1, -1, -1 };
+	pid_t pid;
+	int err = 0;
+	int i;
+	
+	posix_spawn_file_actions_init(&fa);
+	for (i = 0; i < 3 && !err; ++i)
+	{
+		int p[2];
+		
+		if (io[i] == WOW_SPAWN_NULL)
+			err = posix_spawn_file_actions_addopen(&fa, i, "/dev/null"
+				, i ? O_WRONLY : O_RDONLY, 0
+			);
+		
+		else if (io[i] == WOW_SPAWN_PIPE)
+		{
+		#if defined(__linux__)
+			/* pipe2 is only declared with _GNU_SOURCE */
+			if (syscall(SYS_pipe2, p, O_CLOEXEC))
+		#else
+			if (pipe(p))
+		#endif
+			{
+				err = errno;
+				break;
+			}
+		#if !defined(__linux__)
+			fcntl(p[0], F_SETFD, FD_CLOEXEC);
+			fcntl(p[1], F_SETFD, FD_CLOEXEC);
+		#endif
+			/* the child gets the read end of stdin, the write end of the rest */
+			child[i] = i ? p[1] : p[0];
+			sp->fd[i] = i ? p[0] : p[1];
+			fcntl(sp->fd[i], F_SETFL, fcntl(sp->fd[i], F_GETFL) | O_NONBLOCK);
+			err = posix_spawn_file_actions_adddup2(&fa, child[i], i);
+		}
+	}
+	
+	if (!err)
+		err = posix_spawnp(&pid, sp->argv[0], &fa, 0, (char *const*)sp->argv, environ);
+	posix_spawn_file_actions_destroy(&fa);
+	
+	for (i = 0; i < 3; ++i)
+		if (child[i] >= 0)
+			close(child[i]);
+	
+	if (err)
+	{
+		for (i = 0; i < 3; ++i)
+			if (sp->fd[i] >= 0)
+				close(sp->fd[i]);
+		sp->fd[0] = sp->fd[1] = sp->fd[2] = -1;
+		errno = err;
+		return -1;
+	}
+	sp->pid = pid;
+	
+	/* nothing to feed */
+	if (sp->fd[0] >= 0 && !sp->input_len)
+	{
+		close(sp->fd[0]);
+		sp->fd[0] = -1;
+	}
+	
+	#if defined(__linux__) && defined(SYS_pidfd_open)
+	sp->pidfd = syscall(SYS_pidfd_open, pid, 0);
+	if (sp->pidfd >= 0)
+		fcntl(sp->pidfd, F_SETFD, FD_CLOEXEC);
+	#endif
+	
+	return 0;
+#endif
+}
+
+
+WOW_API_PREFIX
+int
+wow_spawn_wait(struct wow_spawn *sp)
+{
+#if defined(_WIN32)
+	return sp->status;
+#else
+	struct pollfd p[4];
+	int n;
+	
+	if (sp->pid < 0)
+		return -1;
+	
+	for (;;)
+	{
+		if (private_spawn_service(sp, p, 0, 1))
+			break;
+		n = private_spawn_pollfds(sp, p);
+		if (poll(p, n, -1) < 0 && errno != EINTR)
+			break;
+		if (private_spawn_service(sp, p, n, 1))
+			break;
+	}
+	
+	return sp->status;
+#endif
+}
+
+
+WOW_API_PREFIX
+int
+wow_spawn(struct wow_spawn *sp)
+{
+	if (wow_spawn_start(sp))
+		return -1;
+	
+	return wow_spawn_wait(sp);
+}
+
+
 WOW_API_PREFIX
-int
-wow_system_gui(char const *name, const char *param)
+void
+wow_spawn_free(struct wow_spawn *sp)
 {
-#if defined(_WIN32)
-	STARTUPINFOW si;
-	PROCESS_INFORMATION pi;
+	wow_free(sp->output);
+	wow_free(sp->errors);
+	sp->output = 0;
+	sp->errors = 0;
+	sp->output_len = sp->output_cap = 0;
+	sp->errors_len = sp->errors_cap = 0;
+}
 
-	ZeroMemory(&si, sizeof(si));
-	si.cb = sizeof(si);
-	ZeroMemory(&pi, sizeof(pi));
-	int rval = 0 /*success */;
-//extern int ShellExecuteA(void *hwnd, void *op, void *file, void *param, void *dir, int cmd);
-//extern int ShellExecuteW(void *hwnd, void *op, void *file, void *param, void *dir, int cmd);
-//const int SW_SHOWNORMAL = 1;
-	#if defined(_UNICODE)
-		void *wname = 0;
-		void *wparam = 0;
+
+WOW_API_PREFIX
+size_t
+wow_run_batch(struct wow_spawn *cmds, size_t count, int max_parallel)
+{
+	size_t failed = 0;
+	size_t i;
+	
+	if (max_parallel <= 0)
+		max_parallel = private_cpu_count();
+	if ((size_t)max_parallel > count)
+		max_parallel = count;
+	
+#if defined(_WIN32)
+	/* wow_spawn_start waits on win32, so these run one at a time */
+	for (i = 0; i < count; ++i)
+		if (wow_spawn(&cmds[i]))
+			failed += 1;
+#else
+	/* per running slot: which command, and where its pollfds are */
+	struct private_batch_slot
+	{
+		struct wow_spawn *sp;
+		int first;
+		int n;
+	} *slot;
+	struct pollfd *p;
+	int running = 0;
+	int k;
+	
+	if (!count)
+		return 0;
+	
+	slot = wow_malloc_die(max_parallel * sizeof(*slot));
+	p = wow_malloc_die(max_parallel * 4 * sizeof(*p));
+	
+	for (i = 0; i < count || running; )
+	{
+		int np = 0;
+		int timeout = -1;
 		
-		wname = wow_utf8_to_wchar_die(name);
-		if (!wname)
-		{
-			return -1;
-		}
-		wparam = wow_utf8_to_wchar_die(param);
-		if (!wparam)
+		/* keep max_parallel going */
+		while (running < max_parallel && i < count)
 		{
-			free(wname);
-			return -1;
+			struct wow_spawn *sp = &cmds[i++];
+			
+			if (wow_spawn_start(sp))
+				failed += 1;
+			else
+				slot[running++].sp = sp;
 		}
+		if (!running)
+			break;
 		
-#if 0
-		if (CreateProcessW(
-			wname, wparam
-			, NULL, NULL
-			, FALSE
-			, CREATE_NO_WINDOW
-			, NULL
-			, NULL
-			, &si, &pi)
-		)
+		for (k = 0; k < running; ++k)
 		{
-		//WaitForSingleObject(pi.hProcess, INFINITE);
-		//CloseHandle(pi.hProcess);
-		//CloseHandle(pi.hThread);
+			slot[k].first = np;
+			slot[k].n = private_spawn_pollfds(slot[k].sp, p + np);
+			np += slot[k].n;
+			
+			/* no pipes and no pidfd: check for the exit now and then */
+			if (!slot[k].n)
+				timeout = 10;
 		}
-		else
-			rval = 1;
-#else
-		rval = (int)ShellExecuteW(NULL, L"open", wname, wparam, L".", SW_SHOWNORMAL);
-		rval = rval <= 32;
-#endif
 		
-		free(wname);
-		free(wparam);
-	#else /* win32 non-unicode */
-#if 0
-		if (CreateProcessA(
-			name, x
-			, NULL, NULL
-			, FALSE
-			, CREATE_NO_WINDOW
-			, NULL
-			, NULL
-			, &si, &pi)
-		)
+		/* on failure (EINTR), the next round polls again */
+		if (poll(p, np, timeout) < 0)
+			for (k = 0; k < np; ++k)
+				p[k].revents = 0;
+		
+		for (k = 0; k < running; )
 		{
-		//WaitForSingleObject(pi.hProcess, INFINITE);
-		//CloseHandle(pi.hProcess);
-		//CloseHandle(pi.hThread);
+			struct wow_spawn *sp = slot[k].sp;
+			
+			if (!private_spawn_service(sp, p + slot[k].first, slot[k].n, 0))
+			{
+				++k;
+				continue;
+			}
+			
+			if (sp->status)
+				failed += 1;
+			slot[k] = slot[--running];
 		}
-		else
-			rval = 1;
-#else
-		rval = (int)ShellExecuteA(NULL, "open", name, param, ".", SW_SHOWNORMAL);
-		rval = rval <= 32;
-#endif
-	#endif
-	return rval;//rval <= 32;
-#else /* not win32 unicode */
-	char *x = wow_malloc_die(strlen(name) + strlen(param) + 128);
-	if (!x)
-		return -1;
-	strcpy(x, "\"");
-	strcat(x, name);
-	strcat(x, "\" ");
-	strcat(x, param);
-	int rval = system(x);
-	free(x);
-	return rval;
+	}
+	
+	wow_free(slot);
+	wow_free(p);
 #endif
+	
+	return failed;
 }
 
 
@@ -974,22 +8824,6 @@ wow_windowicon(int iconId)
 #endif
 }
 
-/* add extension to filename */
-static int __wow_fnAddExtension(char **str, const char *ext)
-{
-	int len;
-	
-	len = strlen(*str);
-	*str = realloc(*str, len + strlen(ext) + 16);
-	/* memory error */
-	if (!*str)
-		return 1;
-	strcat(*str, ".");
-	strcat(*str, ext);
-	
-	return 0;
-}
-
 WOW_API_PREFIX
 int
 wow_strcasecmp(char *str, const char *ext)
@@ -1000,26 +8834,76 @@ wow_strcasecmp(char *str, const char *ext)
 	return strcasecmp(str, ext);
 }
 
+/* returns the offset of the last component of str */
+static
+size_t
+private_path_name(const char *str, size_t len)
+{
+	while (len && str[len - 1] != '/' && str[len - 1] != '\\')
+		--len;
+	
+	return len;
+}
+
+/* returns len less any trailing separators, but keeps a root */
+static
+size_t
+private_path_trim(const char *str, size_t len)
+{
+	while (len > 1 && (str[len - 1] == '/' || str[len - 1] == '\\'))
+		--len;
+	
+	return len;
+}
+
+/* returns the offset of the extension's '.' in str, or len */
+static
+size_t
+private_path_ext(const char *str, size_t len)
+{
+	size_t i = len;
+	
+	while (i && str[i - 1] != '/' && str[i - 1] != '\\')
+		if (str[--i] == '.')
+			return i;
+	
+	return len;
+}
+
 WOW_API_PREFIX
 char *
 wow_fnHasExtension(char *str)
 {
-	char *slash = strrchr(str, '\\');
-	
-	if (!slash)
-		slash = strrchr(str, '/');
-	if (!slash)
-		slash = str;
-	else
-		slash += 1;
-	
-	char *pd = strrchr(str, '.');
+	size_t len = strlen(str);
+	size_t dot = private_path_ext(str, len);
 	
 	/* no period, or period occurs before actual name */
-	if (!pd || pd < slash)
+	if (dot == len)
 		return 0;
 	
-	return pd + 1;
+	return str + dot + 1;
+}
+
+/* puts ".ext" at str[at], growing str as needed */
+static
+int
+private_fn_put_extension(char **str, size_t at, size_t cap, const char *ext)
+{
+	size_t ext_len = strlen(ext);
+	
+	if (at + 1 + ext_len + 1 > cap)
+	{
+		char *grown = realloc(*str, at + 1 + ext_len + 1);
+		
+		/* memory error */
+		if (!grown)
+			return 1;
+		*str = grown;
+	}
+	(*str)[at] = '.';
+	memcpy(*str + at + 1, ext, ext_len + 1);
+	
+	return 0;
 }
 
 /* forces string to end in extension (returns non-zero on memory failure) */
@@ -1027,33 +8911,272 @@ WOW_API_PREFIX
 int
 wow_fnChangeExtension(char **str, const char *ext)
 {
-	char *has;
-	int len;
+	size_t len = strlen(*str);
+	size_t dot = private_path_ext(*str, len);
+	
+	/* the existing extension (if any) is overwritten in place *
+	 * when it's big enough, so no realloc happens then        */
+	return private_fn_put_extension(str, dot, len + 1, ext);
+}
+
+/* appends extension unless string already ends in it */
+WOW_API_PREFIX
+int
+wow_fnForceExtension(char **str, const char *ext)
+{
+	size_t len = strlen(*str);
+	size_t dot = private_path_ext(*str, len);
 	
-	/* has no extension, so append one */
-	has = wow_fnHasExtension(*str);
-	if (!has)
-		return __wow_fnAddExtension(str, ext);
+	/* is already desirable extension */
+	if (dot < len && !strcasecmp(*str + dot + 1, ext))
+		return 0;
 	
-	/* existing extension is big enough */
-	if (strlen(has) >= strlen(ext))
-	{
-		strcpy(has, ext);
+	return private_fn_put_extension(str, len, len + 1, ext);
+}
+
+/* returns where str is in path->str, or SIZE_MAX if it's not in *
+ * there, so it can be found again after path->str is realloc'd  */
+static
+size_t
+private_path_alias(const struct wow_path *path, const char *str)
+{
+	uintptr_t ofs = (uintptr_t)str - (uintptr_t)path->str;
+	
+	return (ofs < path->cap) ? ofs : SIZE_MAX;
+}
+
+/* makes room for len bytes plus the terminator */
+static
+int
+private_path_reserve(struct wow_path *path, size_t len)
+{
+	size_t cap = path->cap;
+	char *str;
+	
+	if (len < cap)
 		return 0;
+	
+	while (cap <= len)
+		cap *= 2;
+	
+	if (path->str == path->stack)
+	{
+		if (!(str = malloc(cap)))
+			return 1;
+		memcpy(str, path->str, path->len + 1);
+	}
+	else if (!(str = realloc(path->str, cap)))
+		return 1;
+	
+	path->str = str;
+	path->cap = cap;
+	
+	return 0;
+}
+
+WOW_API_PREFIX
+int
+wow_path_init(struct wow_path *path, const char *str)
+{
+	path->str = path->stack;
+	path->cap = sizeof(path->stack);
+	path->len = 0;
+	path->str[0] = '\0';
+	
+	return str ? wow_path_append(path, str) : 0;
+}
+
+WOW_API_PREFIX
+void
+wow_path_free(struct wow_path *path)
+{
+	if (path->str != path->stack)
+		free(path->str);
+	path->str = path->stack;
+	path->cap = sizeof(path->stack);
+	path->len = 0;
+	path->str[0] = '\0';
+}
+
+WOW_API_PREFIX
+char *
+wow_path_detach(struct wow_path *path)
+{
+	char *str = path->str;
+	
+	if (str == path->stack)
+	{
+		if (!(str = malloc(path->len + 1)))
+			return 0;
+		memcpy(str, path->str, path->len + 1);
 	}
 	
-	len = strlen(*str);
-	*str = realloc(*str, len + strlen(ext) + 16);
-	/* memory error */
-	if (!*str)
+	path->str = path->stack;
+	wow_path_free(path);
+	
+	return str;
+}
+
+WOW_API_PREFIX
+int
+wow_path_set(struct wow_path *path, const char *str)
+{
+	size_t n = strlen(str);
+	
+	if (private_path_reserve(path, n))
+		return 1;
+	
+	memmove(path->str, str, n + 1);
+	path->len = n;
+	
+	return 0;
+}
+
+WOW_API_PREFIX
+int
+wow_path_append_n(struct wow_path *path, const char *str, size_t n)
+{
+	size_t alias = private_path_alias(path, str);
+	
+	if (private_path_reserve(path, path->len + n))
+		return 1;
+	
+	if (alias != SIZE_MAX)
+		str = path->str + alias;
+	memmove(path->str + path->len, str, n);
+	path->len += n;
+	path->str[path->len] = '\0';
+	
+	return 0;
+}
+
+WOW_API_PREFIX
+int
+wow_path_append(struct wow_path *path, const char *str)
+{
+	return wow_path_append_n(path, str, strlen(str));
+}
+
+WOW_API_PREFIX
+int
+wow_path_join(struct wow_path *path, const char *name)
+{
+	size_t n = strlen(name);
+	size_t len = path->len;
+	int sep = len && path->str[len - 1] != '/' && path->str[len - 1] != '\\';
+	size_t alias = private_path_alias(path, name);
+	
+	if (private_path_reserve(path, len + sep + n))
+		return 1;
+	
+	if (alias != SIZE_MAX)
+		name = path->str + alias;
+	memmove(path->str + len + sep, name, n);
+	if (sep)
+		path->str[len] = '/';
+	path->len = len + sep + n;
+	path->str[path->len] = '\0';
+	
+	return 0;
+}
+
+WOW_API_PREFIX
+void
+wow_path_truncate(struct wow_path *path, size_t len)
+{
+	if (len >= path->len)
+		return;
+	
+	path->len = len;
+	path->str[len] = '\0';
+}
+
+WOW_API_PREFIX
+char *
+wow_path_extension(const struct wow_path *path)
+{
+	size_t dot = private_path_ext(path->str, path->len);
+	
+	if (dot == path->len)
+		return 0;
+	
+	return path->str + dot + 1;
+}
+
+WOW_API_PREFIX
+int
+wow_path_replace_extension(struct wow_path *path, const char *ext)
+{
+	size_t dot = private_path_ext(path->str, path->len);
+	size_t n;
+	
+	if (*ext == '.')
+		++ext;
+	n = strlen(ext);
+	
+	if (private_path_reserve(path, dot + 1 + n))
+		return 1;
+	
+	path->str[dot] = '.';
+	memcpy(path->str + dot + 1, ext, n + 1);
+	path->len = dot + 1 + n;
+	
+	return 0;
+}
+
+WOW_API_PREFIX
+int
+wow_path_force_extension(struct wow_path *path, const char *ext)
+{
+	size_t dot = private_path_ext(path->str, path->len);
+	size_t n;
+	
+	if (*ext == '.')
+		++ext;
+	
+	/* is already desirable extension */
+	if (dot < path->len && !strcasecmp(path->str + dot + 1, ext))
+		return 0;
+	
+	n = strlen(ext);
+	if (private_path_reserve(path, path->len + 1 + n))
 		return 1;
-	*has = 0;
-	strcat(*str, ".");
-	strcat(*str, ext);
+	
+	path->str[path->len] = '.';
+	memcpy(path->str + path->len + 1, ext, n + 1);
+	path->len += 1 + n;
 	
 	return 0;
 }
 
+WOW_API_PREFIX
+void
+wow_path_dirname(struct wow_path *path)
+{
+	size_t len = private_path_trim(path->str, path->len);
+	
+	/* drop the name, then the separator(s) before it */
+	len = private_path_trim(path->str, private_path_name(path->str, len));
+	
+	wow_path_truncate(path, len);
+}
+
+WOW_API_PREFIX
+void
+wow_path_basename(struct wow_path *path)
+{
+	size_t len = private_path_trim(path->str, path->len);
+	size_t name = private_path_name(path->str, len);
+	
+	/* a root is its own name */
+	if (name == len)
+		name = 0;
+	
+	path->len = len - name;
+	memmove(path->str, path->str + name, path->len);
+	path->str[path->len] = '\0';
+}
+
 #endif /* WOW_IMPLEMENTATION */
 
 #ifdef WOW_OVERLOAD_FILE
@@ -1063,7 +9186,12 @@ wow_fnChangeExtension(char **str, const char *ext)
  #define  remove      wow_remove
 #endif
 
-#ifdef WOW_OVERLOAD_ALLOCATORS
+#if defined(WOW_OVERLOAD_ALLOCATORS) && defined(WOW_TRACK_ALLOCATIONS)
+ #define  malloc(SIZE)       wow_track_malloc(SIZE, __FILE__, __LINE__)
+ #define  calloc(NMEMB, SIZE) wow_track_calloc(NMEMB, SIZE, __FILE__, __LINE__)
+ #define  realloc(PTR, SIZE) wow_track_realloc(PTR, SIZE, __FILE__, __LINE__)
+ #define  free        wow_track_free
+#elif defined(WOW_OVERLOAD_ALLOCATORS)
  #define  malloc      wow_malloc_die
  #define  calloc      wow_calloc_die
  #define  realloc     wow_realloc_die
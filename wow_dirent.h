@@ -5,6 +5,11 @@
  * 
  * XXX: must be #include'd after dirent.h
  * 
+ * also has wow_walk, a recursive directory walker, and wow_dircache,
+ * for listing the same directories over and over; their code is
+ * emitted in the compilation unit that defines WOW_IMPLEMENTATION,
+ * so #include this file there as well
+ * 
  * z64me <z64.me>
  * 
  */
@@ -24,13 +29,13 @@ static
 wow_DIR *
 wow_opendir(const char *path)
 {
-	void *wpath = wow_utf8_to_wchar_die(path);
-	if (!wpath)
+	struct wow_utf16_buf wpath;
+	if (!wow_utf16_buf_init(&wpath, path))
 		return NULL;
 	
-	wow_DIR *rv = _wopendir(wpath);
+	wow_DIR *rv = _wopendir((wchar_t*)wpath.str);
 	
-	free(wpath);
+	wow_utf16_buf_free(&wpath);
 	
 	return rv;
 }
@@ -62,6 +67,1223 @@ wow_readdir(wow_DIR *dir)
 #  define  wow_dirent_dname(X)  ((char*)(X)->d_name)
 #endif
 
+
+/* recursive directory walking */
+
+/* entry types reported by wow_walk */
+enum wow_walk_type
+{
+	WOW_WALK_FILE = 0
+	, WOW_WALK_DIR
+	, WOW_WALK_LINK   /* symbolic links are reported, never followed */
+	, WOW_WALK_OTHER
+	, WOW_WALK_ERROR  /* a directory that couldn't be read; see error */
+};
+
+/* what a wow_walk callback wants to happen next */
+enum wow_walk_action
+{
+	WOW_WALK_CONTINUE = 0
+	, WOW_WALK_PRUNE  /* don't descend into this directory */
+	, WOW_WALK_STOP   /* stop walking altogether */
+};
+
+/* an entry found by wow_walk; only valid during the callback */
+struct wow_walk_entry
+{
+	const char *path;  /* root joined with every name down to this one */
+	const char *name;  /* points into path */
+	enum wow_walk_type type;
+	int depth;         /* 0 for entries directly inside root */
+	int error;         /* errno value for WOW_WALK_ERROR, otherwise 0 */
+};
+
+typedef enum wow_walk_action (*wow_walk_func)(
+	const struct wow_walk_entry *entry
+	, void *udata
+);
+
+
+/* calls func for everything inside root, recursively; entry *
+ * types come from readdir where possible, so there is no    *
+ * stat per entry; with WOW_USE_PTHREAD, subdirectories are  *
+ * shared between 'threads' threads (0 = one per processor), *
+ * in which case func is called from all of them at once;    *
+ * a directory that can't be opened or read is reported to   *
+ * func again as WOW_WALK_ERROR; returns 0 when done, 1 if   *
+ * stopped, 2 if done but some directories were unreadable,  *
+ * -1 if root can't be opened                                *
+ * NOTE: like wow.h, the implementation is emitted where     *
+ *       WOW_IMPLEMENTATION is defined                       */
+WOW_API_PREFIX
+int
+wow_walk(char const *root, int threads, wow_walk_func func, void *udata);
+
+
+#ifdef WOW_IMPLEMENTATION
+
+#if !defined(_WIN32)
+ #include <dirent.h>
+#endif
+
+#if defined(_WIN32)
+
+/* win32: a plain recursive walk on top of wow_opendir */
+static
+int
+private_walk_win32(
+	char *path
+	, size_t path_len
+	, size_t name_ofs
+	, int depth
+	, wow_walk_func func
+	, void *udata
+	, int *errors
+)
+{
+	struct wow_walk_entry entry;
+	struct wow_dirent *ep;
+	enum wow_walk_action act;
+	wow_DIR *dir;
+	int rval = 0;
+	
+	if (!(dir = wow_opendir(path)))
+	{
+		if (depth == 0)
+			return -1;
+		
+		/* reported, and the walk goes on */
+		entry.path = path;
+		entry.name = path + name_ofs;
+		entry.type = WOW_WALK_ERROR;
+		entry.depth = depth - 1;
+		entry.error = errno ? errno : EACCES;
+		*errors += 1;
+		return (func(&entry, udata) == WOW_WALK_STOP);
+	}
+	
+	while (!rval && (ep = wow_readdir(dir)))
+	{
+		char *name = wow_dirent_dname(ep);
+		size_t len = strlen(name);
+		size_t at = path_len;
+		char *child;
+		
+		if (!strcmp(name, ".") || !strcmp(name, ".."))
+			continue;
+		
+		child = wow_malloc_die(path_len + len + 2);
+		memcpy(child, path, path_len);
+		if (at && path[at - 1] != '/' && path[at - 1] != '\\')
+			child[at++] = '/';
+		memcpy(child + at, name, len + 1);
+		
+		entry.path = child;
+		entry.name = child + at;
+		entry.type = wow_is_dir(child) ? WOW_WALK_DIR : WOW_WALK_FILE;
+		entry.depth = depth;
+		entry.error = 0;
+		act = func(&entry, udata);
+		
+		if (act == WOW_WALK_STOP)
+			rval = 1;
+		else if (entry.type == WOW_WALK_DIR && act != WOW_WALK_PRUNE)
+			rval = private_walk_win32(child, at + len, at, depth + 1, func, udata, errors);
+		
+		wow_free(child);
+	}
+	wow_closedir(dir);
+	
+	return rval;
+}
+
+#else /* ! _WIN32 */
+
+/* an open directory, kept open while children are being opened *
+ * relative to it; closed when the last reference goes away    */
+struct private_walk_node
+{
+	DIR *dir;
+	int refs;
+};
+
+/* a directory waiting to be read */
+struct private_walk_item
+{
+	struct private_walk_node *parent; /* 0 for the root */
+	char *path;
+	size_t name_ofs;                  /* name is path + name_ofs */
+	int depth;
+};
+
+/* per-thread work: the owner pushes and pops at the tail, *
+ * idle threads steal the oldest items from the head       */
+struct private_walk_queue
+{
+#ifdef WOW_USE_PTHREAD
+	pthread_mutex_t lock;
+#endif
+	struct private_walk_item **items;
+	size_t head;
+	size_t tail;
+	size_t cap;
+};
+
+struct private_walk
+{
+	wow_walk_func func;
+	void *udata;
+	struct private_walk_queue *queues;
+	int nqueues;
+	long pending;  /* items queued or being read */
+	int stop;
+	int errors;    /* directories that couldn't be read */
+#ifdef WOW_USE_PTHREAD
+	pthread_mutex_t idle_lock;
+	pthread_cond_t idle_cond;
+	long generation; /* bumped on every push, so sleepers don't miss work */
+	int sleepers;
+#endif
+};
+
+/* per-thread state */
+struct private_walk_worker
+{
+	struct private_walk *walk;
+	int index;
+	char *path;     /* scratch path buffer */
+	size_t path_cap;
+};
+
+static
+void
+private_walk_lock(struct private_walk_queue *q)
+{
+#ifdef WOW_USE_PTHREAD
+	pthread_mutex_lock(&q->lock);
+#else
+	(void)q; /* unused parameter */
+#endif
+}
+
+static
+void
+private_walk_unlock(struct private_walk_queue *q)
+{
+#ifdef WOW_USE_PTHREAD
+	pthread_mutex_unlock(&q->lock);
+#else
+	(void)q; /* unused parameter */
+#endif
+}
+
+static
+void
+private_walk_release(struct private_walk_node *node)
+{
+	if (node && !__atomic_sub_fetch(&node->refs, 1, __ATOMIC_ACQ_REL))
+	{
+		closedir(node->dir);
+		wow_free(node);
+	}
+}
+
+static
+void
+private_walk_push(struct private_walk *walk, int index, struct private_walk_item *item)
+{
+	struct private_walk_queue *q = &walk->queues[index];
+	
+	__atomic_add_fetch(&walk->pending, 1, __ATOMIC_SEQ_CST);
+	
+	private_walk_lock(q);
+	if (q->tail == q->cap)
+	{
+		/* slide down before growing */
+		if (q->head)
+		{
+			memmove(q->items, q->items + q->head
+				, (q->tail - q->head) * sizeof(*q->items)
+			);
+			q->tail -= q->head;
+			q->head = 0;
+		}
+		if (q->tail == q->cap)
+		{
+			q->cap = q->cap ? q->cap * 2 : 64;
+			q->items = wow_realloc_die(q->items, q->cap * sizeof(*q->items));
+		}
+	}
+	q->items[q->tail++] = item;
+	private_walk_unlock(q);
+	
+#ifdef WOW_USE_PTHREAD
+	__atomic_add_fetch(&walk->generation, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&walk->sleepers, __ATOMIC_SEQ_CST))
+	{
+		pthread_mutex_lock(&walk->idle_lock);
+		pthread_cond_signal(&walk->idle_cond);
+		pthread_mutex_unlock(&walk->idle_lock);
+	}
+#endif
+}
+
+/* takes the newest item of this thread's queue, or else *
+ * the oldest item of another thread's queue             */
+static
+struct private_walk_item *
+private_walk_pop(struct private_walk *walk, int index)
+{
+	struct private_walk_item *item = 0;
+	struct private_walk_queue *q = &walk->queues[index];
+	int i;
+	
+	private_walk_lock(q);
+	if (q->tail > q->head)
+		item = q->items[--q->tail];
+	private_walk_unlock(q);
+	
+	for (i = 1; !item && i < walk->nqueues; ++i)
+	{
+		q = &walk->queues[(index + i) % walk->nqueues];
+		private_walk_lock(q);
+		if (q->tail > q->head)
+			item = q->items[q->head++];
+		private_walk_unlock(q);
+	}
+	
+	return item;
+}
+
+static
+void
+private_walk_free_item(struct private_walk_item *item)
+{
+	private_walk_release(item->parent);
+	wow_free(item->path);
+	wow_free(item);
+}
+
+/* reports a directory that couldn't be read */
+static
+void
+private_walk_error(struct private_walk *walk, struct private_walk_item *item, int error)
+{
+	struct wow_walk_entry entry;
+	
+	entry.path = item->path;
+	entry.name = item->path + item->name_ofs;
+	entry.type = WOW_WALK_ERROR;
+	entry.depth = item->depth - 1;
+	entry.error = error;
+	
+	__atomic_add_fetch(&walk->errors, 1, __ATOMIC_RELAXED);
+	if (walk->func(&entry, walk->udata) == WOW_WALK_STOP)
+		__atomic_store_n(&walk->stop, 1, __ATOMIC_RELAXED);
+}
+
+/* reads one directory, reporting its entries and queueing its subdirectories */
+static
+void
+private_walk_read(struct private_walk_worker *wk, struct private_walk_item *item)
+{
+	struct private_walk *walk = wk->walk;
+	struct private_walk_node *node;
+	struct wow_walk_entry entry;
+	struct dirent *ep;
+	size_t path_len = strlen(item->path);
+	int tries;
+	int fd;
+	
+	for (tries = 0; ; ++tries)
+	{
+		struct timespec ts;
+		
+		if (item->parent)
+			fd = openat(dirfd(item->parent->dir), item->path + item->name_ofs
+				, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW
+			);
+		else
+			fd = open(item->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		
+		if (fd >= 0 || (errno != EMFILE && errno != ENFILE) || tries == 8)
+			break;
+		
+		/* out of descriptors: back off while other threads *
+		 * (or the rest of the program) close some          */
+		ts.tv_sec = 0;
+		ts.tv_nsec = 1000000L << tries;
+		nanosleep(&ts, 0);
+	}
+	
+	/* the parent doesn't need to stay open for this one anymore */
+	private_walk_release(item->parent);
+	item->parent = 0;
+	
+	if (fd < 0)
+	{
+		private_walk_error(walk, item, errno);
+		return;
+	}
+	
+	node = wow_malloc_die(sizeof(*node));
+	node->refs = 1;
+	if (!(node->dir = fdopendir(fd)))
+	{
+		private_walk_error(walk, item, errno);
+		close(fd);
+		wow_free(node);
+		return;
+	}
+	
+	/* scratch path: item path, a separator, and the entry name */
+	if (path_len && item->path[path_len - 1] == '/')
+		path_len -= 1;
+	
+	while (!__atomic_load_n(&walk->stop, __ATOMIC_RELAXED))
+	{
+		const char *name;
+		size_t name_len;
+		enum wow_walk_action act;
+		
+		/* the end, or readdir gave up partway */
+		errno = 0;
+		if (!(ep = readdir(node->dir)))
+		{
+			if (errno)
+				private_walk_error(walk, item, errno);
+			break;
+		}
+		
+		name = ep->d_name;
+		if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2])))
+			continue;
+		
+		name_len = strlen(name);
+		if (path_len + name_len + 2 > wk->path_cap)
+		{
+			wk->path_cap = (path_len + name_len + 2) * 2;
+			wk->path = wow_realloc_die(wk->path, wk->path_cap);
+		}
+		memcpy(wk->path, item->path, path_len);
+		wk->path[path_len] = '/';
+		memcpy(wk->path + path_len + 1, name, name_len + 1);
+		
+		entry.path = wk->path;
+		entry.name = wk->path + path_len + 1;
+		entry.depth = item->depth;
+		entry.error = 0;
+		entry.type = WOW_WALK_OTHER;
+#if defined(DT_UNKNOWN)
+		switch (ep->d_type)
+		{
+			case DT_REG: entry.type = WOW_WALK_FILE; break;
+			case DT_DIR: entry.type = WOW_WALK_DIR; break;
+			case DT_LNK: entry.type = WOW_WALK_LINK; break;
+			case DT_UNKNOWN:
+#endif
+			{
+				/* the filesystem didn't say, so ask */
+				struct stat s;
+				if (!fstatat(dirfd(node->dir), name, &s, AT_SYMLINK_NOFOLLOW))
+				{
+					if (S_ISREG(s.st_mode))
+						entry.type = WOW_WALK_FILE;
+					else if (S_ISDIR(s.st_mode))
+						entry.type = WOW_WALK_DIR;
+					else if (S_ISLNK(s.st_mode))
+						entry.type = WOW_WALK_LINK;
+				}
+			}
+#if defined(DT_UNKNOWN)
+				break;
+		}
+#endif
+		
+		act = walk->func(&entry, walk->udata);
+		
+		if (act == WOW_WALK_STOP)
+		{
+			__atomic_store_n(&walk->stop, 1, __ATOMIC_RELAXED);
+			break;
+		}
+		
+		if (entry.type == WOW_WALK_DIR && act != WOW_WALK_PRUNE)
+		{
+			struct private_walk_item *child = wow_malloc_die(sizeof(*child));
+			
+			child->path = wow_memdup_die(wk->path, path_len + name_len + 2);
+			child->name_ofs = path_len + 1;
+			child->depth = item->depth + 1;
+			child->parent = node;
+			__atomic_add_fetch(&node->refs, 1, __ATOMIC_RELAXED);
+			private_walk_push(walk, wk->index, child);
+		}
+	}
+	
+	private_walk_release(node);
+}
+
+/* worker loop, shared by the calling thread and any helpers */
+static
+void *
+private_walk_worker(void *udata)
+{
+	struct private_walk_worker *wk = udata;
+	struct private_walk *walk = wk->walk;
+	struct private_walk_item *item;
+	
+	for (;;)
+	{
+#ifdef WOW_USE_PTHREAD
+		long seen = __atomic_load_n(&walk->generation, __ATOMIC_SEQ_CST);
+#endif
+		
+		if ((item = private_walk_pop(walk, wk->index)))
+		{
+			if (!__atomic_load_n(&walk->stop, __ATOMIC_RELAXED))
+				private_walk_read(wk, item);
+			private_walk_free_item(item);
+			
+			if (!__atomic_sub_fetch(&walk->pending, 1, __ATOMIC_SEQ_CST))
+			{
+#ifdef WOW_USE_PTHREAD
+				/* that was the last one: wake everyone to leave */
+				pthread_mutex_lock(&walk->idle_lock);
+				pthread_cond_broadcast(&walk->idle_cond);
+				pthread_mutex_unlock(&walk->idle_lock);
+#endif
+			}
+			continue;
+		}
+		
+		if (!__atomic_load_n(&walk->pending, __ATOMIC_SEQ_CST))
+			break;
+		
+#ifdef WOW_USE_PTHREAD
+		/* everything left is being read by other threads; *
+		 * wait for one of them to queue something more    */
+		pthread_mutex_lock(&walk->idle_lock);
+		__atomic_add_fetch(&walk->sleepers, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&walk->generation, __ATOMIC_SEQ_CST) == seen
+			&& __atomic_load_n(&walk->pending, __ATOMIC_SEQ_CST)
+		)
+			pthread_cond_wait(&walk->idle_cond, &walk->idle_lock);
+		__atomic_sub_fetch(&walk->sleepers, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&walk->idle_lock);
+#endif
+	}
+	
+	return 0;
+}
+
+#endif /* ! _WIN32 */
+
+
+/* calls func for everything inside root, recursively; entry *
+ * types come from readdir where possible, so there is no    *
+ * stat per entry; with WOW_USE_PTHREAD, subdirectories are  *
+ * shared between 'threads' threads (0 = one per processor), *
+ * in which case func is called from all of them at once;    *
+ * a directory that can't be opened or read is reported to   *
+ * func again as WOW_WALK_ERROR; returns 0 when done, 1 if   *
+ * stopped, 2 if done but some directories were unreadable,  *
+ * -1 if root can't be opened                                */
+WOW_API_PREFIX
+int
+wow_walk(char const *root, int threads, wow_walk_func func, void *udata)
+{
+	if (!root || !func)
+		return -1;
+	
+#if defined(_WIN32)
+	(void)threads; /* unused parameter */
+	char *path = wow_strdup_die(root);
+	int errors = 0;
+	int rval = private_walk_win32(path, strlen(path), 0, 0, func, udata, &errors);
+	wow_free(path);
+	return (!rval && errors) ? 2 : rval;
+#else /* ! _WIN32 */
+	struct private_walk walk;
+	struct private_walk_worker *workers;
+	struct private_walk_item *item;
+	int fd;
+	int i;
+	
+	/* make sure root can be opened before getting started */
+	if ((fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+		return -1;
+	close(fd);
+	
+#ifdef WOW_USE_PTHREAD
+	if (threads <= 0)
+	{
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (n > 0) ? n : 1;
+	}
+	if (threads > 64)
+		threads = 64;
+#else
+	threads = 1;
+#endif
+	
+	memset(&walk, 0, sizeof(walk));
+	walk.func = func;
+	walk.udata = udata;
+	walk.nqueues = threads;
+	walk.queues = wow_calloc_die(threads, sizeof(*walk.queues));
+	workers = wow_calloc_die(threads, sizeof(*workers));
+	for (i = 0; i < threads; ++i)
+	{
+#ifdef WOW_USE_PTHREAD
+		pthread_mutex_init(&walk.queues[i].lock, 0);
+#endif
+		workers[i].walk = &walk;
+		workers[i].index = i;
+	}
+#ifdef WOW_USE_PTHREAD
+	pthread_mutex_init(&walk.idle_lock, 0);
+	pthread_cond_init(&walk.idle_cond, 0);
+#endif
+	
+	item = wow_calloc_die(1, sizeof(*item));
+	item->path = wow_strdup_die(root);
+	private_walk_push(&walk, 0, item);
+	
+	/* the calling thread is worker 0 */
+#ifdef WOW_USE_PTHREAD
+	{
+		pthread_t tid[64];
+		int started = 0;
+		
+		while (started < threads - 1
+			&& !pthread_create(&tid[started], 0, private_walk_worker, &workers[started + 1])
+		)
+			started += 1;
+		private_walk_worker(&workers[0]);
+		while (started)
+			pthread_join(tid[--started], 0);
+	}
+#else
+	private_walk_worker(&workers[0]);
+#endif
+	
+	for (i = 0; i < threads; ++i)
+	{
+#ifdef WOW_USE_PTHREAD
+		pthread_mutex_destroy(&walk.queues[i].lock);
+#endif
+		wow_free(walk.queues[i].items);
+		wow_free(workers[i].path);
+	}
+#ifdef WOW_USE_PTHREAD
+	pthread_cond_destroy(&walk.idle_cond);
+	pthread_mutex_destroy(&walk.idle_lock);
+#endif
+	wow_free(walk.queues);
+	wow_free(workers);
+	
+	if (walk.stop)
+		return 1;
+	
+	return walk.errors ? 2 : 0;
+#endif /* ! _WIN32 */
+}
+
+#endif /* WOW_IMPLEMENTATION */
+
+
+/* cached directory listings */
+
+/* an entry in a cached listing */
+struct wow_dircache_entry
+{
+	const char *name;
+	enum wow_walk_type type;
+};
+
+/* a set of cached directory listings; on linux each directory is *
+ * watched with inotify, and only entries that changed since the *
+ * last listing are looked at again; elsewhere a directory is    *
+ * read again whenever its modification time changes (win32:    *
+ * every time)                                                   */
+struct wow_dircache;
+
+
+/* creates an empty cache */
+WOW_API_PREFIX
+struct wow_dircache *
+wow_dircache_new(void);
+
+
+/* frees a cache and every listing it handed out */
+WOW_API_PREFIX
+void
+wow_dircache_free(struct wow_dircache *cache);
+
+
+/* lists a directory ('.' and '..' excluded, in no particular *
+ * order); the listing stays valid until the next call for   *
+ * the same path; returns 0 if the directory can't be read   */
+WOW_API_PREFIX
+const struct wow_dircache_entry *
+wow_dircache_list(struct wow_dircache *cache, char const *path, size_t *count);
+
+
+#ifdef WOW_IMPLEMENTATION
+
+#ifdef __linux__
+ #include <sys/inotify.h>
+#endif
+
+#define WOW_DIRCACHE_DEAD ((size_t)-1)
+
+/* a cached directory; names live back to back in one block */
+struct private_dircache_dir
+{
+	char *path;
+	int wd;        /* inotify watch, or -1 to go by modification time */
+	int stale;     /* needs to be read in full */
+	int dirty;     /* list needs rebuilding */
+	time_t mtime;
+	long mtime_ns;
+	off_t size;
+	nlink_t nlink;
+	char *names;
+	size_t names_len;
+	size_t names_cap;
+	size_t names_dead;
+	struct {
+		size_t name;  /* offset into names, or WOW_DIRCACHE_DEAD */
+		enum wow_walk_type type;
+	} *ents;
+	size_t ents_count;
+	size_t ents_cap;
+	size_t *hash;      /* entry index + 1; 0 = empty, DEAD = removed */
+	size_t hash_cap;
+	size_t hash_used;  /* including removed */
+	struct wow_dircache_entry *list; /* last listing, names included */
+	size_t list_count;
+};
+
+struct wow_dircache
+{
+	int ifd; /* inotify, or -1 */
+	struct private_dircache_dir **dirs;
+	size_t dirs_count;
+	size_t dirs_cap;
+	struct private_dircache_dir **table; /* dirs by path hash, 0 = empty */
+	size_t table_cap;
+};
+
+static
+size_t
+private_dircache_hash(const char *name)
+{
+	size_t h = 2166136261u;
+	
+	while (*name)
+		h = (h ^ (unsigned char)*name++) * 16777619u;
+	
+	return h;
+}
+
+/* returns the table slot that holds path, or the empty slot where it would go */
+static
+struct private_dircache_dir **
+private_dircache_find(struct wow_dircache *cache, const char *path)
+{
+	size_t mask = cache->table_cap - 1;
+	size_t i = private_dircache_hash(path) & mask;
+	
+	while (cache->table[i] && strcmp(cache->table[i]->path, path))
+		i = (i + 1) & mask;
+	
+	return &cache->table[i];
+}
+
+/* returns the hash slot that holds name, or the empty slot where it would go */
+static
+size_t *
+private_dircache_slot(struct private_dircache_dir *d, const char *name)
+{
+	size_t mask = d->hash_cap - 1;
+	size_t i = private_dircache_hash(name) & mask;
+	size_t *tomb = 0;
+	
+	for (;; i = (i + 1) & mask)
+	{
+		size_t v = d->hash[i];
+		
+		if (!v)
+			return tomb ? tomb : &d->hash[i];
+		if (v == WOW_DIRCACHE_DEAD)
+		{
+			if (!tomb)
+				tomb = &d->hash[i];
+			continue;
+		}
+		if (!strcmp(d->names + d->ents[v - 1].name, name))
+			return &d->hash[i];
+	}
+}
+
+/* rebuilds the hash table, dropping removed entries */
+static
+void
+private_dircache_rehash(struct private_dircache_dir *d, size_t want)
+{
+	size_t i;
+	
+	while (d->hash_cap < want * 2)
+		d->hash_cap = d->hash_cap ? d->hash_cap * 2 : 64;
+	
+	wow_free(d->hash);
+	d->hash = wow_calloc_die(d->hash_cap, sizeof(*d->hash));
+	d->hash_used = 0;
+	
+	for (i = 0; i < d->ents_count; ++i)
+	{
+		if (d->ents[i].name == WOW_DIRCACHE_DEAD)
+			continue;
+		*private_dircache_slot(d, d->names + d->ents[i].name) = i + 1;
+		d->hash_used += 1;
+	}
+}
+
+/* squeezes out removed names and entries */
+static
+void
+private_dircache_compact(struct private_dircache_dir *d)
+{
+	size_t len = 0;
+	size_t n = 0;
+	size_t i;
+	
+	for (i = 0; i < d->ents_count; ++i)
+	{
+		size_t ofs = d->ents[i].name;
+		size_t sz;
+		
+		if (ofs == WOW_DIRCACHE_DEAD)
+			continue;
+		sz = strlen(d->names + ofs) + 1;
+		memmove(d->names + len, d->names + ofs, sz);
+		d->ents[n].name = len;
+		d->ents[n].type = d->ents[i].type;
+		len += sz;
+		n += 1;
+	}
+	d->names_len = len;
+	d->names_dead = 0;
+	d->ents_count = n;
+	private_dircache_rehash(d, n);
+}
+
+static
+void
+private_dircache_add(struct private_dircache_dir *d, const char *name, enum wow_walk_type type)
+{
+	size_t len = strlen(name) + 1;
+	size_t *slot;
+	
+	if ((d->hash_used + 1) * 2 > d->hash_cap)
+		private_dircache_rehash(d, d->ents_count + 1);
+	
+	/* inotify can report entries that were already read */
+	slot = private_dircache_slot(d, name);
+	if (*slot && *slot != WOW_DIRCACHE_DEAD)
+	{
+		d->ents[*slot - 1].type = type;
+		d->dirty = 1;
+		return;
+	}
+	
+	if (d->names_len + len > d->names_cap)
+	{
+		d->names_cap = (d->names_len + len) * 2;
+		d->names = wow_realloc_die(d->names, d->names_cap);
+	}
+	if (d->ents_count == d->ents_cap)
+	{
+		d->ents_cap = d->ents_cap ? d->ents_cap * 2 : 64;
+		d->ents = wow_realloc_die(d->ents, d->ents_cap * sizeof(*d->ents));
+	}
+	memcpy(d->names + d->names_len, name, len);
+	d->ents[d->ents_count].name = d->names_len;
+	d->ents[d->ents_count].type = type;
+	d->names_len += len;
+	d->ents_count += 1;
+	if (!*slot)
+		d->hash_used += 1;
+	*slot = d->ents_count;
+	d->dirty = 1;
+}
+
+static
+void
+private_dircache_remove(struct private_dircache_dir *d, const char *name)
+{
+	size_t *slot;
+	
+	if (!d->hash_cap)
+		return;
+	
+	slot = private_dircache_slot(d, name);
+	if (!*slot || *slot == WOW_DIRCACHE_DEAD)
+		return;
+	
+	d->names_dead += strlen(name) + 1;
+	d->ents[*slot - 1].name = WOW_DIRCACHE_DEAD;
+	*slot = WOW_DIRCACHE_DEAD;
+	d->dirty = 1;
+	
+	if (d->names_dead > 4096 && d->names_dead * 2 > d->names_len)
+		private_dircache_compact(d);
+}
+
+/* looks up the type of one entry that inotify reported */
+static
+enum wow_walk_type
+private_dircache_type(struct private_dircache_dir *d, const char *name)
+{
+#if defined(_WIN32)
+	enum wow_walk_type type;
+	char *p = wow_malloc_die(strlen(d->path) + strlen(name) + 2);
+	
+	sprintf(p, "%s/%s", d->path, name);
+	type = wow_is_dir(p) ? WOW_WALK_DIR : WOW_WALK_FILE;
+	wow_free(p);
+	
+	return type;
+#else
+	enum wow_walk_type type = WOW_WALK_OTHER;
+	char *p = wow_malloc_die(strlen(d->path) + strlen(name) + 2);
+	struct stat s;
+	
+	sprintf(p, "%s/%s", d->path, name);
+	if (!lstat(p, &s))
+	{
+		if (S_ISREG(s.st_mode))
+			type = WOW_WALK_FILE;
+		else if (S_ISDIR(s.st_mode))
+			type = WOW_WALK_DIR;
+		else if (S_ISLNK(s.st_mode))
+			type = WOW_WALK_LINK;
+	}
+	wow_free(p);
+	
+	return type;
+#endif
+}
+
+#if !defined(_WIN32)
+/* sub-second part of a modification time, where there is one */
+static
+long
+private_dircache_mtime_ns(struct stat *s)
+{
+#if defined(__linux__)
+	return s->st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+	return s->st_mtimespec.tv_nsec;
+#else
+	(void)s; /* unused parameter */
+	return 0;
+#endif
+}
+#endif
+
+/* reads a directory in full; returns non-zero if it can't be read */
+static
+int
+private_dircache_scan(struct wow_dircache *cache, struct private_dircache_dir *d)
+{
+	struct wow_dirent *ep;
+	wow_DIR *dir;
+	
+#ifdef __linux__
+	/* watch first, so nothing that happens during the scan is missed */
+	if (d->wd < 0 && cache->ifd >= 0)
+		d->wd = inotify_add_watch(cache->ifd, d->path
+			, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+			| IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR
+		);
+#else
+	(void)cache; /* unused parameter */
+#endif
+	
+#if !defined(_WIN32)
+	{
+		struct stat s;
+		if (stat(d->path, &s))
+			return -1;
+		d->mtime = s.st_mtime;
+		d->mtime_ns = private_dircache_mtime_ns(&s);
+		d->size = s.st_size;
+		d->nlink = s.st_nlink;
+	}
+#endif
+	
+	if (!(dir = wow_opendir(d->path)))
+		return -1;
+	
+	d->names_len = 0;
+	d->names_dead = 0;
+	d->ents_count = 0;
+	if (d->hash)
+		memset(d->hash, 0, d->hash_cap * sizeof(*d->hash));
+	d->hash_used = 0;
+	
+	while ((ep = wow_readdir(dir)))
+	{
+		const char *name = wow_dirent_dname(ep);
+		enum wow_walk_type type;
+		
+		if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2])))
+			continue;
+		
+#if defined(DT_UNKNOWN)
+		switch (ep->d_type)
+		{
+			case DT_REG: type = WOW_WALK_FILE; break;
+			case DT_DIR: type = WOW_WALK_DIR; break;
+			case DT_LNK: type = WOW_WALK_LINK; break;
+			case DT_UNKNOWN: type = private_dircache_type(d, name); break;
+			default: type = WOW_WALK_OTHER; break;
+		}
+#else
+		type = private_dircache_type(d, name);
+#endif
+		private_dircache_add(d, name, type);
+	}
+	wow_closedir(dir);
+	
+	d->stale = 0;
+	d->dirty = 1;
+	
+	return 0;
+}
+
+#ifdef __linux__
+/* applies queued inotify events to the cached directories */
+static
+void
+private_dircache_events(struct wow_dircache *cache)
+{
+	char buf[16384] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	long long got;
+	
+	if (cache->ifd < 0)
+		return;
+	
+	while ((got = read(cache->ifd, buf, sizeof(buf))) > 0)
+	{
+		char *p;
+		
+		for (p = buf; p < buf + got; )
+		{
+			struct inotify_event *ev = (void*)p;
+			size_t i;
+			
+			p += sizeof(*ev) + ev->len;
+			
+			/* lost track: read everything again */
+			if (ev->mask & IN_Q_OVERFLOW)
+			{
+				for (i = 0; i < cache->dirs_count; ++i)
+					cache->dirs[i]->stale = 1;
+				continue;
+			}
+			
+			/* the same directory can be cached under several paths */
+			for (i = 0; i < cache->dirs_count; ++i)
+			{
+				struct private_dircache_dir *d = cache->dirs[i];
+				
+				if (d->wd != ev->wd)
+					continue;
+				
+				/* the directory itself went away or moved */
+				if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+				{
+					if (ev->mask & IN_MOVE_SELF)
+						inotify_rm_watch(cache->ifd, ev->wd);
+					if (ev->mask & (IN_IGNORED | IN_MOVE_SELF))
+						d->wd = -1;
+					d->stale = 1;
+				}
+				else if (d->stale)
+					continue;
+				else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+					private_dircache_remove(d, ev->name);
+				else if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+					private_dircache_add(d, ev->name
+						, (ev->mask & IN_ISDIR)
+							? WOW_WALK_DIR
+							: private_dircache_type(d, ev->name)
+					);
+			}
+		}
+	}
+}
+#endif /* __linux__ */
+
+
+/* creates an empty cache */
+WOW_API_PREFIX
+struct wow_dircache *
+wow_dircache_new(void)
+{
+	struct wow_dircache *cache = wow_calloc_die(1, sizeof(*cache));
+	
+#ifdef __linux__
+	cache->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#else
+	cache->ifd = -1;
+#endif
+	
+	return cache;
+}
+
+
+/* frees a cache and every listing it handed out */
+WOW_API_PREFIX
+void
+wow_dircache_free(struct wow_dircache *cache)
+{
+	size_t i;
+	
+	if (!cache)
+		return;
+	
+	for (i = 0; i < cache->dirs_count; ++i)
+	{
+		struct private_dircache_dir *d = cache->dirs[i];
+		
+		wow_free(d->path);
+		wow_free(d->names);
+		wow_free(d->ents);
+		wow_free(d->hash);
+		wow_free(d->list);
+		wow_free(d);
+	}
+	if (cache->ifd >= 0)
+		close(cache->ifd);
+	wow_free(cache->dirs);
+	wow_free(cache->table);
+	wow_free(cache);
+}
+
+
+/* lists a directory ('.' and '..' excluded, in no particular *
+ * order); the listing stays valid until the next call for   *
+ * the same path; returns 0 if the directory can't be read   */
+WOW_API_PREFIX
+const struct wow_dircache_entry *
+wow_dircache_list(struct wow_dircache *cache, char const *path, size_t *count)
+{
+	struct private_dircache_dir **slot;
+	struct private_dircache_dir *d;
+	size_t i;
+	
+	if (count)
+		*count = 0;
+	
+	if (!cache || !path)
+		return 0;
+	
+#ifdef __linux__
+	private_dircache_events(cache);
+#endif
+	
+	/* keep the path table at most half full */
+	if ((cache->dirs_count + 1) * 2 > cache->table_cap)
+	{
+		cache->table_cap = cache->table_cap ? cache->table_cap * 2 : 64;
+		wow_free(cache->table);
+		cache->table = wow_calloc_die(cache->table_cap, sizeof(*cache->table));
+		for (i = 0; i < cache->dirs_count; ++i)
+			*private_dircache_find(cache, cache->dirs[i]->path) = cache->dirs[i];
+	}
+	
+	slot = private_dircache_find(cache, path);
+	if (!(d = *slot))
+	{
+		if (cache->dirs_count == cache->dirs_cap)
+		{
+			cache->dirs_cap = cache->dirs_cap ? cache->dirs_cap * 2 : 16;
+			cache->dirs = wow_realloc_die(cache->dirs
+				, cache->dirs_cap * sizeof(*cache->dirs)
+			);
+		}
+		d = wow_calloc_die(1, sizeof(*d));
+		d->path = wow_strdup_die(path);
+		d->wd = -1;
+		d->stale = 1;
+		cache->dirs[cache->dirs_count++] = d;
+		*slot = d;
+	}
+	
+#if defined(_WIN32)
+	/* nothing to go by, so always read it again */
+	d->stale = 1;
+#else
+	/* not watched: go by modification time */
+	if (d->wd < 0 && !d->stale)
+	{
+		struct stat s;
+		if (stat(path, &s)
+			|| s.st_mtime != d->mtime
+			|| private_dircache_mtime_ns(&s) != d->mtime_ns
+			|| s.st_size != d->size
+			|| s.st_nlink != d->nlink
+		)
+			d->stale = 1;
+	}
+#endif
+	
+	if (d->stale && private_dircache_scan(cache, d))
+		return 0;
+	
+	/* the listing gets a copy of the names: events read for other *
+	 * paths change names and ents, but not what was handed out    */
+	if (d->dirty)
+	{
+		struct wow_dircache_entry *list = wow_malloc_die(
+			(d->ents_count + 1) * sizeof(*list) + d->names_len - d->names_dead
+		);
+		char *at = (char*)(list + d->ents_count + 1);
+		
+		d->list_count = 0;
+		for (i = 0; i < d->ents_count; ++i)
+		{
+			const char *name;
+			size_t sz;
+			
+			if (d->ents[i].name == WOW_DIRCACHE_DEAD)
+				continue;
+			name = d->names + d->ents[i].name;
+			sz = strlen(name) + 1;
+			memcpy(at, name, sz);
+			list[d->list_count].name = at;
+			list[d->list_count].type = d->ents[i].type;
+			d->list_count += 1;
+			at += sz;
+		}
+		wow_free(d->list);
+		d->list = list;
+		d->dirty = 0;
+	}
+	
+	if (count)
+		*count = d->list_count;
+	
+	return d->list;
+}
+
+#endif /* WOW_IMPLEMENTATION */
+
 #endif /* WOW_DIRENT_INCLUDED */
 
 
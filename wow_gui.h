@@ -1244,7 +1244,8 @@ font_crisp_draw(
 	int newline_adv = 16; /* advance 8 pixels on newline */
 	int ox = x;
 	int oy = y;
-	int end = strlen(str);
+	const char *s = str;
+	const char *end = str + strlen(str);
 	
 	/* set dimensions = 0 */
 	if (w)
@@ -1252,26 +1253,32 @@ font_crisp_draw(
 	if (h)
 		*h = 0;
 	
-	for (int a = 0; a < end; ++a)
+	while (s < end)
 	{
-		unsigned char c = str[a];
+		const char *at = s;
+		unsigned char c = *s;
+		
+		/* measuring: every ascii character but '\n' is 8 pixels wide */
+		if (w && c < 0x80 && c != '\n')
+		{
+			size_t run = wow_utf8_ascii_run(s, end - s);
+			const char *nl = memchr(s, '\n', run);
+			
+			if (nl)
+				run = nl - s;
+			x += 8 * run;
+			s += run;
+			continue;
+		}
 		
 		/* utf8: make unknown characters display as '?' */
-		if (0xf0 == (0xf8 & c)) {
-			// 4-byte utf8 code point (began with 0b11110xxx)
-			a += 3;
-			c = '?';
-		} else if (0xe0 == (0xf0 & c)) {
-			// 3-byte utf8 code point (began with 0b1110xxxx)
-			a += 2;
-			c = '?';
-		} else if (0xc0 == (0xe0 & c)) {
-			// 2-byte utf8 code point (began with 0b110xxxxx)
-			a += 1;
+		if (c >= 0x80 && c != 0xFF)
+		{
+			wow_utf8_next(&s, end);
 			c = '?';
-		} else { // if (0x00 == (0x80 & *s)) {
-			// 1-byte ascii (began with 0b0xxxxxxx)
 		}
+		else
+			s += 1;
 		
 		switch(c) {
 			case '\n': // newline
@@ -1298,7 +1305,7 @@ font_crisp_draw(
 						, (struct wowGui_rect){8 * (c - ' '), 0, 8, 16}
 						, (struct wowGui_rect){x, y, 8, 16}
 					);
-					wowGui_editcursor(str + a, x, y);
+					wowGui_editcursor(at, x, y);
 				}
 				
 				break;
@@ -1803,22 +1810,7 @@ WOW_GUI_API_PREFIX
 char *
 wowGui_has_extension(char *str)
 {
-	char *slash = strrchr(str, '\\');
-	
-	if (!slash)
-		slash = strrchr(str, '/');
-	if (!slash)
-		slash = str;
-	else
-		slash += 1;
-	
-	char *pd = strrchr(str, '.');
-	
-	/* no period, or period occurs before actual name */
-	if (!pd || pd < slash)
-		return 0;
-	
-	return pd + 1;
+	return wow_fnHasExtension(str);
 }
 
 WOW_GUI_API_PREFIX
@@ -1836,21 +1828,7 @@ WOW_GUI_API_PREFIX
 int
 wowGui_force_extension(char **str, const char *ext)
 {
-	int len;
-	
-	/* is already desirable extension */
-	if (wowGui_is_extension(wowGui_has_extension(*str), ext))
-		return 0;
-	
-	len = strlen(*str);
-	*str = realloc(*str, len + strlen(ext) + 16);
-	/* memory error */
-	if (!*str)
-		return 1;
-	strcat(*str, ".");
-	strcat(*str, ext);
-	
-	return 0;
+	return wow_fnForceExtension(str, ext);
 }
 
 /* forces string to end in extension (returns non-zero on memory failure) */
@@ -1858,31 +1836,7 @@ WOW_GUI_API_PREFIX
 int
 wowGui_change_extension(char **str, const char *ext)
 {
-	char *has;
-	int len;
-	
-	/* has no extension, so append one */
-	has = wowGui_has_extension(*str);
-	if (!has)
-		return wowGui_force_extension(str, ext);
-	
-	/* existing extension is big enough */
-	if (strlen(has) >= strlen(ext))
-	{
-		strcpy(has, ext);
-		return 0;
-	}
-	
-	len = strlen(*str);
-	*str = realloc(*str, len + strlen(ext) + 16);
-	/* memory error */
-	if (!*str)
-		return 1;
-	*has = 0;
-	strcat(*str, ".");
-	strcat(*str, ext);
-	
-	return 0;
+	return wow_fnChangeExtension(str, ext);
 }
 
 
@@ -2090,6 +2044,7 @@ wowGui_window_end(void)
 {
 	struct wowGui_window *win;
 	struct wowGui_target *target;
+	wow_trace_scope("wowGui_window_end");
 	
 	win = wowGui.win;
 	
@@ -2128,6 +2083,7 @@ wowGui_window(struct wowGui_window *win)
 	int mouse_was_in_window = 0;
 	int force_redraw = 0;
 	int mouse_inactive = 0;
+	wow_trace_scope("wowGui_window");
 	
 	/* bind global window structure */
 	wowGui.win = win;
@@ -4978,7 +4934,7 @@ static
 void *
 memdup_safe(void *data, unsigned int size)
 {
-	void *out = wow_malloc_die(size);
+	void *out = wowGui_malloc_die(size);
 	memcpy(out, data, size);
 	return out;
 }
@@ -5926,6 +5882,7 @@ void
 wowGui_bind_result(void)
 {
 	mfb_update_state state;
+	wow_trace_scope("wowGui_bind_result");
 	state = mfb_update(__wowGui_mfbWindow, g_buffer->pixels);
 	if (state != STATE_OK)
 		__wowGui_mfbRunning = 0;
@@ -5980,6 +5937,7 @@ WOW_GUI_API_PREFIX
 void
 wowGui_bind_events(void)
 {
+	wow_trace_scope("wowGui_bind_events");
 	wowGui_u32_t ms = wowGui_bind_ms();
 //	static int c = 0; fprintf(stderr, "events %d\n", c++);
 #if 0 /* FPS counter */